@@ -0,0 +1,867 @@
+// Just one include file - everything is referenced there
+#include "PLCHandlerService.h"
+
+/// LocalCloud HTTP client - every LocalCloud call goes through here
+/// ..one curl share holds the connection cache (+ DNS), shared by a pool of
+/// ..easy handles: a thread takes a handle for one request and gives it back
+/// ..after, so connections stay open (keep-alive) between requests and
+/// ..threads instead of a new TCP connection per request
+/// A handle belongs to one thread between Acquire + Release, the share is
+/// ..locked by curl through LockLocalCloudShare/UnlockLocalCloudShare
+/// URLs are built in one place from g_szIPPort (LocalCloudServer)
+/// Fire-and-forget posts (item status) go through the async engine: one
+/// ..thread drives curl multi over a bounded request queue, upto
+/// ..LCASYNCMAXINFLIGHT posts at once, started in queue order; a failed post
+/// ..stays queued and the queue backs off LCASYNCRETRYMS before retrying,
+/// ..so an outage costs no extra threads or memory - a full queue drops new posts
+/// In-order posts (item status) go out one at a time in queue order, so a
+/// ..later status never overtakes an earlier one, even across retries
+/// Item status is batched: updates within a short window (upto N) are posted
+/// ..as one {"data":[items]} array, LocalCloud answers per item; a batch an
+/// ..old LocalCloud does not take is posted item by item in its place, and
+/// ..items go out singly ({"data":item}) from then on
+
+// Global functions
+void InitLocalCloudClient();
+void CleanupLocalCloudClient();
+void BuildLocalCloudURL(char *pszURL, const char *pszPath);
+CURL *AcquireLocalCloudHandle();
+void ReleaseLocalCloudHandle(CURL *pHandle);
+void SetupLocalCloudHandle(CURL *pHandle, const char *pszPath, const char *pcBody, size_t stBodyLen, struct MemoryStruct *pResp);
+CURLcode LocalCloudRequest(const char *pszPath, const char *pcBody, size_t stBodyLen, struct MemoryStruct *pResp, long *plHTTPCode);
+void StartLocalCloudAsync();
+BOOL LocalCloudPostAsync(const char *pszPath, const char *pszBody, BOOL bInOrder, pfnLCAsyncDone pfnDone);
+BOOL EnqueueAsyncRequest(const char *pszPath, const char *pszBody, BOOL bInOrder, int iItems, const short *psItemStart, const short *psItemEnd, pfnLCAsyncDone pfnDone);
+void *LocalCloudAsyncFunction(void *pArg);
+int StartQueuedRequests(CURLM *pMulti, int iInFlight);
+void FinishAsyncRequest(CURLM *pMulti, CURL *pHandle, CURLcode res, long long *pllRetryAtMS);
+void ConfigureStatusBatching(int iWindowMS, int iMaxItems);
+BOOL QueueItemStatus(const char *pszItem);
+long long FlushStatusBatch(BOOL bNow);
+static BOOL PostStatusBatchLocked();
+int ItemStatusPosted(pLCAsyncRequest pReq, CURLcode res, long lHTTPCode, const char *pszResp);
+int StatusBatchPosted(pLCAsyncRequest pReq, CURLcode res, long lHTTPCode, const char *pszResp);
+static size_t CurlWriterCallback(void *pContents, size_t stSize, size_t stNum, void *pUser);
+static size_t CurlDiscardCallback(void *pContents, size_t stSize, size_t stNum, void *pUser);
+static size_t CurlSlotWriterCallback(void *pContents, size_t stSize, size_t stNum, void *pUser);
+static void LockLocalCloudShare(CURL *pHandle, curl_lock_data Data, curl_lock_access Access, void *pUser);
+static void UnlockLocalCloudShare(CURL *pHandle, curl_lock_data Data, void *pUser);
+
+// External vars + funcs
+extern char g_szIPPort[22];
+extern BOOL g_bAppDone;
+
+extern void DoLog(const char *pszLogMsg, int iPriority = 0);
+extern long long MonotonicMS();
+
+// Shared connection cache + its locks [one per curl lock data type]
+CURLSH *g_pLCShare = NULL;
+pthread_mutex_t g_lcShareLocks[LCSHARELOCKS];
+
+// Idle easy handles [g_lcPoolLock]
+CURL *g_pLCHandlePool[LCHANDLEPOOLSIZE];
+int g_iLCHandlesIdle = 0;
+pthread_mutex_t g_lcPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// JSON request header [shared by every POST, never changed]
+struct curl_slist *g_pLCJSONHeader = NULL;
+
+// Async engine - request queue [ring from g_iLCQueueHead, the oldest not done,
+// ..g_iLCQueueCount slots long, g_lcQueueLock], its curl multi + thread
+LCAsyncRequest g_LCQueue[LCASYNCQUEUESIZE];
+int g_iLCQueueHead = 0;
+int g_iLCQueueCount = 0;
+int g_iLCQueueDropped = 0;
+pthread_mutex_t g_lcQueueLock = PTHREAD_MUTEX_INITIALIZER;
+CURLM *g_pLCMulti = NULL;
+pthread_t g_tLCAsync;
+BOOL g_bLCAsyncStarted = FALSE;
+
+// Async engine in-flight slots [bUsed under g_lcQueueLock]
+LCInFlight g_LCInFlight[LCASYNCMAXINFLIGHT];
+
+// Open item status batch [g_lcBatchLock] - items comma separated, where each
+// ..starts / ends, when its window is over; batching settings
+char g_szStatusBatch[LCASYNCBODYLEN];
+int g_iStatusBatchLen = 0;
+int g_iStatusBatchItems = 0;
+short g_sStatusBatchStart[LCSTATUSBATCHMAX];
+short g_sStatusBatchEnd[LCSTATUSBATCHMAX];
+long long g_llStatusBatchDueMS = 0;
+int g_iStatusBatchMS = LCSTATUSBATCHMS;
+int g_iStatusBatchMax = LCSTATUSBATCHMAX;
+BOOL g_bStatusBatching = FALSE;
+pthread_mutex_t g_lcBatchLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// Sets up the shared connection cache
+// ..call after curl_global_init, before any LocalCloud call
+void InitLocalCloudClient()
+{
+	for (int i = 0; i < LCSHARELOCKS; i++)
+		pthread_mutex_init(&g_lcShareLocks[i], NULL);
+
+	g_pLCJSONHeader = curl_slist_append(NULL, "Content-Type: application/json");
+
+	g_pLCShare = curl_share_init();
+	if (!g_pLCShare)
+	{
+		DoLog("LocalCloud:: Unable to create connection share, connections wont be shared across requests", 1);
+		return;
+	}
+
+	curl_share_setopt(g_pLCShare, CURLSHOPT_LOCKFUNC, LockLocalCloudShare);
+	curl_share_setopt(g_pLCShare, CURLSHOPT_UNLOCKFUNC, UnlockLocalCloudShare);
+	curl_share_setopt(g_pLCShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+	curl_share_setopt(g_pLCShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+} // void func, no return value
+
+// Stops the async engine [app done], closes pooled handles + the connection cache
+// ..call before curl_global_cleanup, once no LocalCloud call is running
+void CleanupLocalCloudClient()
+{
+	// Engine thread ends within a poll interval of app done
+	if (g_bLCAsyncStarted)
+		pthread_join(g_tLCAsync, NULL);
+	g_bLCAsyncStarted = FALSE;
+
+	pthread_mutex_lock(&g_lcPoolLock);
+	while (g_iLCHandlesIdle > 0)
+		curl_easy_cleanup(g_pLCHandlePool[--g_iLCHandlesIdle]);
+	pthread_mutex_unlock(&g_lcPoolLock);
+
+	if (g_pLCShare)
+		curl_share_cleanup(g_pLCShare);
+	g_pLCShare = NULL;
+
+	curl_slist_free_all(g_pLCJSONHeader);
+	g_pLCJSONHeader = NULL;
+} // void func, no return value
+
+// Builds a LocalCloud API URL
+// Params: [out] URL (1024 chars), API path under /plcio/ e.g "order_queue"
+void BuildLocalCloudURL(char *pszURL, const char *pszPath)
+{
+	snprintf(pszURL, 1024, "http://%s/plcio/%s", g_szIPPort, pszPath);
+}
+
+// Takes an easy handle for one request [from the pool, or a new one]
+// Returns: handle owned by the calling thread until released, NULL on failure
+CURL *AcquireLocalCloudHandle()
+{
+	CURL *pHandle = NULL;
+
+	pthread_mutex_lock(&g_lcPoolLock);
+	if (g_iLCHandlesIdle > 0)
+		pHandle = g_pLCHandlePool[--g_iLCHandlesIdle];
+	pthread_mutex_unlock(&g_lcPoolLock);
+
+	if (!pHandle)
+		pHandle = curl_easy_init();
+
+	return pHandle;
+}
+
+// Gives a handle back to the pool [closed if the pool is full]
+// ..options are reset, connections stay in the shared cache
+void ReleaseLocalCloudHandle(CURL *pHandle)
+{
+	curl_easy_reset(pHandle);
+
+	pthread_mutex_lock(&g_lcPoolLock);
+	if (g_iLCHandlesIdle < LCHANDLEPOOLSIZE)
+	{
+		g_pLCHandlePool[g_iLCHandlesIdle++] = pHandle;
+		pHandle = NULL;
+	}
+	pthread_mutex_unlock(&g_lcPoolLock);
+
+	if (pHandle)
+		curl_easy_cleanup(pHandle);
+}
+
+// Sets a handle up for one LocalCloud request
+// Params: handle, API path under /plcio/, JSON body to POST (NULL = GET) + its
+// ..length [not copied, must outlive the request], response buffer (appended
+// ..to, NULL = response discarded)
+void SetupLocalCloudHandle(CURL *curlEasyHandle, const char *pszPath, const char *pcBody, size_t stBodyLen, struct MemoryStruct *pResp)
+{
+	char szURL[1024] = {0};
+	BuildLocalCloudURL(szURL, pszPath);
+
+	// This is the URL to fetch
+	curl_easy_setopt(curlEasyHandle, CURLOPT_URL, szURL);
+
+	// Timeout 10 seconds, no signals (we are threaded), keep idle connections alive
+	curl_easy_setopt(curlEasyHandle, CURLOPT_TIMEOUT, 10L);
+	curl_easy_setopt(curlEasyHandle, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curlEasyHandle, CURLOPT_TCP_KEEPALIVE, 1L);
+
+	// Shared connection cache
+	if (g_pLCShare)
+		curl_easy_setopt(curlEasyHandle, CURLOPT_SHARE, g_pLCShare);
+
+	// Writer callback function + Writer object
+	if (pResp)
+	{
+		curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlWriterCallback);
+		curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEDATA, (void *)pResp);
+	}
+	else
+		curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlDiscardCallback);
+
+	// POST request? Body is sent as is [not copied]
+	if (pcBody)
+	{
+		curl_easy_setopt(curlEasyHandle, CURLOPT_POST, 1L);
+		curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDS, pcBody);
+		curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDSIZE, (long)stBodyLen);
+		curl_easy_setopt(curlEasyHandle, CURLOPT_HTTPHEADER, g_pLCJSONHeader);
+	}
+} // void func, no return value
+
+// Does one LocalCloud request on a pooled handle - blocking
+// Params: API path under /plcio/, JSON body to POST (NULL = GET) + its length,
+// ..response buffer (appended to), [out, optional] HTTP status
+// Returns: curl result
+CURLcode LocalCloudRequest(const char *pszPath, const char *pcBody, size_t stBodyLen, struct MemoryStruct *pResp, long *plHTTPCode)
+{
+	if (plHTTPCode)
+		*plHTTPCode = 0;
+
+	CURL *curlEasyHandle = AcquireLocalCloudHandle();
+	if (!curlEasyHandle)
+		return CURLE_FAILED_INIT;
+
+	SetupLocalCloudHandle(curlEasyHandle, pszPath, pcBody, stBodyLen, pResp);
+
+	// Fetch it - this is a blocking call
+	CURLcode res = curl_easy_perform(curlEasyHandle);
+
+	if (res == CURLE_OK && plHTTPCode)
+		curl_easy_getinfo(curlEasyHandle, CURLINFO_RESPONSE_CODE, plHTTPCode);
+
+	ReleaseLocalCloudHandle(curlEasyHandle);
+
+	return res;
+} // end of LocalCloud request func
+
+// Starts the async engine thread
+// ..call after InitLocalCloudClient
+void StartLocalCloudAsync()
+{
+	g_pLCMulti = curl_multi_init();
+	if (!g_pLCMulti)
+	{
+		DoLog("LocalCloud:: Unable to create async engine, async posts will be dropped", 1);
+		return;
+	}
+
+	curl_multi_setopt(g_pLCMulti, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long)LCASYNCMAXINFLIGHT);
+
+	if (pthread_create(&g_tLCAsync, NULL, &LocalCloudAsyncFunction, NULL) == 0)
+		g_bLCAsyncStarted = TRUE;
+	else
+		DoLog("LocalCloud:: Unable to start async engine thread", 1);
+} // void func, no return value
+
+// Queues a LocalCloud POST on the async engine - never blocks on the network
+// Params: API path under /plcio/, JSON body [upto LCASYNCBODYLEN - 1 chars],
+// ..in order? [starts once earlier in-order posts are done], [optional]
+// ..callback once it is posted (engine thread)
+// Returns: FALSE if it was dropped (queue full, engine not running, body too long)
+BOOL LocalCloudPostAsync(const char *pszPath, const char *pszBody, BOOL bInOrder, pfnLCAsyncDone pfnDone)
+{
+	return EnqueueAsyncRequest(pszPath, pszBody, bInOrder, 0, NULL, NULL, pfnDone);
+}
+
+// Queues a request on the async engine [LocalCloudPostAsync + batches]
+// Params: API path, JSON body, in order?, # batch items + where each starts /
+// ..ends in the body (0, NULL, NULL = not a batch), [optional] callback
+// Returns: FALSE if it was dropped
+BOOL EnqueueAsyncRequest(const char *pszPath, const char *pszBody, BOOL bInOrder, int iItems, const short *psItemStart, const short *psItemEnd, pfnLCAsyncDone pfnDone)
+{
+	char szMsg[1024] = {0};
+	int iBodyLen = strlen(pszBody);
+
+	if (!g_bLCAsyncStarted || iBodyLen >= LCASYNCBODYLEN || strlen(pszPath) >= sizeof(g_LCQueue[0].szPath) || iItems > LCSTATUSBATCHMAX)
+	{
+		sprintf(szMsg, "LocalCloud:: Async post to [%s] dropped [engine %s, body %d chars, %d items]", \
+			pszPath, g_bLCAsyncStarted ? "running" : "not running", iBodyLen, iItems);
+		DoLog(szMsg, 1);
+		return FALSE;
+	}
+
+	pthread_mutex_lock(&g_lcQueueLock);
+
+	// Full? LocalCloud has been away for a while
+	if (g_iLCQueueCount == LCASYNCQUEUESIZE)
+	{
+		int iDropped = ++g_iLCQueueDropped;
+		pthread_mutex_unlock(&g_lcQueueLock);
+
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Async queue full, post to [%s] dropped [%d dropped so far] [%s]", pszPath, iDropped, pszBody);
+		DoLog(szMsg, 1);
+		return FALSE;
+	}
+
+	pLCAsyncRequest pReq = &g_LCQueue[(g_iLCQueueHead + g_iLCQueueCount) % LCASYNCQUEUESIZE];
+	strcpy(pReq->szPath, pszPath);
+	memcpy(pReq->szBody, pszBody, iBodyLen + 1);
+	pReq->iBodyLen = iBodyLen;
+	pReq->iTries = 0;
+	pReq->bInOrder = bInOrder;
+	pReq->iItems = iItems;
+	for (int i = 0; i < iItems; i++)
+	{
+		pReq->sItemStart[i] = psItemStart[i];
+		pReq->sItemEnd[i] = psItemEnd[i];
+	}
+	pReq->bSplit = FALSE;
+	pReq->iNextItem = 0;
+	pReq->iSlot = -1;
+	pReq->pfnDone = pfnDone;
+	pReq->iState = LCREQQUEUED;
+	g_iLCQueueCount++;
+
+	pthread_mutex_unlock(&g_lcQueueLock);
+
+	// Wake the engine up
+	curl_multi_wakeup(g_pLCMulti);
+
+	return TRUE;
+} // end of enqueue func
+
+// Async engine thread
+// ..posts due status batches, starts queued requests, drives the transfers
+// ..+ completes them until app done
+void *LocalCloudAsyncFunction(void *pArg)
+{
+	int iInFlight = 0;
+	long long llRetryAtMS = 0;
+
+	while (!g_bAppDone)
+	{
+		// Status batch window over? Queue it [ms until the next one is due, 0 = none]
+		long long llBatchDueMS = FlushStatusBatch(FALSE);
+
+		// Start queued requests [unless backing off after a failure]
+		if (MonotonicMS() >= llRetryAtMS)
+			iInFlight = StartQueuedRequests(g_pLCMulti, iInFlight);
+
+		// Move the transfers along
+		int iRunning = 0;
+		curl_multi_perform(g_pLCMulti, &iRunning);
+
+		// Any finished?
+		struct CURLMsg *pMsg;
+		int iLeft = 0;
+		BOOL bFinished = FALSE;
+		while ((pMsg = curl_multi_info_read(g_pLCMulti, &iLeft)))
+		{
+			if (pMsg->msg != CURLMSG_DONE)
+				continue;
+
+			FinishAsyncRequest(g_pLCMulti, pMsg->easy_handle, pMsg->data.result, &llRetryAtMS);
+			iInFlight--;
+			bFinished = TRUE;
+		}
+
+		// Finished some? The next in-order request (or its next item) can go now
+		if (bFinished)
+			continue;
+
+		// Wait for socket activity, a new request, the retry time or the batch
+		// ..window [upto 1s - app done check]
+		long long llWaitMS = 1000;
+		if (!iInFlight && llRetryAtMS > MonotonicMS())
+			llWaitMS = llRetryAtMS - MonotonicMS();
+		if (llBatchDueMS && llBatchDueMS < llWaitMS)
+			llWaitMS = llBatchDueMS;
+		curl_multi_poll(g_pLCMulti, NULL, 0, llWaitMS < 1000 ? (int)llWaitMS : 1000, NULL);
+	} // end of engine loop
+
+	// Cleanup - requests still in flight are lost with the app
+	pthread_mutex_lock(&g_lcQueueLock);
+	for (int i = 0; i < g_iLCQueueCount; i++)
+		g_LCQueue[(g_iLCQueueHead + i) % LCASYNCQUEUESIZE].iState = LCREQFREE;
+	g_iLCQueueCount = 0;
+	pthread_mutex_unlock(&g_lcQueueLock);
+
+	curl_multi_cleanup(g_pLCMulti);
+	g_pLCMulti = NULL;
+
+	return NULL;
+} // end of async engine thread
+
+// Starts queued requests in queue order, upto LCASYNCMAXINFLIGHT at once
+// ..an in-order request waits for the in-order requests ahead of it
+// Params: multi handle, # in flight
+// Returns: # in flight now
+int StartQueuedRequests(CURLM *pMulti, int iInFlight)
+{
+	BOOL bInOrderBusy = FALSE;
+
+	pthread_mutex_lock(&g_lcQueueLock);
+
+	for (int i = 0; i < g_iLCQueueCount && iInFlight < LCASYNCMAXINFLIGHT; i++)
+	{
+		int iIdx = (g_iLCQueueHead + i) % LCASYNCQUEUESIZE;
+		pLCAsyncRequest pReq = &g_LCQueue[iIdx];
+
+		if (pReq->iState != LCREQQUEUED && pReq->iState != LCREQINFLIGHT)
+			continue;
+
+		// In-order lane - only its oldest request goes out
+		BOOL bWait = (pReq->bInOrder && bInOrderBusy);
+		if (pReq->bInOrder)
+			bInOrderBusy = TRUE;
+
+		if (pReq->iState != LCREQQUEUED || bWait)
+			continue;
+
+		// Free in-flight slot [one per request in flight, so always one]
+		int iSlot = 0;
+		while (iSlot < LCASYNCMAXINFLIGHT && g_LCInFlight[iSlot].bUsed)
+			iSlot++;
+		if (iSlot == LCASYNCMAXINFLIGHT)
+			break;
+		pLCInFlight pSlot = &g_LCInFlight[iSlot];
+
+		CURL *pHandle = AcquireLocalCloudHandle();
+		if (!pHandle)
+			break;
+
+		// Body stays put in its queue slot until the request is done, a split
+		// ..batch posts its next item from the in-flight slot
+		const char *pcBody = pReq->szBody;
+		int iBodyLen = pReq->iBodyLen;
+		if (pReq->bSplit)
+		{
+			int iItem = pReq->iNextItem;
+			iBodyLen = snprintf(pSlot->szBody, sizeof(pSlot->szBody), "{\"data\":%.*s}", \
+				pReq->sItemEnd[iItem] - pReq->sItemStart[iItem], pReq->szBody + pReq->sItemStart[iItem]);
+			pcBody = pSlot->szBody;
+		}
+
+		SetupLocalCloudHandle(pHandle, pReq->szPath, pcBody, iBodyLen, NULL);
+		curl_easy_setopt(pHandle, CURLOPT_WRITEFUNCTION, CurlSlotWriterCallback);
+		curl_easy_setopt(pHandle, CURLOPT_WRITEDATA, (void *)pSlot);
+		curl_easy_setopt(pHandle, CURLOPT_PRIVATE, (void *)(intptr_t)iIdx);
+
+		if (curl_multi_add_handle(pMulti, pHandle) != CURLM_OK)
+		{
+			ReleaseLocalCloudHandle(pHandle);
+			break;
+		}
+
+		pSlot->bUsed = TRUE;
+		pSlot->stResp = 0;
+		pSlot->szResp[0] = 0;
+		pReq->iSlot = iSlot;
+		pReq->iState = LCREQINFLIGHT;
+		iInFlight++;
+	}
+
+	pthread_mutex_unlock(&g_lcQueueLock);
+
+	return iInFlight;
+}
+
+// Completes a finished request - done (callback, slot freed) or queued
+// ..again: after LCASYNCRETRYMS when it failed or its callback asks for a
+// ..retry, at once when its callback asks for a repost
+// Params: multi handle, the request's easy handle, curl result, [in/out] retry time
+void FinishAsyncRequest(CURLM *pMulti, CURL *pHandle, CURLcode res, long long *pllRetryAtMS)
+{
+	char *pPrivate = NULL;
+	long lHTTPCode = 0;
+
+	curl_easy_getinfo(pHandle, CURLINFO_PRIVATE, &pPrivate);
+	if (res == CURLE_OK)
+		curl_easy_getinfo(pHandle, CURLINFO_RESPONSE_CODE, &lHTTPCode);
+
+	curl_multi_remove_handle(pMulti, pHandle);
+	ReleaseLocalCloudHandle(pHandle);
+
+	pLCAsyncRequest pReq = &g_LCQueue[(intptr_t)pPrivate];
+	pLCInFlight pSlot = &g_LCInFlight[pReq->iSlot];
+	pReq->iTries++;
+
+	// Posted? Callback decides what is next
+	int iResult = LCCBRETRY;
+	if (res == CURLE_OK)
+		iResult = pReq->pfnDone ? pReq->pfnDone(pReq, res, lHTTPCode, pSlot->szResp) : LCCBDONE;
+	else
+	{
+		char szMsg[1024] = {0};
+		sprintf(szMsg, "LocalCloud:: Error posting to [%s] [%s] try %d, retrying in %d ms", \
+			pReq->szPath, curl_easy_strerror(res), pReq->iTries, LCASYNCRETRYMS);
+		DoLog(szMsg, 1);
+	}
+
+	pthread_mutex_lock(&g_lcQueueLock);
+	pSlot->bUsed = FALSE;
+
+	// Failed / callback wants it posted again? It keeps its place [first in
+	// ..line], a retry once the queue has backed off
+	if (iResult != LCCBDONE)
+	{
+		pReq->iState = LCREQQUEUED;
+		pthread_mutex_unlock(&g_lcQueueLock);
+
+		if (iResult == LCCBRETRY)
+			*pllRetryAtMS = MonotonicMS() + LCASYNCRETRYMS;
+		return;
+	}
+
+	// Free its slot + any done slots at the head of the queue
+	pReq->iState = LCREQDONE;
+	while (g_iLCQueueCount > 0 && g_LCQueue[g_iLCQueueHead].iState == LCREQDONE)
+	{
+		g_LCQueue[g_iLCQueueHead].iState = LCREQFREE;
+		g_iLCQueueHead = (g_iLCQueueHead + 1) % LCASYNCQUEUESIZE;
+		g_iLCQueueCount--;
+	}
+	pthread_mutex_unlock(&g_lcQueueLock);
+} // void func, no return value
+
+// Sets item status batching up [PLCStatusBatchMS / PLCStatusBatchMax]
+// ..call before the first status is queued
+// Params: window in ms (0 = no batching), max items per batch
+void ConfigureStatusBatching(int iWindowMS, int iMaxItems)
+{
+	char szMsg[1024] = {0};
+
+	if (iWindowMS < 0)
+		iWindowMS = 0;
+	if (iMaxItems < 1 || iMaxItems > LCSTATUSBATCHMAX)
+		iMaxItems = LCSTATUSBATCHMAX;
+
+	g_iStatusBatchMS = iWindowMS;
+	g_iStatusBatchMax = iMaxItems;
+	g_bStatusBatching = (iWindowMS > 0 && iMaxItems > 1);
+
+	if (g_bStatusBatching)
+		sprintf(szMsg, "LocalCloud:: Item status posts batched [%d ms window, upto %d items]", iWindowMS, iMaxItems);
+	else
+		sprintf(szMsg, "LocalCloud:: Item status posts not batched");
+	DoLog(szMsg, 1);
+} // void func, no return value
+
+// Queues one item status for LocalCloud [update_order_item_status]
+// ..batching: added to the open batch, posted when the window is over or it
+// ..is full; else posted on its own as {"data":item}
+// ..either way status posts go out in the order they were queued
+// Params: item JSON object {"dispense_id":..,"status":..,"order_stub":..}
+// Returns: FALSE if it was dropped
+BOOL QueueItemStatus(const char *pszItem)
+{
+	int iItemLen = strlen(pszItem);
+	BOOL bQueued = TRUE;
+
+	// Too long for any body?
+	if (iItemLen + 11 >= LCASYNCBODYLEN)
+	{
+		char szMsg[2048] = {0};
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Item status too long [%d chars], dropped %s", iItemLen, pszItem);
+		DoLog(szMsg, 1);
+		return FALSE;
+	}
+
+	pthread_mutex_lock(&g_lcBatchLock);
+
+	// Not batching [any more]? Batch still open goes first, it has older items
+	if (!g_bStatusBatching)
+	{
+		if (g_iStatusBatchItems)
+			PostStatusBatchLocked();
+
+		char szData[LCASYNCBODYLEN] = {0};
+		snprintf(szData, sizeof(szData), "{\"data\":%s}", pszItem);
+		bQueued = LocalCloudPostAsync("update_order_item_status", szData, TRUE, ItemStatusPosted);
+
+		pthread_mutex_unlock(&g_lcBatchLock);
+		return bQueued;
+	}
+
+	// No room for it? Post what is there first [body is {"data":[items]}]
+	if (g_iStatusBatchItems && 11 + g_iStatusBatchLen + 1 + iItemLen >= LCASYNCBODYLEN)
+		bQueued = PostStatusBatchLocked();
+
+	if (g_iStatusBatchItems)
+		g_szStatusBatch[g_iStatusBatchLen++] = ',';
+	else
+		g_llStatusBatchDueMS = MonotonicMS() + g_iStatusBatchMS;
+
+	memcpy(g_szStatusBatch + g_iStatusBatchLen, pszItem, iItemLen + 1);
+	g_sStatusBatchStart[g_iStatusBatchItems] = g_iStatusBatchLen;
+	g_iStatusBatchLen += iItemLen;
+	g_sStatusBatchEnd[g_iStatusBatchItems] = g_iStatusBatchLen;
+	BOOL bFirst = (++g_iStatusBatchItems == 1);
+
+	if (g_iStatusBatchItems >= g_iStatusBatchMax)
+		bQueued = PostStatusBatchLocked() && bQueued;
+
+	pthread_mutex_unlock(&g_lcBatchLock);
+
+	// New window - wake the engine so it waits for it
+	if (bFirst && g_pLCMulti)
+		curl_multi_wakeup(g_pLCMulti);
+
+	return bQueued;
+} // end of queue item status func
+
+// Posts the open status batch once its window is over [engine thread]
+// Params: post it now, window or not?
+// Returns: ms until the open batch is due, 0 = no batch open
+long long FlushStatusBatch(BOOL bNow)
+{
+	long long llDueMS = 0;
+
+	pthread_mutex_lock(&g_lcBatchLock);
+
+	if (g_iStatusBatchItems)
+	{
+		long long llNowMS = MonotonicMS();
+		if (bNow || llNowMS >= g_llStatusBatchDueMS)
+			PostStatusBatchLocked();
+		else
+			llDueMS = g_llStatusBatchDueMS - llNowMS;
+	}
+
+	pthread_mutex_unlock(&g_lcBatchLock);
+
+	return llDueMS;
+}
+
+// Queues the open status batch as one {"data":[items]} post [in order]
+// ..call with g_lcBatchLock held
+// Returns: FALSE if it was dropped
+static BOOL PostStatusBatchLocked()
+{
+	char szBody[LCASYNCBODYLEN] = {0};
+	short sStart[LCSTATUSBATCHMAX], sEnd[LCSTATUSBATCHMAX];
+	int iPrefixLen = strlen("{\"data\":[");
+
+	snprintf(szBody, sizeof(szBody), "{\"data\":[%.*s]}", g_iStatusBatchLen, g_szStatusBatch);
+	for (int i = 0; i < g_iStatusBatchItems; i++)
+	{
+		sStart[i] = g_sStatusBatchStart[i] + iPrefixLen;
+		sEnd[i] = g_sStatusBatchEnd[i] + iPrefixLen;
+	}
+
+	BOOL bQueued = EnqueueAsyncRequest("update_order_item_status", szBody, TRUE, g_iStatusBatchItems, sStart, sEnd, StatusBatchPosted);
+
+	g_iStatusBatchItems = 0;
+	g_iStatusBatchLen = 0;
+	g_szStatusBatch[0] = 0;
+
+	return bQueued;
+}
+
+// Async engine callback - item status posted on its own
+// ..5xx is retried like a failed post, upto LCSTATUSPOSTTRIES times [a
+// ..restarting LocalCloud answers 502/503]
+// Returns: LCCBDONE when done, LCCBRETRY to post it again
+int ItemStatusPosted(pLCAsyncRequest pReq, CURLcode res, long lHTTPCode, const char *pszResp)
+{
+	char szMsg[2048];
+
+	// LocalCloud not up to it right now? Again once backed off
+	if (lHTTPCode / 100 == 5 && pReq->iTries < LCSTATUSPOSTTRIES)
+	{
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Item status post failed [HTTP %ld] try %d, retrying in %d ms %s", \
+			lHTTPCode, pReq->iTries, LCASYNCRETRYMS, pReq->szBody);
+		DoLog(szMsg, 1);
+		return LCCBRETRY;
+	}
+
+	snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Posted item status [HTTP %ld, %d tries] %s", lHTTPCode, pReq->iTries, pReq->szBody);
+	DoLog(szMsg, lHTTPCode / 100 == 2 ? 2 : 1);
+
+	return LCCBDONE;
+}
+
+// Async engine callback - item status batch posted [or one item of a split batch]
+// ..LocalCloud answers a batch with {"results":[{"dispense_id":..,"ok":..,"error":..}]}
+// ..a batch it does not understand (old LocalCloud - 400/404/415/422) is split
+// ..+ posted an item at a time in its place in the queue, and batching is off
+// ..from then on; 5xx is retried like a failed post, upto LCSTATUSPOSTTRIES
+// ..times before that batch [only] is split - each of its items then gets
+// ..LCSTATUSPOSTTRIES tries of its own
+// Returns: LCCBDONE when done, LCCBREPOST / LCCBRETRY to post (the next item) again
+int StatusBatchPosted(pLCAsyncRequest pReq, CURLcode res, long lHTTPCode, const char *pszResp)
+{
+	char szMsg[2048] = {0};
+
+	// Item of a split batch
+	if (pReq->bSplit)
+	{
+		int iItem = pReq->iNextItem;
+
+		// LocalCloud not up to it right now? This item again once backed off
+		if (lHTTPCode / 100 == 5 && pReq->iTries < LCSTATUSPOSTTRIES)
+		{
+			sprintf(szMsg, "LocalCloud:: Item status post failed [HTTP %ld, item %d/%d] try %d, retrying in %d ms", \
+				lHTTPCode, iItem + 1, pReq->iItems, pReq->iTries, LCASYNCRETRYMS);
+			DoLog(szMsg, 1);
+			return LCCBRETRY;
+		}
+
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Posted item status [HTTP %ld, item %d/%d, %d tries] %.*s", lHTTPCode, iItem + 1, pReq->iItems, \
+			pReq->iTries, pReq->sItemEnd[iItem] - pReq->sItemStart[iItem], pReq->szBody + pReq->sItemStart[iItem]);
+		DoLog(szMsg, lHTTPCode / 100 == 2 ? 2 : 1);
+
+		// Next item [counts its own tries]
+		pReq->iNextItem++;
+		pReq->iTries = 0;
+		return (pReq->iNextItem >= pReq->iItems) ? LCCBDONE : LCCBREPOST;
+	}
+
+	// LocalCloud not up to it right now? Same batch again once backed off
+	if (lHTTPCode / 100 == 5 && pReq->iTries < LCSTATUSPOSTTRIES)
+	{
+		sprintf(szMsg, "LocalCloud:: Item status batch failed [HTTP %ld] try %d, retrying in %d ms", lHTTPCode, pReq->iTries, LCASYNCRETRYMS);
+		DoLog(szMsg, 1);
+		return LCCBRETRY;
+	}
+
+	// Batch not understood? Old LocalCloud - single items from now on
+	if (lHTTPCode == 400 || lHTTPCode == 404 || lHTTPCode == 415 || lHTTPCode == 422)
+	{
+		pthread_mutex_lock(&g_lcBatchLock);
+		BOOL bWasBatching = g_bStatusBatching;
+		g_bStatusBatching = FALSE;
+		pthread_mutex_unlock(&g_lcBatchLock);
+
+		if (bWasBatching)
+		{
+			sprintf(szMsg, "LocalCloud:: Item status batch rejected [HTTP %ld], posting item status one at a time from now on", lHTTPCode);
+			DoLog(szMsg, 1);
+		}
+
+		pReq->bSplit = TRUE;
+		pReq->iNextItem = 0;
+		pReq->iTries = 0;
+		return LCCBREPOST;
+	}
+
+	// Still 5xx after LCSTATUSPOSTTRIES? This batch item by item, batching stays on
+	if (lHTTPCode / 100 == 5)
+	{
+		sprintf(szMsg, "LocalCloud:: Item status batch failed [HTTP %ld] %d tries, posting its items one at a time", lHTTPCode, pReq->iTries);
+		DoLog(szMsg, 1);
+
+		pReq->bSplit = TRUE;
+		pReq->iNextItem = 0;
+		pReq->iTries = 0;
+		return LCCBREPOST;
+	}
+
+	// Any other answer - not taken, nothing to gain posting it again
+	if (lHTTPCode / 100 != 2)
+	{
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Item status batch not taken [HTTP %ld, %d items, %d tries] %s", \
+			lHTTPCode, pReq->iItems, pReq->iTries, pReq->szBody);
+		DoLog(szMsg, 1);
+		return LCCBDONE;
+	}
+
+	// Per-item results
+	json_error_t Err;
+	json_t *pRoot = json_loads(pszResp, 0, &Err);
+	json_t *pResults = pRoot ? json_object_get(pRoot, "results") : NULL;
+
+	if (!pResults || !json_is_array(pResults))
+	{
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Posted item status batch [HTTP %ld, %d items, %d tries, no per-item results] %s", \
+			lHTTPCode, pReq->iItems, pReq->iTries, pReq->szBody);
+		DoLog(szMsg, 2);
+	}
+	else
+	{
+		int iFailed = 0;
+		for (size_t i = 0; i < json_array_size(pResults); i++)
+		{
+			json_t *pResult = json_array_get(pResults, i);
+			json_t *pOK = json_object_get(pResult, "ok");
+			if (pOK && json_is_true(pOK))
+				continue;
+
+			json_t *pError = json_object_get(pResult, "error");
+			iFailed++;
+			snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Item status not taken - dispense id [%d] [%s]", \
+				(int)json_integer_value(json_object_get(pResult, "dispense_id")), \
+				(pError && json_is_string(pError)) ? json_string_value(pError) : "no reason given");
+			DoLog(szMsg, 1);
+		}
+
+		snprintf(szMsg, sizeof(szMsg), "LocalCloud:: Posted item status batch [HTTP %ld, %d items, %d not taken, %d tries] %s", \
+			lHTTPCode, pReq->iItems, iFailed, pReq->iTries, pReq->szBody);
+		DoLog(szMsg, 2);
+	}
+
+	if (pRoot)
+		json_decref(pRoot);
+
+	return LCCBDONE;
+} // end of status batch callback
+
+// Curl Writer callback used for LocalCloud responses
+// See CURLOPT_WRITEFUNCTION spec for desc of this function
+// Parameters: ReadData, Size, # of items, user-specified struct [MemoryStruct]
+static size_t CurlWriterCallback(void *pContents, size_t stSize,
+	size_t stNum, void *pUser)
+{
+	size_t stRealSize = stSize * stNum;
+  struct MemoryStruct *pMem = (struct MemoryStruct *)pUser;
+
+  pMem->pcBuffer = (char *)realloc(pMem->pcBuffer, pMem->stSize + stRealSize + 1);
+
+	// Ran out of memory ?
+  if(pMem->pcBuffer == NULL)
+    // Fail
+		return 0;
+
+  memcpy(&(pMem->pcBuffer[pMem->stSize]), pContents, stRealSize);
+  pMem->stSize += stRealSize;
+  pMem->pcBuffer[pMem->stSize] = 0;
+
+  return stRealSize;
+} // end of curl writer callback
+
+// Curl Writer callback for responses nobody reads
+static size_t CurlDiscardCallback(void *pContents, size_t stSize, size_t stNum, void *pUser)
+{
+	return stSize * stNum;
+}
+
+// Curl Writer callback for async responses - kept in the in-flight slot
+// ..upto LCASYNCRESPLEN - 1 chars, the rest is dropped
+static size_t CurlSlotWriterCallback(void *pContents, size_t stSize, size_t stNum, void *pUser)
+{
+	size_t stRealSize = stSize * stNum;
+	pLCInFlight pSlot = (pLCInFlight)pUser;
+
+	size_t stCopy = sizeof(pSlot->szResp) - 1 - pSlot->stResp;
+	if (stCopy > stRealSize)
+		stCopy = stRealSize;
+
+	memcpy(pSlot->szResp + pSlot->stResp, pContents, stCopy);
+	pSlot->stResp += stCopy;
+	pSlot->szResp[pSlot->stResp] = 0;
+
+	return stRealSize;
+}
+
+// Share lock callbacks - curl locks the connection cache / DNS through these
+static void LockLocalCloudShare(CURL *pHandle, curl_lock_data Data, curl_lock_access Access, void *pUser)
+{
+	pthread_mutex_lock(&g_lcShareLocks[Data % LCSHARELOCKS]);
+}
+
+static void UnlockLocalCloudShare(CURL *pHandle, curl_lock_data Data, void *pUser)
+{
+	pthread_mutex_unlock(&g_lcShareLocks[Data % LCSHARELOCKS]);
+}
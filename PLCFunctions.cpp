@@ -1,10 +1,54 @@
 #include "PLCHandlerService.h"
 
 // Global functions
-void DisconnectFromPLC(PLC *pPLC);
-PLC *ConnectToPLC(char *pszIP, int iPort, BOOL bMicroLogix);
-void *WriteVarToPLC(PLC *pPLC, char *pszVarName, char *pszVal, int iLen);
-char *ReadVarFromPLC(PLC *pPLC, char *pszVarName, char cVarType);
+void InitPLCConnection(pPLCConnection pConn, const char *pszName);
+void DisconnectFromPLC(pPLCConnection pConn);
+void ConnectToPLC(pPLCConnection pConn, char *pszIP, int iPort, BOOL bMicroLogix);
+BOOL WriteVarToPLC(pPLCConnection pConn, char *pszVarName, char *pszVal, int iLen);
+void EncodePLCString(char *pszVal, pPLCWriteBuf pBuf);
+void EncodeControlLogixString(pPLCWriteBuf pBuf);
+void EncodeMicroLogixString(pPLCWriteBuf pBuf);
+void SelectPLCTagSet(int iPLCType);
+int WriteEncodedToPLC(pPLCConnection pConn, char *pszVarName, pPLCWriteBuf pBuf);
+BOOL ReadVarFromPLC(pPLCConnection pConn, char *pszVarName, char cVarType, void *pResult);
+BOOL ReadBool(pPLCConnection pConn, char *pszVarName, BOOL *pbVal);
+BOOL ReadInt(pPLCConnection pConn, char *pszVarName, int *piVal);
+BOOL ReadString82(pPLCConnection pConn, char *pszVarName, char *pszVal);
+int ReadString82Array(pPLCConnection pConn, char *pszArrayName, int iFirst, int iCount, char *pszVals);
+int ReadStageSnapshot(pPLCConnection pConn, pStageSnapshot pSnapshot, unsigned int uStageMask);
+void GetReadParams(char cVarType, int *piOp, char **ppszFormat, int *piReadLen);
+void MarkPLCLinkDown(pPLCConnection pConn, const char *pszCaller);
+PLC *OpenPLC(char *pszIP, BOOL bMicroLogix);
+long long MonotonicMS();
+long long MonotonicUS();
+int GetPLCTimeout(pPLCConnection pConn, int iTimeouts);
+void UpdatePLCRTT(pPLCConnection pConn, long long llRTTUS);
+BOOL ProbePLCLink(pPLCConnection pConn);
+void AttemptPLCReconnect(pPLCConnection pConn, unsigned int *puSeed);
+void *ReconnectWorkerFunction(void *pArg);
+void StartReconnectManager();
+int ReadRawFromPLC(pPLCConnection pConn, char *pszVarName, int iOp, char *pszFormat, void *pBuf, int iReadLen, char cVarType);
+void LockPLC(pPLCConnection pConn);
+void UnlockPLC(pPLCConnection pConn);
+void ClosePLCHandle(pPLCConnection pConn);
+pTagInfo GetTag(char *pszVarName, char cVarType, pTagInfo pScratch);
+BOOL IsTagAbsent(pTagInfo pTag);
+void ClearRuntimeAbsentTags();
+void ValidateTagRegistry(pPLCConnection pConn);
+int ReadTagFromPLC(pPLCConnection pConn, pTagInfo pTag, void *pBuf);
+BOOL PLCFdSet(pPLCConnection pConn, fd_set *pReadSet, int *piMaxFd);
+BOOL PLCFdIsSet(pPLCConnection pConn, fd_set *pReadSet);
+void AddLatency(pLatencyHist pHist, long long llUS);
+long long LatencyPercentileUS(pLatencyHist pHist, int iPercent);
+void FormatLatency(char *pszOut, pLatencyHist pHist);
+void RecordPLCCall(pPLCConnection pConn, pTagInfo pTag, long long llUS, BOOL bOK, int iTimeouts);
+void DumpPLCStats();
+void *PLCStatsWorkerFunction(void *pArg);
+void PLCStatsSignalHandler(int iSignal);
+void StartPLCStats();
+BOOL StartPLCRecorder(char *pszFile);
+void StopPLCRecorder();
+void RecordPLCTraffic(pPLCConnection pConn, char *pszVarName, char cType, int iResult, void *pData);
 
 // Global variables
 struct PLCStringStruct
@@ -13,67 +57,178 @@ struct PLCStringStruct
   char szData[83];
 } PLCString, *pPLCString;
 
+// Tag sets per PLC family - names from PLCVariables.h
+const PLCTagSet g_ControlLogixTags =
+{
+  "ControlLogix",
+  gboolPLCPowerON, gboolPLCAlwaysON,
+  d1boolReadyForOrdering, d1stringPlaceOrder, d1boolDoorClosed, d1boolOKToOpenDoor, d1boolScanStarted,
+  d1boolsyncScanCompleted, d1stringsyncBCSlot, d1boolasyncScanCompleted, d1asyncScannedBarcode,
+  // Stage vars - 3 Mics for stage 5-7, just 1 variant @ Stage 8
+  {
+    {NULL},
+    {NULL, d1stringBCONPickedItem},
+    {NULL, d1stringBCONStagingItem},
+    {NULL, d1stringBCONRotaryItem},
+    {NULL, d1stringBCONPiercingItem},
+    {NULL, delstringBCONMic1FrontItem, delstringBCONMic2FrontItem, delstringBCONMic3FrontItem},
+    {NULL, delstringBCONMic1InsideItem, delstringBCONMic2InsideItem, delstringBCONMic3InsideItem},
+    {NULL, delboolFlagMic1HeatingItem, delboolFlagMic2HeatingItem, delboolFlagMic3HeatingItem},
+    {NULL, delstringBCONLane1ChangeItem},
+    {NULL, delstringBCONLane1EndItem, delstringBCONLane2EndItem}
+  },
+  {{0}, {0, 's'}, {0, 's'}, {0, 's'}, {0, 's'}, {0, 's', 's', 's'}, {0, 's', 's', 's'}, {0, 'b', 'b', 'b'}, {0, 's'}, {0, 's', 's'}},
+  // Read params - ControlLogix takes no ops, strings are String82 structs
+  {0, "i1", 1}, {0, "i1c82", sizeof(PLCString)}, {0, "i1", 2},
+  offsetof(struct PLCStringStruct, szData),
+  FALSE,
+  EncodeControlLogixString
+};
+
+const PLCTagSet g_MicroLogixTags =
+{
+  "MicroLogix",
+  gMLboolPLCPowerON, gMLboolPLCAlwaysON,
+  d1MLboolReadyForOrdering, d1MLstringPlaceOrder, d1MLboolDoorClosed, d1MLboolOKToOpenDoor, d1MLboolScanStarted,
+  d1MLboolsyncScanCompleted, d1MLstringsyncBCSlot, "", "",
+  // Stage vars - " " = absent on MicroLogix
+  {
+    {NULL},
+    {NULL, d1MLstringBCONPickedItem},
+    {NULL, d1MLstringBCONStagingItem},
+    {NULL, d1MLstringBCONRotaryItem},
+    {NULL, d1MLstringBCONPiercingItem},
+    {NULL, delMLstringBCONMic1FrontItem, delMLstringBCONMic2FrontItem, delMLstringBCONMic3FrontItem},
+    {NULL, delMLstringBCONMic1InsideItem, delMLstringBCONMic2InsideItem, delMLstringBCONMic3InsideItem},
+    {NULL, delMLboolFlagMic1HeatingItem, delMLboolFlagMic2HeatingItem, delMLboolFlagMic3HeatingItem},
+    {NULL, delMLstringBCONLane1ChangeItem},
+    {NULL, delMLstringBCONLane1EndItem, delMLstringBCONLane2EndItem}
+  },
+  {{0}, {0, 's'}, {0, 's'}, {0, 's'}, {0, 's'}, {0, 's', 's', 's'}, {0, 's', 's', 's'}, {0, 'b', 'b', 'b'}, {0, 's'}, {0, 's', 's'}},
+  // Read params - word conversion, strings are raw bytes
+  {PLC_RCOIL, PLC_CVT_WORD, 2}, {PLC_RBYTE, PLC_CVT_NONE, 82}, {PLC_RREG, PLC_CVT_WORD, 2},
+  0,
+  TRUE,
+  EncodeMicroLogixString
+};
+
+// Tag set of our PLC [set once at startup, before any PLC I/O]
+const PLCTagSet *g_pTagSet = &g_ControlLogixTags;
+
+// Tag registry - one entry per PLC tag we use, with cached read params
+// ..hashed by name (open addressing, table twice the registry size)
+TagInfo g_Tags[MAXTAGS];
+int g_iTagCount = 0;
+int g_iTagHash[MAXTAGS * 2] = {0}; // Tag index + 1, 0 = empty slot
+pthread_mutex_t g_tagLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Stats dump requested (SIGUSR1)
+volatile sig_atomic_t g_bDumpPLCStats = 0;
+
+// Traffic recorder (PLCRecord) - log file (NULL = off), start + last flush
+// ..times [guarded by g_recordLock]
+FILE *g_pRecordFile = NULL;
+long long g_llRecordStartUS = 0;
+long long g_llRecordFlushUS = 0;
+pthread_mutex_t g_recordLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Reconnect manager - guards link state of all connections,
+// ..signalled when a link goes down
+pthread_mutex_t g_reconnectLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_reconnectCond;
+
 // External vars + funcs
-extern PLC *g_pOrderPLC, *g_pScanPLC;
+extern PLCConnection g_OrderPLC, g_ScanPLC;
 extern ConfigInfo g_CfgInfo;
+extern BOOL g_bAppDone;
 extern pthread_mutex_t g_plcLock;
+extern char *g_pszStageVars[10][4];
+extern char g_cStageTypes[10][4];
 
 extern void DoLog(const char *pszLogMsg, int iPriority = 0);
 
 
+// Initializes a PLC connection (not connected yet)
+// Parameters: Connection to init, name of connection for logs
+void InitPLCConnection(pPLCConnection pConn, const char *pszName)
+{
+  memset(pConn, 0, sizeof(PLCConnection));
+  pthread_mutex_init(&pConn->Lock, NULL);
+  strncpy(pConn->szName, pszName, sizeof(pConn->szName) - 1);
+} // void function, no return value
+
+// Locks a PLC connection for PLCIO calls
+// ..each connection has its own lock so the order and scan sessions
+// ..can talk to the PLC in parallel. Build with PLCIO_GLOBAL_LOCK to
+// ..also serialize all sessions on g_plcLock (see test-tools/plcstress.c)
+void LockPLC(pPLCConnection pConn)
+{
+  long long llStartUS = MonotonicUS();
+
+  pthread_mutex_lock(&pConn->Lock);
+#ifdef PLCIO_GLOBAL_LOCK
+  pthread_mutex_lock(&g_plcLock);
+#endif
+
+  // Lock contention stats [we own the connection now]
+  AddLatency(&pConn->LockWaitHist, MonotonicUS() - llStartUS);
+}
+
+// Unlocks a PLC connection
+void UnlockPLC(pPLCConnection pConn)
+{
+#ifdef PLCIO_GLOBAL_LOCK
+  pthread_mutex_unlock(&g_plcLock);
+#endif
+  pthread_mutex_unlock(&pConn->Lock);
+}
+
+// Closes a connection's PLCIO handle [close touches library globals]
+// MUST be called with the connection lock held - with PLCIO_GLOBAL_LOCK
+// ..that lock already holds g_plcLock, so it is only taken here without it
+void ClosePLCHandle(pPLCConnection pConn)
+{
+#ifndef PLCIO_GLOBAL_LOCK
+  pthread_mutex_lock(&g_plcLock);
+#endif
+  plc_close(pConn->pPLC);
+#ifndef PLCIO_GLOBAL_LOCK
+  pthread_mutex_unlock(&g_plcLock);
+#endif
+  pConn->pPLC = NULL;
+}
+
 // Connects to PLC
-// and returns a PLC fd
+// and stores the PLC fd in the connection
 // This will retry until the connect succeeds
-// params: IP of PLC, Port of PLC
-PLC *ConnectToPLC(char *pszIP, int iPort, BOOL bMicroLogix)
+// params: Connection, IP of PLC, Port of PLC, MicroLogix flag
+void ConnectToPLC(pPLCConnection pConn, char *pszIP, int iPort, BOOL bMicroLogix)
 {
   //// IMPORTANT NOTE
-  /// THIS FUNCTION DOES NOT LOCK PLCIO library
-  /// AS IT MAY BE INVOKED FROM WITHIN THE PLC LOCK BY PLCRead/PLCWrite
-  /// (and if not, it is only invoked at PLCHandler start)
+  /// THIS FUNCTION DOES NOT LOCK THE CONNECTION
+  /// AS IT IS ONLY INVOKED AT PLCHandler START (before the session is used)
+  /// Dropped links are recovered in the background by the reconnect manager
 
 	PLC *pPLC = NULL;
-
-	char szPLCString[1024];
-
-  // Build PLC Connection String
-	if (!bMicroLogix)
-  {
-      // CIP Protocol being used ControlLogix PLC
-  	  snprintf(szPLCString, 1024, "cip %s", pszIP);
-  } // end non-micrologix check
-  else
-  {
-    // ABETH Protocol being used MicroLogix PLC
-    snprintf(szPLCString, 1024, "cipmlx %s", pszIP);
-  }
+	char szMsg[1024];
 
 	// Loop will break from inside (like egg)
 	while (TRUE)
 	{
-    DoLog("Connecting to PLC", 4);
+    sprintf(szMsg, "%s:: Connecting to PLC", pConn->szName);
+    DoLog(szMsg, 4);
 
-		// Connect
-		pPLC = plc_open(szPLCString);
-
-		// Success?
-		if (pPLC)
+		// Connect - Success?
+		if ((pPLC = OpenPLC(pszIP, bMicroLogix)))
 			// Done
 			break;
 
-    // Log error to STDOUT
-    plc_print_error(pPLC, "plc_open");
-
-    // Log error to file
-    char szErr[1024] = {0};
-    sprintf(szErr, "plc_open: Error [%s]", plc_open_ptr->ac_errmsg);
-    DoLog(szErr);
-
 		// wait 10 seconds
 		sleep(10);
 	} // end of eternal while loop that tries to connect to PLC
 
-  DoLog("Connected to PLC", 4);
+  sprintf(szMsg, "%s:: Connected to PLC", pConn->szName);
+  DoLog(szMsg, 4);
 
   // Wait a bit - for PLC to 'cool down'
   sleep(2); // 2 seconds
@@ -82,375 +237,1348 @@ PLC *ConnectToPLC(char *pszIP, int iPort, BOOL bMicroLogix)
   // Set log file name (for super-enhanced PLCIO packet logging)
   // plc_log_init("PLCLogFile2.txt");
 
-	// Return PLC fd
-	return pPLC;
+	// Store PLC fd
+	pConn->pPLC = pPLC;
 }
 
-// Disconnects an fd from a PLC
-void DisconnectFromPLC(PLC *pPLC)
+// Opens a PLCIO session - one attempt
+// ..plc_open is serialized on g_plcLock as it uses library globals (plc_open_ptr)
+// Parameters: PLC IP, TRUE for MicroLogix
+// Returns: PLCIO handle, NULL on failure (error logged)
+PLC *OpenPLC(char *pszIP, BOOL bMicroLogix)
 {
-  // Lock the PLCIO code
+	char szPLCString[1024];
+
+  // Build PLC Connection String
+	if (!bMicroLogix)
+  {
+      // CIP Protocol being used ControlLogix PLC
+  	  snprintf(szPLCString, 1024, "cip %s", pszIP);
+  } // end non-micrologix check
+  else
+  {
+    // ABETH Protocol being used MicroLogix PLC
+    snprintf(szPLCString, 1024, "cipmlx %s", pszIP);
+  }
+
   pthread_mutex_lock(&g_plcLock);
+	PLC *pPLC = plc_open(szPLCString);
+
+	// Success?
+	if (pPLC)
+	{
+    pthread_mutex_unlock(&g_plcLock);
+    return pPLC;
+	}
 
-	// Call the PLCIO library
-	plc_close(pPLC);
+  // Log error to STDOUT
+  plc_print_error(pPLC, "plc_open");
 
-  // Done with PLCIO - unlock
+  // Log error to file
+  char szErr[1024] = {0};
+  sprintf(szErr, "plc_open: Error [%s]", plc_open_ptr->ac_errmsg);
   pthread_mutex_unlock(&g_plcLock);
+  DoLog(szErr);
+
+  return NULL;
+} // end of open func
+
+// Disconnects a connection from a PLC
+void DisconnectFromPLC(pPLCConnection pConn)
+{
+  // Lock the connection
+  LockPLC(pConn);
+
+	// Call the PLCIO library - unless the link is down (already closed)
+  if (pConn->pPLC)
+    ClosePLCHandle(pConn);
+
+  // Done with PLCIO - unlock
+  UnlockPLC(pConn);
 } // void function, no return value
 
-// Reads variable from PLC and returns a string with the data
-// Variables can be of three kinds: BOOL, String82, and int
-// Parameters: Pointer to PLC, Name of variable to read, Type of var ('b'/'s'/'i')
-// Returns: freshly allocated char * array
-char *ReadVarFromPLC(PLC *pPLC, char *pszVarName, char cVarType)
-{
-    char *pszRet;
-		int iTimeouts = 0;
-		char szTempRet[MAXPLCREAD] = {0};
-
-    // Lock the PLCIO code
-    pthread_mutex_lock(&g_plcLock);
-
-		// Check if bool, string, int ?
-		// ..and generate format string for PLC Read function
-		char szType[10] = {0};
-		int iReadLen;
-    int iOp;
-		switch(cVarType)
+// Picks the tag set of our PLC family
+// ..called once at startup, when the config (PLC type) is known
+// Parameters: PLC type (0 = ControlLogix, else MicroLogix)
+void SelectPLCTagSet(int iPLCType)
+{
+    g_pTagSet = (iPLCType == 0) ? &g_ControlLogixTags : &g_MicroLogixTags;
+
+    char szMsg[1024] = {0};
+    sprintf(szMsg, "PLCTags:: Using %s tag set", g_pTagSet->pszName);
+    DoLog(szMsg, 2);
+} // void function, no return value
+
+// Gets the plc_read parameters for a variable type on this PLC
+// ..(PLCIO op, format string, and number of bytes to read)
+// Parameters: Type of var ('b'/'s'/'i'), [out] op, [out] format, [out] read length
+void GetReadParams(char cVarType, int *piOp, char **ppszFormat, int *piReadLen)
+{
+    const PLCReadParams *pParams;
+
+    // Check if bool, string, int ?
+    switch(cVarType)
     {
       case 'b':
-  			strcpy(szType, "i1");
-        iOp = PLC_RCOIL;
-        if (g_CfgInfo.iPLCType == 0)
-           iReadLen = 1;
-        else
-  			   iReadLen = 2;
-		    break;
+        pParams = &g_pTagSet->BoolRead;
+        break;
       case 's':
-        if (g_CfgInfo.iPLCType == 0)
-  			{
-            strcpy(szType, "i1c82");
-      			iReadLen = sizeof(PLCString);
-        }
-        else
-        {
-            strcpy(szType, "c82");
-            iOp = PLC_RBYTE;
-            iReadLen = 82;
-        }
+        pParams = &g_pTagSet->StringRead;
         break;
       default:
-  			strcpy(szType, "i1");
-        iOp = PLC_RREG;
-  			iReadLen = 2;
-		}
+        pParams = &g_pTagSet->IntRead;
+    }
 
-    // Read data from PLC
-    int iBytesRead;
+    *piOp = pParams->iOp;
+    *ppszFormat = pParams->pszFormat;
+    *piReadLen = pParams->iReadLen;
+} // void function, no return value
+
+// Gets the registry entry for a tag, adding it on first use
+// ..read params are worked out once here, not on every read
+// ..MicroLogix gaps (" "), empty + NULL names are marked absent straight away
+// Parameters: Name of tag, Type of var ('b'/'s'/'i'),
+// ..scratch entry to fill if the tag cant be registered (registry full/name too long)
+// Returns: Registry entry (or the filled scratch entry)
+pTagInfo GetTag(char *pszVarName, char cVarType, pTagInfo pScratch)
+{
+    // No name? [tag not set up] Nothing to read - and nothing to register
+    if (!pszVarName)
+    {
+      memset(pScratch, 0, sizeof(TagInfo));
+      pScratch->cType = cVarType;
+      pScratch->bAbsent = pScratch->bValidated = TRUE;
+      return pScratch;
+    }
 
-reader:
+    // Hash the name (djb2)
+    unsigned int uHash = 5381;
+    for (char *pc = pszVarName; *pc; pc++)
+      uHash = ((uHash << 5) + uHash) + *pc;
 
-    // ControlLogix PLC?
-    if (g_CfgInfo.iPLCType == 0)
+    pthread_mutex_lock(&g_tagLock);
+
+    // Probe for the tag
+    int iSlot = uHash % (MAXTAGS * 2);
+    while (g_iTagHash[iSlot])
     {
-        // Regular ControlLogix PLC
-        iBytesRead = plc_read(pPLC, 0, pszVarName, szTempRet, iReadLen, PLCTIMEOUT, szType);
+      pTagInfo pTag = &g_Tags[g_iTagHash[iSlot] - 1];
+
+      // Found it?
+      if (pTag->cType == cVarType && !strcmp(pTag->szName, pszVarName))
+      {
+        pthread_mutex_unlock(&g_tagLock);
+        return pTag;
+      }
+
+      // Next slot
+      iSlot = (iSlot + 1) % (MAXTAGS * 2);
     }
-    // MicroLogix PLC!
-    // Is this not a string read?
-    else if (iOp != PLC_RBYTE)
-        // WORD conversion
-        iBytesRead = plc_read(pPLC, iOp, pszVarName, szTempRet, iReadLen, PLCTIMEOUT, PLC_CVT_WORD);
-    else
-        // No conversion required - string read
-        iBytesRead = plc_read(pPLC, iOp, pszVarName, szTempRet, iReadLen, PLCTIMEOUT, PLC_CVT_NONE);
 
-    // Error?
-    if (iBytesRead == -1)
-		{
-				// Ignore invalid tag errors, some tags dont exist
-				// ..and we've done enough testing to ensure we know which ones dont exist
-				if (pPLC->j_error == PLCE_BAD_ADDRESS)
-        {
-            // Test Test Only for Scan PLC Logging
-            if (pPLC == g_pScanPLC)
-              printf("PLCRead:: Tag Absent: [%s]\n", pszVarName);
+    // New tag - use registry entry if there's space, else the scratch entry
+    pTagInfo pTag = pScratch;
+    if (g_iTagCount < MAXTAGS && strlen(pszVarName) < sizeof(pTag->szName))
+    {
+      pTag = &g_Tags[g_iTagCount];
+      g_iTagHash[iSlot] = ++g_iTagCount;
+    }
+
+    // Fill it in
+    memset(pTag, 0, sizeof(TagInfo));
+    strncpy(pTag->szName, pszVarName, sizeof(pTag->szName) - 1);
+    pTag->cType = cVarType;
+    GetReadParams(cVarType, &pTag->iOp, &pTag->pszFormat, &pTag->iReadLen);
+    if (cVarType == 's')
+      pTag->iDataOffset = g_pTagSet->iStringOffset;
+
+    // No address on this PLC? (MicroLogix absent vars are an empty space)
+    if (pszVarName[0] == '\0' || pszVarName[0] == ' ')
+      pTag->bAbsent = pTag->bValidated = TRUE;
+
+    pthread_mutex_unlock(&g_tagLock);
+
+    return pTag;
+} // end of get tag func
+
+// Is a tag to be skipped? Absent on this PLC, or a bad address on a recent
+// ..read (cooling down TAGABSENTRETRYMS)
+// ..the cool down is shared by both sessions - read under g_tagLock
+BOOL IsTagAbsent(pTagInfo pTag)
+{
+    if (pTag->bAbsent)
+      return TRUE;
+
+    pthread_mutex_lock(&g_tagLock);
+    long long llAbsentUntilMS = pTag->llAbsentUntilMS;
+    pthread_mutex_unlock(&g_tagLock);
+
+    return (llAbsentUntilMS && MonotonicMS() < llAbsentUntilMS);
+}
+
+// Forgets runtime bad addresses - the PLC program may have changed
+// ..called when a link comes back up
+void ClearRuntimeAbsentTags()
+{
+    pthread_mutex_lock(&g_tagLock);
+    for (int i = 0; i < g_iTagCount; i++)
+      g_Tags[i].llAbsentUntilMS = 0;
+    pthread_mutex_unlock(&g_tagLock);
+}
+
+// Validates all registered tags against the PLC with plc_validaddr
+// ..recording each tag's size and whether it exists - so absent tags
+// ..never cost a wire round trip on polls
+// Tags registered later are validated by their first read instead
+// ..call before the scan thread / event loop reads any tag - the absent
+// ..flags + read lengths are read without g_tagLock
+// Parameters: PLC Connection to validate on
+void ValidateTagRegistry(pPLCConnection pConn)
+{
+    char szMsg[1024];
+    int iAbsent = 0;
+
+    // Lock the connection
+    LockPLC(pConn);
+
+    // Link down? Tags stay unvalidated (and are read as usual)
+    if (pConn->bLinkDown)
+    {
+      UnlockPLC(pConn);
+      DoLog("TagRegistry:: Link down, tags not validated", 1);
+      return;
+    }
+
+    for (int i = 0; i < g_iTagCount; i++)
+    {
+      pTagInfo pTag = &g_Tags[i];
+      int iSize = 0, iDomain, iOffset;
+
+      // Already done (or a known gap)?
+      if (pTag->bValidated)
+      {
+        if (pTag->bAbsent)
+          iAbsent++;
+        continue;
+      }
 
-            // Done with PLCIO, unlock
-            pthread_mutex_unlock(&g_plcLock);
+      // Ask the PLC about this address
+      if (plc_validaddr(pConn->pPLC, pTag->szName, &iSize, &iDomain, &iOffset) == -1)
+      {
+        // Tag doesnt exist on this PLC?
+        if (pConn->pPLC->j_error == PLCE_BAD_ADDRESS || pConn->pPLC->j_error == PLCE_PARSE_ADDRESS)
+        {
+          pTag->bAbsent = pTag->bValidated = TRUE;
+          iAbsent++;
 
-            // Return No data
-					  return NULL;
+          sprintf(szMsg, "TagRegistry:: Tag Absent: [%s]", pTag->szName);
+          DoLog(szMsg, 2);
+          continue;
         }
 
-				// Log error to STDOUT
-        plc_print_error(pPLC, "plc_read");
+        // Some other failure (comm error, module cant validate) - leave it to the reads
+        sprintf(szMsg, "TagRegistry:: Cant validate [%s] Error [%s]", pTag->szName, pConn->pPLC->ac_errmsg);
+        DoLog(szMsg, 2);
+        continue;
+      }
 
-        // Log error to file
-        char szErr[1024] = {0};
-        sprintf(szErr, "plc_read: Tag [%s] Type: %c Len: %d Error [%s]", \
-          pszVarName, cVarType, iReadLen, pPLC->ac_errmsg);
-        DoLog(szErr, 1);
+      // Record size - and never read past the end of the tag
+      pTag->iSize = iSize;
+      pTag->bValidated = TRUE;
+      if (iSize > 0 && iSize < pTag->iReadLen)
+        pTag->iReadLen = iSize;
 
-				// Handle the error
-				if (pPLC->j_error == PLCE_COMM_SEND || pPLC->j_error == PLCE_COMM_RECV)
-				{
-					/// Communication error, need to reconnect with PLC and retry
-reconnect:
-					// Reset timeouts
-					iTimeouts = 0;
+      sprintf(szMsg, "TagRegistry:: Tag [%s] Size %d ReadLen %d", pTag->szName, iSize, pTag->iReadLen);
+      DoLog(szMsg, 5);
+    } // end loop through tags
 
-					// Was this the order plc?
-					if (pPLC == g_pOrderPLC)
-					{
-						DoLog("PLCRead:: OrderPLC disconnected, reconnecting...");
+    // Done with PLCIO - unlock
+    UnlockPLC(pConn);
 
-            // Close the PLC connection
-            plc_close(pPLC);
+    sprintf(szMsg, "TagRegistry:: %d tags, %d absent", g_iTagCount, iAbsent);
+    DoLog(szMsg, 2);
+} // void function, no return value
 
-						// Reconnect order PLC
-						pPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
+// Reads raw bytes of a registered tag from PLC
+// ..absent tags are skipped without a wire round trip, and tags the PLC
+// ..reports as bad addresses are skipped for TAGABSENTRETRYMS (or until the
+// ..link is re-established) - a program download / online edit can make a
+// ..tag briefly unresolvable
+// MUST be called with the connection lock held
+// Parameters: Connection, Tag, buffer to read into (atleast pTag->iReadLen bytes)
+// Returns: # of bytes read, -1 on failure
+int ReadTagFromPLC(pPLCConnection pConn, pTagInfo pTag, void *pBuf)
+{
+    // Known absent? Link down? [no I/O, nothing to record]
+    if (IsTagAbsent(pTag) || pConn->bLinkDown)
+      return -1;
+
+    // Read data from PLC [timed incl. retries]
+    long long llStartUS = MonotonicUS();
+    int iTimeouts = pConn->iTimeouts;
+    int iBytesRead = ReadRawFromPLC(pConn, pTag->szName, pTag->iOp, pTag->pszFormat, pBuf, pTag->iReadLen, pTag->cType);
+    RecordPLCCall(pConn, pTag, MonotonicUS() - llStartUS, iBytesRead != -1, pConn->iTimeouts - iTimeouts);
+    RecordPLCTraffic(pConn, pTag->szName, pTag->cType, iBytesRead, pBuf);
+
+    // Tag doesnt resolve? Dont ask again for a while
+    if (iBytesRead == -1 && !pConn->bLinkDown && pConn->pPLC->j_error == PLCE_BAD_ADDRESS)
+    {
+      char szMsg[1024] = {0};
+      sprintf(szMsg, "TagRegistry:: Bad address [%s], not read for %d ms", pTag->szName, TAGABSENTRETRYMS);
+      DoLog(szMsg, 1);
 
-            DoLog("PLCRead:: OrderPLC reconnected");
+      pthread_mutex_lock(&g_tagLock);
+      pTag->llAbsentUntilMS = MonotonicMS() + TAGABSENTRETRYMS;
+      pthread_mutex_unlock(&g_tagLock);
+    }
 
-						// Store in global
-						g_pOrderPLC = pPLC;
-					} // end of order plc check
-					// No, Scan PLC?
-					else if(pPLC == g_pScanPLC)
-					{
-						DoLog("PLCRead:: ScanPLC disconnected, reconnecting...");
+    return iBytesRead;
+} // end of tag read func
 
-            // Close the PLC connection
-            plc_close(pPLC);
+// Adds a PLC connection's socket to a select() read set
+// ..used by the event loop to watch the PLC sessions alongside its timers
+// Parameters: Connection, read set, [in/out] highest fd in the set
+// Returns: TRUE if the session has an fd to watch
+BOOL PLCFdSet(pPLCConnection pConn, fd_set *pReadSet, int *piMaxFd)
+{
+    BOOL bRet = FALSE;
 
-						// Reconnect scan plc
-						pPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
+    LockPLC(pConn);
+    if (pConn->pPLC && !pConn->bLinkDown)
+      bRet = (plc_fd_set(pConn->pPLC, pReadSet, piMaxFd) != -1);
+    UnlockPLC(pConn);
 
-            DoLog("PLCRead:: ScanPLC reconnected");
+    return bRet;
+} // end of fd set func
 
-						// Store in global
-					  g_pScanPLC = pPLC;
-					} // end of scan plc check
-          else
-          {
-            // Error!
-            sprintf(szErr, "PLCRead:: Invalid PLC pointer! pPLC [%d] ScanPLC [%d] OrderPLC [%d]", pPLC, g_pScanPLC, g_pOrderPLC);
-            DoLog(szErr, 2);
+// Checks if a PLC connection's socket is readable in a select() result set
+// Parameters: Connection, read set returned by select
+// Returns: TRUE if readable
+BOOL PLCFdIsSet(pPLCConnection pConn, fd_set *pReadSet)
+{
+    BOOL bRet = FALSE;
 
+    LockPLC(pConn);
+    if (pConn->pPLC)
+      bRet = (plc_fd_isset(pConn->pPLC, pReadSet) > 0);
+    UnlockPLC(pConn);
 
-            // Done with PLCIO, unlock
-            pthread_mutex_unlock(&g_plcLock);
+    return bRet;
+} // end of fd isset func
 
-            // Fail
-            return NULL;
-          }
-          
-          // Retry read
-          goto reader;
-				} // end of if-comm send/comm recv failure check
-				// No - Timeout?
-				else if (pPLC->j_error == PLCE_TIMEOUT)
-				{
-					// Increment timeout counter
-					iTimeouts++;
-
-          /// After multiple timeouts, reconnect with PLC and retry
-					if (iTimeouts == 5)
-          {
-              DoLog("PLCRead:: Multiple timeouts. Assuming connection failure!", 1);
+// Returns monotonic clock time in milliseconds
+long long MonotonicMS()
+{
+    return MonotonicUS() / 1000;
+}
 
-							// Proceed to reconnect
-							goto reconnect; // Are goto statements irredeemably evil? ;)
-          }
+// Returns monotonic clock time in microseconds
+long long MonotonicUS()
+{
+    struct timespec tsNow;
+    clock_gettime(CLOCK_MONOTONIC, &tsNow);
+
+    return (long long)tsNow.tv_sec * 1000000 + tsNow.tv_nsec / 1000;
+}
 
-          // Just a timeout - retry the read
-          goto reader;
-        } // end of timeout check
+// Gets the timeout for the next PLC call on a connection
+// ..SRTT + 4 * RTTVAR (TCP style), PLCTIMEOUT until there is a sample,
+// ..doubled for each timeout in a row on this call
+// MUST be called with the connection lock held
+// Parameters: Connection, # of timeouts in a row so far
+// Returns: timeout in ms
+int GetPLCTimeout(pPLCConnection pConn, int iTimeouts)
+{
+    long long llTimeoutMS = PLCTIMEOUT;
 
-        // Nothing to do here, this error cant be handled
-		} // End of bytesread = -1 check
-		// Yes, we got a result
-    else
+    // Have an estimate?
+    if (pConn->llSRTTUS)
+      llTimeoutMS = (pConn->llSRTTUS + 4 * pConn->llRTTVarUS) / 1000;
+
+    // Back off
+    for (int i = 0; i < iTimeouts && llTimeoutMS < PLCMAXTIMEOUT; i++)
+      llTimeoutMS *= 2;
+
+    if (llTimeoutMS < PLCMINTIMEOUT)
+      llTimeoutMS = PLCMINTIMEOUT;
+    if (llTimeoutMS > PLCMAXTIMEOUT)
+      llTimeoutMS = PLCMAXTIMEOUT;
+
+    return (int)llTimeoutMS;
+}
+
+// Adds a round trip sample (successful call) to a connection's estimate
+// MUST be called with the connection lock held
+// Parameters: Connection, round trip in microseconds
+void UpdatePLCRTT(pPLCConnection pConn, long long llRTTUS)
+{
+    // Keep 0 for 'no samples'
+    if (llRTTUS < 1)
+      llRTTUS = 1;
+
+    // First sample?
+    if (!pConn->llSRTTUS)
     {
-        // Allocate memory for return value
-        char *pszRet = new char[MAXPLCREAD];
+      pConn->llSRTTUS = llRTTUS;
+      pConn->llRTTVarUS = llRTTUS / 2;
+      return;
+    }
+
+    // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - RTT|, SRTT = 7/8 SRTT + 1/8 RTT
+    long long llDelta = pConn->llSRTTUS > llRTTUS ? pConn->llSRTTUS - llRTTUS : llRTTUS - pConn->llSRTTUS;
+    pConn->llRTTVarUS = (3 * pConn->llRTTVarUS + llDelta) / 4;
+    pConn->llSRTTUS = (7 * pConn->llSRTTUS + llRTTUS) / 8;
+    if (!pConn->llSRTTUS)
+      pConn->llSRTTUS = 1;
+}
+
+// Marks a PLC connection's link as down after a communication failure
+// ..closes the handle and wakes the reconnect manager, so the caller
+// ..(and every later caller until recovery) gets a failure straight away
+// MUST be called with the connection lock held
+// Parameters: Connection, caller name for logs
+void MarkPLCLinkDown(pPLCConnection pConn, const char *pszCaller)
+{
+    char szMsg[1024] = {0};
+
+    sprintf(szMsg, "%s:: %s link down, reconnecting in background", pszCaller, pConn->szName);
+    DoLog(szMsg);
+
+    // Close the PLC connection
+    ClosePLCHandle(pConn);
+
+    // Hand it to the reconnect manager - first attempt right away
+    pthread_mutex_lock(&g_reconnectLock);
+    pConn->bLinkDown = TRUE;
+    pConn->llDownSinceMS = pConn->llNextAttemptMS = MonotonicMS();
+    pConn->iBackoffMS = PLCRECONNECTMINMS;
+    pthread_cond_signal(&g_reconnectCond);
+    pthread_mutex_unlock(&g_reconnectLock);
+} // end of link down func
+
+// Checks a freshly opened PLC connection is healthy by reading Always_On
+// MUST be called with the connection lock held
+// Parameters: Connection (with new handle)
+// Returns: TRUE if the PLC answered
+BOOL ProbePLCLink(pPLCConnection pConn)
+{
+    char szTempRet[sizeof(PLCString) + 1] = {0};
+    int iOp, iReadLen;
+    char *pszFormat;
 
-        // Clear the buffer
-        memset(pszRet, 0, MAXPLCREAD);
+    GetReadParams('b', &iOp, &pszFormat, &iReadLen);
 
-				int *piRes;
-				// What kind of value was this?
-				switch(cVarType)
-        {
-          case 'b':
-  					/// Bool: Print the 1/0 into a string
-  					sprintf(pszRet, "%d", szTempRet[0]);
-            break;
-          case 's':
-				    /// String
-            if(g_CfgInfo.iPLCType == 0)
-    				{
-      					// Get the struct
-      					pPLCString = (struct PLCStringStruct *)szTempRet;
-
-      					// Extract the data payload
-      					strcpy(pszRet, pPLCString->szData);
-            }
-            else
-                strcpy(pszRet, szTempRet);
-            break;
-          default:
-            /// Integer
-  					// Get int *
-  					piRes = (int *)szTempRet;
+    // First sample of the new link's round trip estimate
+    long long llStartUS = MonotonicUS();
+    if (plc_read(pConn->pPLC, iOp, g_pTagSet->pszAlwaysOnVar, szTempRet, iReadLen, PLCTIMEOUT, pszFormat) == -1)
+      return FALSE;
 
-  					// Write it into return variable as string
-  					sprintf(pszRet, "%d", szTempRet[0]);
-				} // end of 'int' case block
+    UpdatePLCRTT(pConn, MonotonicUS() - llStartUS);
+    return TRUE;
+}
 
-        // Done with PLCIO - unlock
-        pthread_mutex_unlock(&g_plcLock);
+// Makes one reconnect attempt for a connection whose link is down
+// ..on success the connection is live again and time-to-recover is recorded,
+// ..on failure the next attempt is scheduled with jittered exponential backoff
+// Parameters: Connection, random seed (reconnect manager's)
+void AttemptPLCReconnect(pPLCConnection pConn, unsigned int *puSeed)
+{
+    char szMsg[1024] = {0};
 
-      	// Return the prepared value
-      	return pszRet;
-    } // End of successful result handling block
+    sprintf(szMsg, "ReconnectManager:: %s reconnect attempt", pConn->szName);
+    DoLog(szMsg, 4);
 
+    // One connect attempt [no connection lock, callers keep getting link down]
+    PLC *pPLC = OpenPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCType == 1);
 
-    // Done with PLCIO, unlock
-    pthread_mutex_unlock(&g_plcLock);
+    if (pPLC)
+    {
+      // Wait a bit - for PLC to 'cool down'
+      sleep(2); // 2 seconds
+
+      // Install the handle + probe it before declaring the link up
+      // ..(new link, new round trip estimate)
+      LockPLC(pConn);
+      pConn->pPLC = pPLC;
+      pConn->llSRTTUS = pConn->llRTTVarUS = 0;
+      if (ProbePLCLink(pConn))
+      {
+        long long llRecoverMS = MonotonicMS() - pConn->llDownSinceMS;
+
+        // Tags that didnt resolve before may now [PLC program reloaded?]
+        ClearRuntimeAbsentTags();
+
+        pthread_mutex_lock(&g_reconnectLock);
+        pConn->bLinkDown = FALSE;
+        pConn->iReconnects++;
+        pConn->llLastRecoverMS = llRecoverMS;
+        pConn->llTotalRecoverMS += llRecoverMS;
+        if (llRecoverMS > pConn->llMaxRecoverMS)
+          pConn->llMaxRecoverMS = llRecoverMS;
+        pthread_mutex_unlock(&g_reconnectLock);
+        UnlockPLC(pConn);
+
+        sprintf(szMsg, "ReconnectManager:: %s reconnected in %lld ms [%d reconnects so far, avg %lld ms, worst %lld ms]", \
+          pConn->szName, llRecoverMS, pConn->iReconnects, pConn->llTotalRecoverMS / pConn->iReconnects, pConn->llMaxRecoverMS);
+        DoLog(szMsg);
+        return;
+      } // end of probe success check
+
+      // PLC didnt answer - close it again
+      plc_print_error(pConn->pPLC, "plc_read");
+      ClosePLCHandle(pConn);
+      UnlockPLC(pConn);
+
+      sprintf(szMsg, "ReconnectManager:: %s connected but health probe failed", pConn->szName);
+      DoLog(szMsg, 1);
+    } // end of open success check
+
+    // Schedule next attempt: backoff +/- 25% jitter, then double the backoff
+    pthread_mutex_lock(&g_reconnectLock);
+    int iDelayMS = pConn->iBackoffMS - pConn->iBackoffMS / 4 + rand_r(puSeed) % (pConn->iBackoffMS / 2 + 1);
+    pConn->llNextAttemptMS = MonotonicMS() + iDelayMS;
+    pConn->iBackoffMS *= 2;
+    if (pConn->iBackoffMS > PLCRECONNECTMAXMS)
+      pConn->iBackoffMS = PLCRECONNECTMAXMS;
+    pthread_mutex_unlock(&g_reconnectLock);
+
+    sprintf(szMsg, "ReconnectManager:: %s next attempt in %d ms", pConn->szName, iDelayMS);
+    DoLog(szMsg, 4);
+} // void function, no return value
+
+// Reconnect manager thread
+// ..sleeps until a connection's link goes down, then recovers it
+// ..with backoff while the rest of the service keeps running
+// params: pArg = NULL (no argument needs to be passed)
+void *ReconnectWorkerFunction(void *pArg)
+{
+    pPLCConnection pConns[] = {&g_OrderPLC, &g_ScanPLC};
+    unsigned int uSeed = (unsigned int)time(NULL);
+
+    pthread_mutex_lock(&g_reconnectLock);
+    while (!g_bAppDone)
+    {
+      // Find a connection that is due for an attempt, and the earliest future attempt
+      pPLCConnection pDue = NULL;
+      long long llNow = MonotonicMS(), llNext = 0;
+      for (int i = 0; i < 2 && !pDue; i++)
+      {
+        if (!pConns[i]->bLinkDown)
+          continue;
+        if (pConns[i]->llNextAttemptMS <= llNow)
+          pDue = pConns[i];
+        else if (!llNext || pConns[i]->llNextAttemptMS < llNext)
+          llNext = pConns[i]->llNextAttemptMS;
+      }
+
+      // Attempt it [without holding the manager lock]
+      if (pDue)
+      {
+        pthread_mutex_unlock(&g_reconnectLock);
+        AttemptPLCReconnect(pDue, &uSeed);
+        pthread_mutex_lock(&g_reconnectLock);
+        continue;
+      }
+
+      // Sleep until the next attempt, a new link down, or 1 second (to notice app done)
+      if (!llNext || llNext - llNow > 1000)
+        llNext = llNow + 1000;
+      struct timespec tsWake;
+      tsWake.tv_sec = llNext / 1000;
+      tsWake.tv_nsec = (llNext % 1000) * 1000000;
+      pthread_cond_timedwait(&g_reconnectCond, &g_reconnectLock, &tsWake);
+    } // end of manager loop
+    pthread_mutex_unlock(&g_reconnectLock);
 
-    // Nothing is read
     return NULL;
+} // end of reconnect manager thread
+
+// Starts the background reconnect manager
+// ..called once at service start
+void StartReconnectManager()
+{
+    pthread_t tReconnect;
+    pthread_condattr_t CondAttr;
+
+    // Manager wakes on the monotonic clock (wall clock jumps dont matter)
+    pthread_condattr_init(&CondAttr);
+    pthread_condattr_setclock(&CondAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&g_reconnectCond, &CondAttr);
+    pthread_condattr_destroy(&CondAttr);
+
+    pthread_create(&tReconnect, NULL, &ReconnectWorkerFunction, NULL);
+    pthread_detach(tReconnect);
+} // void function, no return value
+
+// Reads raw bytes of a variable from PLC
+// ..retrying on timeouts; on communication failures (or repeated timeouts)
+// ..the link is marked down and left to the reconnect manager
+// MUST be called with the connection lock held
+// Parameters: Connection, Name of variable to read,
+// ..PLCIO op, format string, buffer to read into, bytes to read, Type of var (for logs)
+// Returns: # of bytes read, -1 on failure (incl. absent tags + link down)
+int ReadRawFromPLC(pPLCConnection pConn, char *pszVarName, int iOp, char *pszFormat, void *pBuf, int iReadLen, char cVarType)
+{
+    int iTimeouts = 0, iTimeoutMS, iWaitedMS = 0;
+    int iBytesRead;
+
+    while (TRUE)
+    {
+      // Link down? Reconnect manager is on it - fail straight away
+      if (pConn->bLinkDown)
+      {
+        pConn->iLastError = PLCE_COMM_SEND;
+        return -1;
+      }
+
+      // Read data from PLC [timed for the round trip estimate]
+      iTimeoutMS = GetPLCTimeout(pConn, iTimeouts);
+      long long llStartUS = MonotonicUS();
+      iBytesRead = plc_read(pConn->pPLC, iOp, pszVarName, pBuf, iReadLen, iTimeoutMS, pszFormat);
+
+      // Success?
+      if (iBytesRead != -1)
+      {
+        UpdatePLCRTT(pConn, MonotonicUS() - llStartUS);
+
+        // Done
+        return iBytesRead;
+      }
+      pConn->iLastError = pConn->pPLC->j_error;
+
+      // Ignore invalid tag errors, some tags dont exist
+      // ..and we've done enough testing to ensure we know which ones dont exist
+      if (pConn->pPLC->j_error == PLCE_BAD_ADDRESS)
+      {
+          // Test Test Only for Scan PLC Logging
+          if (pConn == &g_ScanPLC)
+            printf("PLCRead:: Tag Absent: [%s]\n", pszVarName);
+
+          // Return No data
+          return -1;
+      }
+
+      // Log error to STDOUT
+      plc_print_error(pConn->pPLC, "plc_read");
+
+      // Log error to file
+      char szErr[1024] = {0};
+      sprintf(szErr, "plc_read: Tag [%s] Type: %c Len: %d Timeout: %d ms Error [%s]", \
+        pszVarName, cVarType, iReadLen, iTimeoutMS, pConn->pPLC->ac_errmsg);
+      DoLog(szErr, 1);
+
+      // Handle the error
+      if (pConn->pPLC->j_error == PLCE_TIMEOUT)
+      {
+        // Increment timeout counters
+        iTimeouts++;
+        iWaitedMS += iTimeoutMS;
+        pConn->iTimeouts++;
+
+        // Just a timeout - retry the read [atleast once, then within the stall budget]
+        if (iTimeouts < 2 || iWaitedMS + GetPLCTimeout(pConn, iTimeouts) <= PLCSTALLBUDGETMS)
+          continue;
+
+        /// After multiple timeouts, hand over to the reconnect manager
+        DoLog("PLCRead:: Multiple timeouts. Assuming connection failure!", 1);
+      } // end of timeout check
+      else
+      {
+        // Count the error
+        pConn->iErrors++;
+
+        // Not a communication error? Nothing to do here, this error cant be handled
+        if (pConn->pPLC->j_error != PLCE_COMM_SEND && pConn->pPLC->j_error != PLCE_COMM_RECV)
+          return -1;
+      } // end of non-timeout error check
+
+      /// Communication error, hand the connection to the reconnect manager
+      MarkPLCLinkDown(pConn, "PLCRead");
+
+      return -1;
+    } // end of read-retry loop
+} // end of raw PLC read func
+
+// Reads variable from PLC and decodes it into caller-owned storage
+// Variables can be of three kinds: BOOL, String82, and int
+// Parameters: PLC Connection, Name of variable to read, Type of var ('b'/'s'/'i'),
+// ..result storage (BOOL * for 'b', char[83] for 's', int * for 'i')
+// Returns: TRUE if the variable was read, FALSE otherwise (result untouched)
+BOOL ReadVarFromPLC(pPLCConnection pConn, char *pszVarName, char cVarType, void *pResult)
+{
+    // Raw read buffer - big enough for the largest type (String82 struct)
+    char szTempRet[sizeof(PLCString) + 1] = {0};
+
+    // Get tag from registry (cached read params + absent flag)
+    TagInfo Scratch;
+    pTagInfo pTag = GetTag(pszVarName, cVarType, &Scratch);
+
+    // Known absent? Nothing to read
+    if (IsTagAbsent(pTag))
+      return FALSE;
+
+    // Lock the connection
+    LockPLC(pConn);
+
+    // Read data from PLC
+    int iBytesRead = ReadTagFromPLC(pConn, pTag, szTempRet);
+
+    // Done with PLCIO - unlock
+    UnlockPLC(pConn);
+
+    // Error? Nothing is read
+    if (iBytesRead == -1)
+      return FALSE;
+
+    // What kind of value was this?
+    switch(cVarType)
+    {
+      case 'b':
+        /// Bool
+        *(BOOL *)pResult = (szTempRet[0] != 0);
+        break;
+      case 's':
+        /// String - upto 82 chars, always NUL terminated
+        // ..data payload is past the String82 length on ControlLogix
+        strncpy((char *)pResult, szTempRet + pTag->iDataOffset, 82);
+        ((char *)pResult)[82] = '\0';
+        break;
+      default:
+        /// Integer - 16 bit word
+        *(int *)pResult = *(short *)szTempRet;
+    } // end of type switch
+
+    return TRUE;
 } // end of PLC Read func
 
+// Typed PLC reads - no heap allocation, result goes to caller storage
+// Parameters: PLC Connection, Name of variable to read, result storage
+// Returns: TRUE if the variable was read, FALSE otherwise
+BOOL ReadBool(pPLCConnection pConn, char *pszVarName, BOOL *pbVal)
+{
+    return ReadVarFromPLC(pConn, pszVarName, 'b', pbVal);
+}
+
+BOOL ReadInt(pPLCConnection pConn, char *pszVarName, int *piVal)
+{
+    return ReadVarFromPLC(pConn, pszVarName, 'i', piVal);
+}
+
+// pszVal must hold atleast 83 chars (82 + NUL)
+BOOL ReadString82(pPLCConnection pConn, char *pszVarName, char *pszVal)
+{
+    return ReadVarFromPLC(pConn, pszVarName, 's', pszVal);
+}
+
+// Reads a run of String82 array elements in one request
+// ..X[iFirst] to X[iFirst + iCount - 1], read as raw bytes (one String82
+// ..struct per element, no conversion - ControlLogix and host are both
+// ..little-endian) and split into strings here
+// Parameters: PLC Connection, array name, first element, # of elements
+// ..(atmost PLC_CHAR_MAX / sizeof(PLCString)), storage for iCount strings of 83 chars
+// Returns: # of elements read, -1 on failure (storage untouched)
+int ReadString82Array(pPLCConnection pConn, char *pszArrayName, int iFirst, int iCount, char *pszVals)
+{
+    char szData[PLC_CHAR_MAX];
+    char szAddr[128] = {0};
+    int iElemSize = sizeof(PLCString);
+
+    if (iCount < 1 || iCount * iElemSize > PLC_CHAR_MAX)
+      return -1;
+
+    snprintf(szAddr, sizeof(szAddr), "%s[%d]", pszArrayName, iFirst);
+
+    // Registry entry of the run [for I/O stats, read params are our own]
+    TagInfo Scratch;
+    pTagInfo pTag = GetTag(szAddr, 'a', &Scratch);
+    if (IsTagAbsent(pTag))
+      return -1;
+
+    // Lock the connection
+    LockPLC(pConn);
+
+    // Link down? Nothing to read
+    if (pConn->bLinkDown)
+    {
+      UnlockPLC(pConn);
+      return -1;
+    }
+
+    // Read the whole run
+    long long llStartUS = MonotonicUS();
+    int iTimeouts = pConn->iTimeouts;
+    int iBytesRead = ReadRawFromPLC(pConn, szAddr, 0, PLC_CVT_NONE, szData, iCount * iElemSize, 'a');
+    RecordPLCCall(pConn, pTag, MonotonicUS() - llStartUS, iBytesRead != -1, pConn->iTimeouts - iTimeouts);
+    RecordPLCTraffic(pConn, szAddr, 'a', iBytesRead, szData);
+
+    // Done with PLCIO - unlock
+    UnlockPLC(pConn);
+
+    if (iBytesRead == -1)
+      return -1;
+
+    // Split into strings [whole elements only]
+    int iRead = iBytesRead / iElemSize;
+    for (int i = 0; i < iRead; i++)
+    {
+      struct PLCStringStruct *pString = (struct PLCStringStruct *)(szData + i * iElemSize);
+      int iLen = (pString->iLen < 0 || pString->iLen > 82) ? 82 : pString->iLen;
+
+      memcpy(pszVals + i * 83, pString->szData, iLen);
+      pszVals[i * 83 + iLen] = '\0';
+    }
+
+    return iRead;
+} // end of string array read func
+
+// Reads all stage variables for one machine-state poll cycle in one batch
+// ..holding the connection lock once for the whole sweep (instead of once per tag)
+// ..and reading each distinct PLC address only once
+// ..(MicroLogix shares some addresses between variants, and its heating bits
+// ..live in the same B3 word, so those are read as one word and split locally)
+// Parameters: PLC Connection, snapshot struct to fill,
+// ..stages to read (bit i = stage i, others are left unread)
+// Returns: # of stage variables read successfully
+int ReadStageSnapshot(pPLCConnection pConn, pStageSnapshot pSnapshot, unsigned int uStageMask)
+{
+    int iNumRead = 0;
+
+    // Words read this cycle for MicroLogix bit addresses (eg. B3:13 for B3:13/6)
+    char szWordAddr[8][32] = {0};
+    short sWordVal[8] = {0};
+    BOOL bWordValid[8] = {0};
+    int iWordCount = 0;
+
+    // Clear the snapshot
+    memset(pSnapshot, 0, sizeof(StageSnapshot));
+
+    // Lock the connection - once for the sweep
+    LockPLC(pConn);
+
+    // Loop through every stage-variable [1-base index for stages and variants]
+    for (int i = 1; i <= MACHINESTAGECOUNT; i++)
+    {
+      // Stage not wanted this sweep?
+      if (!(uStageMask & (1 << i)))
+        continue;
+
+      for (int j = 1; j < 4; j++)
+      {
+        char *pszVarName = g_pszStageVars[i][j];
+        char cType = g_cStageTypes[i][j];
+
+        // Skip unused vars
+        if (pszVarName[0] == '\0')
+          continue;
+
+        // Skip absent vars (MicroLogix gaps + tags the PLC doesnt have)
+        TagInfo Scratch;
+        pTagInfo pTag = GetTag(pszVarName, cType, &Scratch);
+        if (IsTagAbsent(pTag))
+          continue;
+
+        /// Have we already read this address during this sweep?
+        BOOL bDone = FALSE;
+        for (int i2 = 1; i2 <= i && !bDone; i2++)
+        {
+          for (int j2 = 1; j2 < 4; j2++)
+          {
+            // Only earlier vars
+            if (i2 == i && j2 >= j)
+              break;
+
+            // Same address + type? [read this sweep]
+            if ((uStageMask & (1 << i2)) && g_cStageTypes[i2][j2] == cType && !strcmp(g_pszStageVars[i2][j2], pszVarName))
+            {
+              // Copy the earlier result
+              pSnapshot->bRead[i][j] = pSnapshot->bRead[i2][j2];
+              pSnapshot->bFlag[i][j] = pSnapshot->bFlag[i2][j2];
+              strcpy(pSnapshot->szBCON[i][j], pSnapshot->szBCON[i2][j2]);
+              bDone = TRUE;
+              break;
+            }
+          }
+        }
+
+        // Yes, nothing more to read for this var
+        if (bDone)
+        {
+          if (pSnapshot->bRead[i][j])
+            iNumRead++;
+          continue;
+        }
+
+        /// MicroLogix bit address? Read the whole word once and pick out the bit
+        char *pszBit = strchr(pszVarName, '/');
+        if (g_pTagSet->bBitWords && cType == 'b' && pszBit && (pszBit - pszVarName) < 32)
+        {
+          char szWord[32] = {0};
+          strncpy(szWord, pszVarName, pszBit - pszVarName);
+
+          // Find word in this sweep's words
+          int iWord;
+          for (iWord = 0; iWord < iWordCount; iWord++)
+            if (!strcmp(szWordAddr[iWord], szWord))
+              break;
+
+          // Not read yet? (and we have space to remember it)
+          if (iWord == iWordCount && iWordCount < 8)
+          {
+            TagInfo WordScratch;
+            strcpy(szWordAddr[iWord], szWord);
+            bWordValid[iWord] = (ReadTagFromPLC(pConn, GetTag(szWord, 'i', &WordScratch), &sWordVal[iWord]) != -1);
+            iWordCount++;
+          }
+
+          // Got the word? Extract the bit
+          if (iWord < iWordCount)
+          {
+            if (bWordValid[iWord])
+            {
+              pSnapshot->bRead[i][j] = TRUE;
+              pSnapshot->bFlag[i][j] = (sWordVal[iWord] >> atoi(pszBit + 1)) & 1;
+              iNumRead++;
+            }
+            continue;
+          }
+        } // end MicroLogix bit check
+
+        /// Regular read of this var
+        char szTempRet[sizeof(PLCString) + 1] = {0};
+        if (ReadTagFromPLC(pConn, pTag, szTempRet) == -1)
+          // No data
+          continue;
+
+        // Decode into snapshot
+        pSnapshot->bRead[i][j] = TRUE;
+        iNumRead++;
+        if (cType == 'b')
+          pSnapshot->bFlag[i][j] = (szTempRet[0] != 0);
+        else
+          strncpy(pSnapshot->szBCON[i][j], szTempRet + pTag->iDataOffset, 82);
+      } // end j loop
+    } // end i loop
+
+    // Done with PLCIO - unlock
+    UnlockPLC(pConn);
+
+    return iNumRead;
+} // end of read stage snapshot func
+
 // Writes data to PLC var
-// Parameters: PLC Pointer, Variable Name, Value to write, length in bytes, format string
-void *WriteVarToPLC(PLC *pPLC, char *pszVarName, char *pszVal, int iLen)
+// Parameters: PLC Connection, Variable Name, Value to write, length in bytes
+// Returns: TRUE if written, FALSE if the link is (or went) down or the PLC rejected it
+BOOL WriteVarToPLC(pPLCConnection pConn, char *pszVarName, char *pszVal, int iLen)
 {
-	int iTimeouts = 0;
 	/// Writes are ONLY String82 for now
-	// Prepare Struct
-	memset(&PLCString, 0, sizeof(PLCString));
-	PLCString.iLen = strlen(pszVal);
-	strncpy(PLCString.szData, pszVal, PLCString.iLen);
+	// Encode once into our own buffer [retries reuse it]
+	PLCWriteBuf Buf;
+	EncodePLCString(pszVal, &Buf);
 
-  // Lock the PLCIO code
-  pthread_mutex_lock(&g_plcLock);
+	return (WriteEncodedToPLC(pConn, pszVarName, &Buf) == PLCWRITEOK);
+} // end of PLC write func
+
+// Encodes a String82 value for plc_write in the layout of our PLC family
+// Parameters: Value to write (upto 82 chars), buffer to encode into
+void EncodePLCString(char *pszVal, pPLCWriteBuf pBuf)
+{
+  memset(pBuf, 0, sizeof(PLCWriteBuf));
+  strncpy(pBuf->szValue, pszVal, 82);
+
+  g_pTagSet->pfnEncodeString(pBuf);
+} // void function, no return value
+
+// ControlLogix: String82 struct (length + data), format "i1c82"
+// Parameters: buffer to encode into (value in szValue)
+void EncodeControlLogixString(pPLCWriteBuf pBuf)
+{
+  struct PLCStringStruct *pString = (struct PLCStringStruct *)pBuf->acData;
+  pString->iLen = strlen(pBuf->szValue);
+  strncpy(pString->szData, pBuf->szValue, pString->iLen);
+
+  pBuf->iOp = 0;
+  pBuf->pszFormat = "i1c82";
+  pBuf->iLen = sizeof(PLCString);
+} // void function, no return value
+
+// MicroLogix: ST file element - length word (59) + data with the bytes
+// ..of each word swapped, PLC_WBYTE with word conversion
+// Parameters: buffer to encode into (value in szValue)
+void EncodeMicroLogixString(pPLCWriteBuf pBuf)
+{
+  char *pszData = pBuf->acData;
+  snprintf(pszData, sizeof(pBuf->acData), "xx%s ", pBuf->szValue);
+  pszData[0] = 59;
+  pszData[1] = 0;
+  for (int j = 2; j <= 60; j+= 2)
+  {
+    char cTmp;
+    cTmp = pszData[j];
+    pszData[j] = pszData[j + 1];
+    pszData[j + 1] = cTmp;
+  }
+
+  pBuf->iOp = PLC_WBYTE;
+  pBuf->pszFormat = PLC_CVT_WORD;
+  pBuf->iLen = 52;
+} // void function, no return value
+
+// Writes an encoded value to a PLC var
+// ..timeouts are retried within the stall budget, then (like COMM errors)
+// ..the link is handed to the reconnect manager; any other error is the
+// ..PLC rejecting this write - not retried
+// Parameters: PLC Connection, Variable Name, encoded value (EncodePLCString)
+// Returns: PLCWRITEOK, PLCWRITELINKDOWN if the link is (or went) down,
+// ..PLCWRITEREJECTED
+int WriteEncodedToPLC(pPLCConnection pConn, char *pszVarName, pPLCWriteBuf pBuf)
+{
+	int iTimeouts = 0, iTimeoutMS, iWaitedMS = 0;
+
+  // Registry entry of the tag [for I/O stats]
+  TagInfo Scratch;
+  pTagInfo pTag = GetTag(pszVarName, 's', &Scratch);
+
+  // Lock the connection
+  LockPLC(pConn);
+  long long llCallStartUS = MonotonicUS();
 writer:
-	/// Write to PLC
-  int iBytesWritten;
-  // Is this a controllogix plc?
-  if (g_CfgInfo.iPLCType == 0)
-      iBytesWritten  = plc_write(pPLC, 0, pszVarName, (void *)&PLCString, sizeof(PLCString), PLCTIMEOUT, "i1c82");
-  else
+  // Link down? Reconnect manager is on it - fail straight away
+  if (pConn->bLinkDown)
   {
-  		char szVal[100] = {0};
-  		sprintf(szVal, "xx%s ", pszVal);
-  		szVal[0] = 59;
-  		szVal[1] = 0;
-  		for (int j = 2; j <= 60; j+= 2)
-  		{
-  			char cTmp;
-  			cTmp = szVal[j];
-  			szVal[j] = szVal[j + 1];
-  			szVal[j + 1] = cTmp;
-  		}
-      iBytesWritten  = plc_write(pPLC, PLC_WBYTE, pszVarName, (void *)szVal, 52, PLCTIMEOUT, PLC_CVT_WORD);
+    UnlockPLC(pConn);
+    return PLCWRITELINKDOWN;
   }
 
+	/// Write to PLC [timed for the round trip estimate]
+  int iBytesWritten;
+  iTimeoutMS = GetPLCTimeout(pConn, iTimeouts);
+  long long llStartUS = MonotonicUS();
+  iBytesWritten = plc_write(pConn->pPLC, pBuf->iOp, pszVarName, (void *)pBuf->acData, pBuf->iLen, iTimeoutMS, pBuf->pszFormat);
+  if (iBytesWritten != -1)
+    UpdatePLCRTT(pConn, MonotonicUS() - llStartUS);
+
   char szMsg[1024] = {0};
-	sprintf(szMsg, "WriteVarToPLC:: Wrote: Var [%s] Data [%s] result [%d]\n", pszVarName, PLCString.szData, iBytesWritten);
+	sprintf(szMsg, "WriteVarToPLC:: Wrote: Var [%s] Data [%s] result [%d]\n", pszVarName, pBuf->szValue, iBytesWritten);
 	DoLog(szMsg, 5);
 
 	// Error?
 	if (iBytesWritten == -1)
 	{
 		// Need to check error reason
-		plc_print_error(pPLC, "plc_write");
+		plc_print_error(pConn->pPLC, "plc_write");
+		pConn->iLastError = pConn->pPLC->j_error;
 
     // Log error to file
     char szErr[1024] = {0};
-    sprintf(szErr, "plc_write: Error [%s][%d]", pPLC->ac_errmsg, pPLC->j_error);
-    DoLog(szErr);
+    sprintf(szErr, "plc_write: Tag [%s] Timeout: %d ms Error [%s][%d]", pszVarName, iTimeoutMS, pConn->pPLC->ac_errmsg, pConn->pPLC->j_error);
+    DoLog(szErr, 1);
 
 
 		// Was this a transport error?
-		if (pPLC->j_error == PLCE_COMM_SEND || pPLC->j_error == PLCE_COMM_RECV)
+		if (pConn->pPLC->j_error == PLCE_COMM_SEND || pConn->pPLC->j_error == PLCE_COMM_RECV)
+		{
+			/// Communication error, hand the connection to the reconnect manager
+      pConn->iErrors++;
+linkdownw:
+			MarkPLCLinkDown(pConn, "PLCWrite");
+      RecordPLCCall(pConn, pTag, MonotonicUS() - llCallStartUS, FALSE, iTimeouts);
+      RecordPLCTraffic(pConn, pszVarName, 'w', -1, pBuf->szValue);
+
+      // UnLock the connection
+      UnlockPLC(pConn);
+
+      return PLCWRITELINKDOWN;
+		} // end of check for catastrophic error
+		// Just a timeout?
+		else if (pConn->pPLC->j_error == PLCE_TIMEOUT)
+		{
+			/// Retry, and after multiple timeouts, treat the link as down
+			// Increment timeout counters
+			iTimeouts++;
+			iWaitedMS += iTimeoutMS;
+			pConn->iTimeouts++;
+
+			// Next try would blow the stall budget? [always retry once]
+			if (iTimeouts >= 2 && iWaitedMS + GetPLCTimeout(pConn, iTimeouts) > PLCSTALLBUDGETMS)
+					// Proceed to link down
+					goto linkdownw; // Are goto statements evil? ;)
+		} // end of timeout check
+		else
 		{
-			/// Communication error, need to reconnect with PLC and retry
-reconnectw:
-			// Reset timeout counter
-			iTimeouts = 0;
+			// Rejected by the PLC [bad address, invalid reply, ..] - this error
+			// ..cant be handled, writing it again would get the same answer
+			pConn->iErrors++;
+			RecordPLCCall(pConn, pTag, MonotonicUS() - llCallStartUS, FALSE, iTimeouts);
+			RecordPLCTraffic(pConn, pszVarName, 'w', -1, pBuf->szValue);
+
+			// UnLock the connection
+			UnlockPLC(pConn);
+
+			return PLCWRITEREJECTED;
+		}
+
+    // Retry write [timeout]
+    goto writer;
+	} // end of error check
+
+  RecordPLCCall(pConn, pTag, MonotonicUS() - llCallStartUS, TRUE, iTimeouts);
+  RecordPLCTraffic(pConn, pszVarName, 'w', iBytesWritten, pBuf->szValue);
 
-			// Was this the order PLC?
-			if (pPLC == g_pOrderPLC)
-			{
-				DoLog("PLCRead:: OrderPLC disconnected, reconnecting...");
+  // UnLock the connection
+  UnlockPLC(pConn);
 
-        // Close the PLC connection
-        plc_close(pPLC);
+  return PLCWRITEOK;
+} // end of encoded PLC write func
 
-				// Reconnect order PLC
-				pPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
+// Adds a latency sample to a histogram
+// ..bucket = 4 x power of 2 + next 2 bits (values below 4us are exact)
+// Parameters: Histogram, latency in microseconds
+void AddLatency(pLatencyHist pHist, long long llUS)
+{
+    int iBucket;
 
-        DoLog("PLCRead:: OrderPLC reconnected");
+    if (llUS < 0)
+      llUS = 0;
 
-				// Store
-				g_pOrderPLC = pPLC;
-			} // End of orderplc check
-			// No, Scan PLC?
-			else if(pPLC == g_pScanPLC)
-			{
-				DoLog("PLCRead:: ScanPLC disconnected, reconnecting...");
+    if (llUS < 4)
+      iBucket = (int)llUS;
+    else
+    {
+      int iMsb = 63 - __builtin_clzll(llUS);
+      iBucket = iMsb * 4 + (int)((llUS >> (iMsb - 2)) & 3) - 4;
+      if (iBucket >= LATHISTBUCKETS)
+        iBucket = LATHISTBUCKETS - 1;
+    }
 
-        // Close the PLC connection
-        plc_close(pPLC);
+    pHist->auBuckets[iBucket]++;
+    pHist->uCount++;
+    pHist->llTotalUS += llUS;
+    if (llUS > pHist->llMaxUS)
+      pHist->llMaxUS = llUS;
+} // void function, no return value
 
-				// Reconnect scan plc
-				pPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
+// Gets a percentile from a histogram
+// Parameters: Histogram, percentile (e.g 99)
+// Returns: upper bound of the bucket holding the percentile in microseconds
+long long LatencyPercentileUS(pLatencyHist pHist, int iPercent)
+{
+    unsigned int uTarget = (unsigned int)(((unsigned long long)pHist->uCount * iPercent + 99) / 100);
+    unsigned int uSeen = 0;
 
-        DoLog("PLCRead:: ScanPLC reconnected");
+    for (int i = 0; i < LATHISTBUCKETS; i++)
+    {
+      uSeen += pHist->auBuckets[i];
+      if (uSeen < uTarget || !uSeen)
+        continue;
 
-				// Store
-				g_pScanPLC = pPLC;
-			} // end of scanplc check
-      else // No PLC match
+      // Bucket upper bound [capped by the max seen]
+      long long llUpperUS = i;
+      if (i >= 4)
       {
-        // Error!
-        sprintf(szErr, "PLCRead:: Invalid PLC pointer! pPLC [%d] ScanPLC [%d] OrderPLC [%d]", pPLC, g_pScanPLC, g_pOrderPLC);
-        DoLog(szErr, 2);
+        int iMsb = (i + 4) / 4;
+        llUpperUS = ((4LL + (i + 4) % 4 + 1) << (iMsb - 2)) - 1;
+      }
+      return llUpperUS < pHist->llMaxUS ? llUpperUS : pHist->llMaxUS;
+    }
+
+    return pHist->llMaxUS;
+}
+
+// Formats a histogram summary for logs (count, avg, p50/p90/p99, max in ms)
+// Parameters: Output string (atleast 128 chars), Histogram
+void FormatLatency(char *pszOut, pLatencyHist pHist)
+{
+    sprintf(pszOut, "n %u avg %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f ms", pHist->uCount, \
+      pHist->uCount ? pHist->llTotalUS / 1000.0 / pHist->uCount : 0.0, \
+      LatencyPercentileUS(pHist, 50) / 1000.0, LatencyPercentileUS(pHist, 90) / 1000.0, \
+      LatencyPercentileUS(pHist, 99) / 1000.0, pHist->llMaxUS / 1000.0);
+}
+
+// Records one PLC read/write for stats
+// MUST be called with the connection lock held
+// Parameters: Connection, Tag, latency incl. retries in microseconds,
+// ..TRUE if it succeeded, # of timeouts during the call
+void RecordPLCCall(pPLCConnection pConn, pTagInfo pTag, long long llUS, BOOL bOK, int iTimeouts)
+{
+    AddLatency(&pConn->CallHist, llUS);
+
+    pthread_mutex_lock(&g_tagLock);
+    AddLatency(&pTag->Hist, llUS);
+    pTag->iErrors += !bOK;
+    pTag->iTimeouts += iTimeouts;
+    pthread_mutex_unlock(&g_tagLock);
+} // void function, no return value
+
+// Dumps PLC I/O stats to the log - per connection, then per tag
+void DumpPLCStats()
+{
+    pPLCConnection pConns[] = {&g_OrderPLC, &g_ScanPLC};
+    char szMsg[1024], szCalls[256], szLockWait[256];
+
+    DoLog("PLCStats:: ---- PLC I/O stats since start ----", 1);
 
- 
-        // Done with PLCIO, unlock
-        pthread_mutex_unlock(&g_plcLock);
+    for (int i = 0; i < 2; i++)
+    {
+      pPLCConnection pConn = pConns[i];
+
+      pthread_mutex_lock(&pConn->Lock);
+      FormatLatency(szCalls, &pConn->CallHist);
+      FormatLatency(szLockWait, &pConn->LockWaitHist);
+      sprintf(szMsg, "PLCStats:: %s calls [%s] lock wait [%s] timeouts %d errors %d reconnects %d " \
+        "recover last/max %lld/%lld ms srtt %.2f ms%s", pConn->szName, szCalls, szLockWait, \
+        pConn->iTimeouts, pConn->iErrors, pConn->iReconnects, pConn->llLastRecoverMS, \
+        pConn->llMaxRecoverMS, pConn->llSRTTUS / 1000.0, pConn->bLinkDown ? " LINK DOWN" : "");
+      pthread_mutex_unlock(&pConn->Lock);
+
+      DoLog(szMsg, 1);
+    }
+
+    pthread_mutex_lock(&g_tagLock);
+    for (int i = 0; i < g_iTagCount; i++)
+    {
+      // Only tags that have been used
+      if (!g_Tags[i].Hist.uCount)
+        continue;
+
+      FormatLatency(szCalls, &g_Tags[i].Hist);
+      sprintf(szMsg, "PLCStats:: Tag [%s] %c [%s] timeouts %d errors %d", \
+        g_Tags[i].szName, g_Tags[i].cType, szCalls, g_Tags[i].iTimeouts, g_Tags[i].iErrors);
+      DoLog(szMsg, 1);
+    }
+    pthread_mutex_unlock(&g_tagLock);
+} // void function, no return value
 
-        // Fail
-        return NULL;
+// Stats thread - dumps every PLCSTATSINTERVAL seconds, or when asked (SIGUSR1)
+// params: pArg = NULL (no argument needs to be passed)
+void *PLCStatsWorkerFunction(void *pArg)
+{
+    time_t ttLastDump = time(NULL);
+
+    while (!g_bAppDone)
+    {
+      sleep(1);
+
+      if (g_bDumpPLCStats || difftime(time(NULL), ttLastDump) >= PLCSTATSINTERVAL)
+      {
+        g_bDumpPLCStats = 0;
+        DumpPLCStats();
+        time(&ttLastDump);
       }
+    }
 
-      // Redo the write now that we've reconnected
-      goto writer;
+    return NULL;
+} // end of stats thread
 
-		} // end of check for catastrophic error
-		// Just a timeout?
-		else if (pPLC->j_error == PLCE_TIMEOUT)
-		{
-			/// Retry, and after multiple timeouts, reconnect with PLC and retry
-			// Increment timeout counter
-			iTimeouts++;
+// SIGUSR1 handler - asks the stats thread for a dump
+void PLCStatsSignalHandler(int iSignal)
+{
+    g_bDumpPLCStats = 1;
+}
 
-			// More than 5?
-			if (iTimeouts == 5)
-					// Proceed to reconnect
-					goto reconnectw; // Are goto statements evil? ;)
-		} // end of timeout check
+// Starts periodic + on demand (kill -USR1) PLC I/O stats dumps
+// ..called once at service start
+void StartPLCStats()
+{
+    pthread_t tStats;
 
-    // Retry write
-    goto writer;
-	} // end of error check
+    signal(SIGUSR1, PLCStatsSignalHandler);
 
-  // UnLock the PLCIO code
-  pthread_mutex_unlock(&g_plcLock);
-} // end of PLC write func, no return value
+    pthread_create(&tStats, NULL, &PLCStatsWorkerFunction, NULL);
+    pthread_detach(tStats);
+} // void function, no return value
+
+// Starts recording PLC traffic (PLCRecord=<file>)
+// ..every tag read + write from here on is appended to the log
+// ..called once at service start, after the config is known (PLC type)
+// Parameters: log file path (overwritten)
+// Returns: TRUE if recording
+BOOL StartPLCRecorder(char *pszFile)
+{
+    char szMsg[1024] = {0};
+    PLCRecordFileHeader Header;
+
+    FILE *pFile = fopen(pszFile, "wb");
+    if (!pFile)
+    {
+      sprintf(szMsg, "PLCRecord:: Cant open [%s] Error [%s]", pszFile, strerror(errno));
+      DoLog(szMsg, 1);
+      return FALSE;
+    }
+
+    // Calls are small + frequent - big buffer, flushed by time
+    setvbuf(pFile, NULL, _IOFBF, 65536);
+
+    struct timeval tvNow;
+    gettimeofday(&tvNow, NULL);
+
+    memset(&Header, 0, sizeof(Header));
+    memcpy(Header.szMagic, PLCRECORDMAGIC, sizeof(Header.szMagic));
+    Header.iPLCType = g_CfgInfo.iPLCType;
+    Header.llStartUS = (long long)tvNow.tv_sec * 1000000 + tvNow.tv_usec;
+    fwrite(&Header, sizeof(Header), 1, pFile);
+
+    pthread_mutex_lock(&g_recordLock);
+    g_llRecordStartUS = g_llRecordFlushUS = MonotonicUS();
+    g_pRecordFile = pFile;
+    pthread_mutex_unlock(&g_recordLock);
+
+    sprintf(szMsg, "PLCRecord:: Recording PLC traffic to [%s]", pszFile);
+    DoLog(szMsg, 1);
+
+    return TRUE;
+} // end of start recorder func
+
+// Stops recording, flushing what is buffered
+void StopPLCRecorder()
+{
+    pthread_mutex_lock(&g_recordLock);
+    if (g_pRecordFile)
+      fclose(g_pRecordFile);
+    g_pRecordFile = NULL;
+    pthread_mutex_unlock(&g_recordLock);
+} // void function, no return value
+
+// Appends one tag read/write to the traffic log (if recording)
+// MUST be called with the connection lock held (for the error code)
+// Parameters: Connection, tag name, tag type ('b'/'s'/'i', 'w' for writes),
+// ..result (bytes, -1 = failed), raw bytes read / NUL terminated string written
+void RecordPLCTraffic(pPLCConnection pConn, char *pszVarName, char cType, int iResult, void *pData)
+{
+    // Not recording? [unlocked check, the file is only set once]
+    if (!g_pRecordFile)
+      return;
+
+    PLCRecordHeader Record;
+    int iNameLen = strlen(pszVarName);
+    int iDataLen = 0;
+
+    // Payload: bytes read, or the string written
+    if (iResult > 0)
+      iDataLen = (cType == 'w') ? strlen((char *)pData) : iResult;
+
+    memset(&Record, 0, sizeof(Record));
+    Record.cConn = (pConn == &g_ScanPLC);
+    Record.cType = cType;
+    Record.cNameLen = iNameLen < 255 ? iNameLen : 255;
+    Record.sResult = iResult < 0 ? -1 : (iDataLen < MAXPLCREAD ? iDataLen : MAXPLCREAD);
+    Record.sError = iResult < 0 ? pConn->iLastError : 0;
+
+    pthread_mutex_lock(&g_recordLock);
+    if (g_pRecordFile)
+    {
+      long long llNowUS = MonotonicUS();
+      Record.llTimeUS = llNowUS - g_llRecordStartUS;
+
+      fwrite(&Record, sizeof(Record), 1, g_pRecordFile);
+      fwrite(pszVarName, Record.cNameLen, 1, g_pRecordFile);
+      if (Record.sResult > 0)
+        fwrite(pData, Record.sResult, 1, g_pRecordFile);
+
+      // Flush now + then, so a killed service leaves a usable log
+      if (llNowUS - g_llRecordFlushUS >= PLCRECORDFLUSHMS * 1000)
+      {
+        fflush(g_pRecordFile);
+        g_llRecordFlushUS = llNowUS;
+      }
+    }
+    pthread_mutex_unlock(&g_recordLock);
+} // void function, no return value
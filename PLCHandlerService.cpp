@@ -7,31 +7,82 @@
 void CheckItemsForTimeouts();
 void DispenseItemFromList(pItemDispenseData pItem);
 void InitializeCompartmentInfo();
-void WaitTillPLCReady(PLC *pPLC);
+void WaitTillPLCReady(pPLCConnection pConn);
 void ProcessMachineStateData();
+void ApplyStageData(int i, int j, BOOL bFlag, char *pszBCON);
+unsigned int GetStagePollMask();
 void *ScanWorkerFunction(void *pArg);
-BOOL GetScanStatus(PLC *pPLC);
+void BeginScan(pScanResults pResults, const char *pszMode);
+void ReadAsyncScanResults(pScanResults pResults);
+void AddAsyncScanItem(pScanResults pResults, int iIdx, char *pszBarCode);
+BOOL ReadSyncScanData(pScanResults pResults);
+int SyncScanBackoffMS(pScanResults pResults, BOOL bNewData);
+int ParseSlotNumber(char *pszSlotNumber);
+void FinishScan(pScanResults pResults);
+void LogScanThroughput(pScanResults pResults);
+BOOL GetScanStatus(pPLCConnection pConn);
 void GetConfigFromLocalCloud(ConfigInfo *cfgInfo);
 void DoLog(const char *pszLogMsg, int iPriority = 0);
 pNode InsertListNode(char *pszDispenseID, int iStatus, char *pszOrderStub);
 char *substr(char *pszString, int iStartIdx, int iNumChars);
 void PurgeItemFromStatusList(char *pszDispenseID);
 void PostTotalStockToLocalCloud();
-void UpdateDispenserStock(char pszSlotArray[][10], char pszBarCodeArray[][35], int iNumScanned);
+BOOL InitStockStorage(int iSlotCount);
+void UpdateDispenserStock(int iSlotNumArray[], char pszBarCodeArray[][35], int iNumScanned);
+int FindOrAddStockEntry(char *pszBarCode);
+unsigned int HashBarCode(const char *pszBarCode);
+unsigned int StockSlotHash(int iEntry);
+BOOL AllocStockSnapshot(pStockSnapshot pSnap);
+int FindSnapshotEntry(pStockSnapshot pSnap, char *pszBarCode);
+void AddSnapshotEntry(pStockSnapshot pSnap, char *pszBarCode, int iQty, unsigned int uSlotHash);
+BOOL BuildStockPostBody(pJSONWriter pBody, pStockSnapshot pPrev, pStockSnapshot pNext);
+BOOL StockResyncRequested(struct MemoryStruct *pResp);
+int BuildStockSlotString(int iEntry, char *pszOut, int iMaxLen);
+void JSONReset(pJSONWriter pWriter);
+BOOL JSONReserve(pJSONWriter pWriter, size_t stMore);
+void JSONAppendRaw(pJSONWriter pWriter, const char *pszText);
+void JSONAppendString(pJSONWriter pWriter, const char *pszVal);
+void JSONAppendInt(pJSONWriter pWriter, int iVal);
+void JSONAppendStockSlots(pJSONWriter pWriter, int iEntry);
 pItemDispenseData *GetNewItemsFromLocalCloud();
 void PostItemStatusToLocalCloud(char *pszOrderStub, char *pszDispenseID, int iStatus, char *pszTimerString = NULL);
 void *SendScanStartSignalToLocalCloud(void *pArg);
 void ProcessCfgResponse(ConfigInfo *pCfgInfo, struct MemoryStruct *pData);
-static size_t CurlWriterCallback(void *pContents, size_t stSize, size_t stNum, void *pUser);
 void PopulateStageVarsAndTypes();
+void PopulateTagRegistry(pPLCConnection pConn);
 void WriteCompletionStatusToFile(char *pszOrderStub, int iLane);
-void *PostItemStatusWorker(void *pData);
+void StartOrderWriter();
+void *OrderWriterFunction(void *pArg);
+BOOL IsOrderWritePending();
 
 // externs
-extern void DisconnectFromPLC(PLC *pPLC);
-extern PLC *ConnectToPLC(char *pszIP, int iPort, BOOL bMicroLogix);
-extern char *ReadVarFromPLC(PLC *pPLC, char *pszVarName, char cVarType);
-extern void *WriteVarToPLC(PLC *pPLC, char *pszVarName, char *pszVal, int iLen);
+extern void InitPLCConnection(pPLCConnection pConn, const char *pszName);
+extern void DisconnectFromPLC(pPLCConnection pConn);
+extern void ConnectToPLC(pPLCConnection pConn, char *pszIP, int iPort, BOOL bMicroLogix);
+extern BOOL ReadBool(pPLCConnection pConn, char *pszVarName, BOOL *pbVal);
+extern BOOL ReadString82(pPLCConnection pConn, char *pszVarName, char *pszVal);
+extern int ReadString82Array(pPLCConnection pConn, char *pszArrayName, int iFirst, int iCount, char *pszVals);
+extern void EncodePLCString(char *pszVal, pPLCWriteBuf pBuf);
+extern int WriteEncodedToPLC(pPLCConnection pConn, char *pszVarName, pPLCWriteBuf pBuf);
+extern void StartReconnectManager();
+extern void StartPLCStats();
+extern BOOL StartPLCRecorder(char *pszFile);
+extern void StopPLCRecorder();
+extern int ReadStageSnapshot(pPLCConnection pConn, pStageSnapshot pSnapshot, unsigned int uStageMask);
+extern long long MonotonicMS();
+extern pTagInfo GetTag(char *pszVarName, char cVarType, pTagInfo pScratch);
+extern void ValidateTagRegistry(pPLCConnection pConn);
+extern void RunReactor();
+extern void SelectPLCTagSet(int iPLCType);
+extern void InitLocalCloudClient();
+extern void CleanupLocalCloudClient();
+extern void BuildLocalCloudURL(char *pszURL, const char *pszPath);
+extern CURLcode LocalCloudRequest(const char *pszPath, const char *pcBody, size_t stBodyLen, struct MemoryStruct *pResp, long *plHTTPCode);
+extern void StartLocalCloudAsync();
+extern void ConfigureStatusBatching(int iWindowMS, int iMaxItems);
+extern BOOL QueueItemStatus(const char *pszItem);
+extern const PLCTagSet *g_pTagSet;
+extern void StartPushListener(char *pszOpenString);
 
 /// START Global Variables ////////////////////////////////////////
 // Linked List head/tail
@@ -43,13 +94,14 @@ FILE *g_pLogFile = NULL;
 // Config info
 ConfigInfo g_CfgInfo = {0};
 
-// Mutexes (LOCKs) for Log File + PLC + stock table
+// Mutexes (LOCKs) for Log File + PLC + stock table + item-status-list
 // Log file write operations
-// ..and PLCIO library calls
-// ..as both may be performed from multiple threads [and PLCIO lib isnt thread-safe]
+// ..and PLCIO library-wide calls (plc_open/plc_close - each PLC session
+// ..has its own lock for reads/writes, see PLCConnection)
 // ..stock table as scans into stock table and reads from stock table can happen
 // ..from multiple threads
-pthread_mutex_t g_logLock, g_plcLock, g_stockLock;
+// ..item-status-list as PLC pushes update it from the push listener thread
+pthread_mutex_t g_logLock, g_plcLock, g_stockLock, g_listLock;
 
 // Scan worker thread ID, scan signal thread id
 pthread_t scanThreadID;
@@ -60,23 +112,34 @@ pthread_t scanSignalThreadID;
 // ..better than doing WHILE(TRUE) loops which future devs may curse us for
 BOOL g_bAppDone = FALSE;
 
-// PLC Pointers - one for orders, one for scan
-PLC *g_pOrderPLC = NULL, *g_pScanPLC = NULL;
+// PLC Connections - one for orders, one for scan
+PLCConnection g_OrderPLC, g_ScanPLC;
 
 // Compartment Info [upto 4]
 CompartmentInfo g_CompInfo = {0};
 
-// Stock Table
+// Stock Table [structure of arrays, sized from the slot count by InitStockStorage]
+// ..barcode entries: barcode (34 chars + NUL), qty, first + last of its slot chain
+// ..scanned items: slot number, next slot of same barcode (-1 = end)
+// ..barcode hash -> entry + 1 (0 = empty), linear probing
+// ..all carved from one arena, along with the scan results arrays
+int g_iStockCapacity = 0;
 int g_iBarCodeCount = {0};
-char g_szBarCodeArray[MAXITEMS][35] = {0}; // MAXITEMS barcodes, 25 chars including NUL
-char g_szSlotStringArray[MAXITEMS][2000] = {0}; // MAXITEMS barcodes, 2000 char slot string
-int g_iSlotCountArray[MAXITEMS] = {0};
+char (*g_szBarCodeArray)[35] = NULL;
+int *g_iSlotCountArray = NULL;
+int *g_iStockFirstSlot = NULL;
+int *g_iStockLastSlot = NULL;
+int *g_iStockSlotNums = NULL;
+int *g_iStockSlotNext = NULL;
+int *g_iStockHash = NULL;
+int g_iStockHashSize = 0;
 
 // Stage Variables array
-// ..this is a 3-D array {Stage, Variants for Stage, Variable-Name-Char-Array}
+// ..this is a 2-D array {Stage, Variants for Stage} of variable names
 // ..since each stage may be seen at different dispensers, microwaves, etc [variants]
-char g_szStageVars[10][4][200] = {0};
-char g_szStageTypes[10][4][1] = {0};
+// ..names point into the PLC family's tag set, unused entries are ""
+char *g_pszStageVars[10][4];
+char g_cStageTypes[10][4] = {0};
 
 // Local Cloud IP:Port
 char g_szIPPort[22] = {0};
@@ -90,9 +153,47 @@ int g_iLogPriority = LOGPRIORITY;
 
 int g_iStatusListNodeCount = 0;
 
+// Item-status-list generation - bumped on every insert, purge + stage update
+// ..[guarded by g_listLock]
+int g_iStatusListGen = 0;
+
+// Stage change-detection cache - last value of each stage-variable
+// ..applied by ProcessMachineStateData + list generation at the time
+// ..[poll thread only]
+StageCacheEntry g_StageCache[MACHINESTAGECOUNT + 1][4];
+int g_iStageCacheGen = -1;
+
+// Last time the stages no active item is near were read (monotonic ms)
+long long g_llStageColdPollMS = 0;
+
+// Results of the scan in progress [one scan at a time]
+ScanResults g_ScanResults;
+
+// Stock post body [reused by each post, posts take turns on g_stockPostLock]
+JSONWriter g_StockPostBody = {0};
+pthread_mutex_t g_stockPostLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Delta stock posts (PLCStockDelta=1) - only changes since the stock LocalCloud
+// ..last acknowledged are posted, snapshots of the last acknowledged + the
+// ..in-flight post [swapped on acknowledge, g_stockPostLock]
+BOOL g_bStockDelta = FALSE;
+StockSnapshot g_StockSnapshots[2] = {0};
+pStockSnapshot g_pAckedStock = &g_StockSnapshots[0];
+pStockSnapshot g_pPostedStock = &g_StockSnapshots[1];
+
+// Event loop mode - one thread runs orders, stages and scans (PLCEventLoop=1)
+BOOL g_bReactorMode = FALSE;
+
 // Array that tracks dispense-id dispense start
 BOOL g_bDispenseIDStarted[50000] = {0};
 
+// Order write queue (ring) for the order writer thread - head, count,
+// ..writes queued or being written [guarded by g_writeLock]
+OrderWrite g_OrderWrites[ORDERWRITEQUEUESIZE];
+int g_iOrderWriteHead = 0, g_iOrderWriteCount = 0, g_iOrderWritesPending = 0;
+pthread_mutex_t g_writeLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_writeCond = PTHREAD_COND_INITIALIZER;
+
 /// END Global Variables //////////////////////////////////////////
 
 
@@ -103,8 +204,24 @@ int main()
 {
 	// Initialize mutexes
 	pthread_mutex_init(&g_logLock, NULL);
+	// ..PLCIO lock is never taken twice: under a connection lock (which holds
+	// ..it with PLCIO_GLOBAL_LOCK) handles are closed through ClosePLCHandle
 	pthread_mutex_init(&g_plcLock, NULL);
 	pthread_mutex_init(&g_stockLock, NULL);
+	pthread_mutex_init(&g_listLock, NULL);
+
+	// Initialize PLC connections [not connected yet]
+	InitPLCConnection(&g_OrderPLC, "OrderPLC");
+	InitPLCConnection(&g_ScanPLC, "ScanPLC");
+
+	// Start background reconnect manager [recovers dropped PLC links]
+	StartReconnectManager();
+
+	// Start PLC I/O stats dumps [every PLCSTATSINTERVAL secs + on SIGUSR1]
+	StartPLCStats();
+
+	// Start order writer [writes order stubs to the PLC off the dispense loop]
+	StartOrderWriter();
 
 	// Avoid SIGPIPE CRASHES
 	signal(SIGPIPE, SIG_IGN);
@@ -114,6 +231,21 @@ int main()
 	// Initialize curl
 	curl_global_init(CURL_GLOBAL_ALL);
 
+	// Shared LocalCloud connections [keep-alive across requests + threads]
+	// ..+ the async engine for item status posts
+	InitLocalCloudClient();
+	StartLocalCloudAsync();
+
+	// Item status batching requested? [window in ms + max items per batch,
+	// ..LocalCloud must support it]
+	char *pszBatch = getenv("PLCStatusBatch");
+	char *pszBatchMS = getenv("PLCStatusBatchMS");
+	char *pszBatchMax = getenv("PLCStatusBatchMax");
+	if (pszBatch && atoi(pszBatch) == 1)
+		ConfigureStatusBatching(pszBatchMS ? atoi(pszBatchMS) : LCSTATUSBATCHMS, pszBatchMax ? atoi(pszBatchMax) : LCSTATUSBATCHMAX);
+	else
+		ConfigureStatusBatching(0, 1);
+
 	// Get Config from LocalCloud
 	// ...this function will keep retrying until it gets the configuration
 	GetConfigFromLocalCloud(&g_CfgInfo);
@@ -126,33 +258,76 @@ int main()
 			g_CfgInfo.bAsyncScan?"yes":"no", g_CfgInfo.iSlotCount);	
 	DoLog(szLogMsg, 1);
 
+	// Delta stock posts requested? [LocalCloud must support them]
+	char *pszStockDelta = getenv("PLCStockDelta");
+	g_bStockDelta = (pszStockDelta && atoi(pszStockDelta) == 1);
+
+	// Stock table + scan results storage for this dispenser's slots
+	// ..async scans read exactly the configured slots, sync scans report
+	// ..whatever slot numbers the PLC sends - room for MAXITEMS then
+	if (!InitStockStorage(g_CfgInfo.bAsyncScan ? g_CfgInfo.iSlotCount : MAXITEMS))
+	{
+		DoLog("Main:: Unable to allocate stock storage, exiting", 1);
+		return 1;
+	}
+
+	// Pick the tag set of our PLC family [MicroLogix/ControlLogix]
+	SelectPLCTagSet(g_CfgInfo.iPLCType);
+
+	/// Compartment Preparation
+	// Just gets the variables and puts them in our
+	// dispenser struct for easy access
+	// ..needs only the tag set - before the scan thread reads them
+	InitializeCompartmentInfo();
+
 	// Populate array of stage-var-strings [indexed from 1 onwards]
 	// ...this is dependent on CfgInfo as the var names vary between
 	// ...MicroLogix/ControlLogix
 	PopulateStageVarsAndTypes();
 
-	// Spawn Scan Worker Thread
-	pthread_create(&scanThreadID, NULL, &ScanWorkerFunction, NULL);
+	// PLC traffic recording requested? [for offline replay with the mock PLC library]
+	char *pszRecord = getenv("PLCRecord");
+	if (pszRecord && pszRecord[0])
+		StartPLCRecorder(pszRecord);
+
+	// Event loop mode requested?
+	char *pszEventLoop = getenv("PLCEventLoop");
+	g_bReactorMode = (pszEventLoop && atoi(pszEventLoop) == 1);
 
 	/// Main Thread is for Order Processing [No Scan Handling]
 	// Connect to ControlLogix/MicroLogix PLC
 	// ... [the function will retry until connection succeeds]
 	if (g_CfgInfo.iPLCType == 0)
-		g_pOrderPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, FALSE); // ControlLogix
+		ConnectToPLC(&g_OrderPLC, g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, FALSE); // ControlLogix
 	else
-		g_pOrderPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, TRUE); // MicroLogix
+		ConnectToPLC(&g_OrderPLC, g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, TRUE); // MicroLogix
 
 	DoLog("Main:: OrderPLC Connected, Waiting for POWER ON + READY");
 
 	// Wait till PLC ready (Power On + Always On must be set)
-	WaitTillPLCReady(g_pOrderPLC);
+	WaitTillPLCReady(&g_OrderPLC);
 
 	DoLog("Main:: OrderPLC POWER ON + READY");
 
-	/// Compartment Preparation
-	// Just gets the variables and puts them in our
-	// dispenser struct for easy access
-	InitializeCompartmentInfo();
+	/// Tag Registry
+	// Validates every tag we poll once, so absent tags
+	// ..are never requested from the PLC
+	PopulateTagRegistry(&g_OrderPLC);
+
+	// Spawn Scan Worker Thread [the event loop does scans itself]
+	// ..only now - validation rewrites the scan tags' registry entries
+	if (!g_bReactorMode)
+		pthread_create(&scanThreadID, NULL, &ScanWorkerFunction, NULL);
+
+	// PLC stage push requested? Stage changes are then seen as the PLC
+	// ..sends them, polling stays on as the fallback
+	char *pszPushListen = getenv("PLCPushListen");
+	if (pszPushListen && pszPushListen[0])
+		StartPushListener(pszPushListen);
+
+	// Event loop mode? This runs orders, stages + scans on this thread until app done
+	if (g_bReactorMode)
+		RunReactor();
 
 	int iItemIdx;
 	pItemDispenseData *pNewItemList = NULL, pListItem = NULL;
@@ -188,7 +363,7 @@ int main()
 		}
 
 
-		char *pszReadyVal = NULL;
+		BOOL bReadyRead = FALSE, bReadyVal = FALSE;
 
 		// Do we have an item to dispense?
 		if (pListItem)
@@ -201,10 +376,12 @@ readinesscheck:
 			DoLog("Dispense Loop:: Checking dispenser for readiness", 5);
 
 			// Read the dispenser ready-var
-			pszReadyVal = ReadVarFromPLC(g_pOrderPLC, g_CompInfo.szDispenseReadinessVar, 'b');
+			bReadyRead = ReadBool(&g_OrderPLC, g_CompInfo.pszDispenseReadinessVar, &bReadyVal);
 
 			// We need a valid return value AND it must be == 1 (true)
-			if (pszReadyVal && !strcmp(pszReadyVal, "1"))
+			// ..and the previous item must be written (until then the
+			// ..PLC may not have dropped its ready flag for it yet)
+			if (bReadyRead && bReadyVal && !IsOrderWritePending())
 			{
 					DoLog("Dispenser ready; sending item", 1);
 
@@ -216,12 +393,9 @@ readinesscheck:
 
 					// Get next 'current-item'
 					pListItem = pNewItemList[iItemIdx];
-
-					// Cleanup memory
-					delete []pszReadyVal;
 			} // end of ready-val presence check
-			// We got a non-null result but it was not 1 i.e ready?
-			else if (pszReadyVal)
+			// We got a result but it was not 1 i.e ready?
+			else if (bReadyRead)
 			{
 					// Sleep a short while (1 second) before retrying
 					sleep(1);
@@ -229,9 +403,6 @@ readinesscheck:
 					// Have we been waiting for readiness too long?
 					if (++iReadinessLoops > ITEMREADINESSTIMEOUT)
 					{
-						// Cleanup memory
-						delete []pszReadyVal;
-
 						// Expire this item
 						char szMsg[1024] = {0};
 						sprintf(szMsg, "{Main Loop} Item readiness timeout DispenseID [%s] OrderStub [%s]", pListItem->szDispenseID, pListItem->szOrderStub);
@@ -256,9 +427,6 @@ readinesscheck:
 					} // end readiness wait timeout check
 					else
 					{
-						// Cleanup memory
-						delete []pszReadyVal;
-
 						DoLog("Dispense Loop:: [item waiting to dispense]", 5);
 
 						// Process Machine State Data
@@ -298,7 +466,7 @@ readinesscheck:
 	DoLog("Main:: Service done, doing cleanup");
 
 	// Disconnect from PLC
-	DisconnectFromPLC(g_pOrderPLC);
+	DisconnectFromPLC(&g_OrderPLC);
 
 	DoLog("Main:: Disconnected from OrderPLC");
 
@@ -313,7 +481,11 @@ readinesscheck:
 		delete []pNewItemList;
 	}
 
+	// Flush + close the traffic log
+	StopPLCRecorder();
+
 	// Cleanup curl
+	CleanupLocalCloudClient();
 	curl_global_cleanup();
 
 	// Clean up - this is never really called
@@ -327,109 +499,59 @@ readinesscheck:
 
 // Fills the stage-vars & stage-types arrays
 // These are the dispense stage PLC variable names
+// ..from our PLC family's tag set (no copies, just pointers)
 // No parameters, no return value
 void PopulateStageVarsAndTypes()
 {
-	// PLC Type 0 == ControlLogix, non 0 == MicroLogix
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[1][1], d1stringBCONPickedItem);
-	else
-		strcpy(g_szStageVars[1][1], d1MLstringBCONPickedItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[2][1], d1stringBCONStagingItem);
-	else
-		strcpy(g_szStageVars[2][1], d1MLstringBCONStagingItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[3][1], d1stringBCONRotaryItem);
-	else
-		strcpy(g_szStageVars[3][1], d1MLstringBCONRotaryItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[4][1], d1stringBCONPiercingItem);
-	else
-		strcpy(g_szStageVars[4][1], d1MLstringBCONPiercingItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[5][1], delstringBCONMic1FrontItem);
-	else
-		strcpy(g_szStageVars[5][1], delMLstringBCONMic1FrontItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[5][2], delstringBCONMic2FrontItem);
-	else
-		strcpy(g_szStageVars[5][2], delMLstringBCONMic2FrontItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[5][3], delstringBCONMic3FrontItem);  // 3 Mics for stage 5-7
-	else
-		strcpy(g_szStageVars[5][3], delMLstringBCONMic3FrontItem);  // 3 Mics for stage 5-7
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[6][1], delstringBCONMic1InsideItem);
-	else
-		strcpy(g_szStageVars[6][1], delMLstringBCONMic1InsideItem);
-
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[6][2], delstringBCONMic2InsideItem);
-	else
-		strcpy(g_szStageVars[6][2], delMLstringBCONMic2InsideItem);
+	for (int i = 0; i < 10; i++)
+	{
+		for (int j = 0; j < 4; j++)
+		{
+			// Unused vars are empty
+			char *pszVar = (i <= MACHINESTAGECOUNT) ? g_pTagSet->pszStageVars[i][j] : NULL;
+			g_pszStageVars[i][j] = pszVar ? pszVar : (char *)"";
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[6][3], delstringBCONMic3InsideItem);  // 3 Mics for stage 5-7
-	else
-		strcpy(g_szStageVars[6][3], delMLstringBCONMic3InsideItem);  // 3 Mics for stage 5-7
+			// Types - string, bool, etc for each var
+			g_cStageTypes[i][j] = pszVar ? g_pTagSet->cStageTypes[i][j] : '\0';
+		}
+	}
+} // end PopulateStageVarsAndTypes method, no return value
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[7][1], delboolFlagMic1HeatingItem);
-	else
-		strcpy(g_szStageVars[7][1], delMLboolFlagMic1HeatingItem);
+// Registers all PLC tags this service reads in the tag registry
+// ..and validates them against the PLC (existence + size)
+// Params: PLC connection to validate on
+void PopulateTagRegistry(pPLCConnection pConn)
+{
+	TagInfo Scratch;
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[7][2], delboolFlagMic2HeatingItem);
-	else
-		strcpy(g_szStageVars[7][2], delMLboolFlagMic2HeatingItem);
+	// Power + ready state
+	GetTag(g_pTagSet->pszPowerOnVar, 'b', &Scratch);
+	GetTag(g_pTagSet->pszAlwaysOnVar, 'b', &Scratch);
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[7][3], delboolFlagMic3HeatingItem); // 3 Mics for stage 5-7
-	else
-		strcpy(g_szStageVars[7][3], delMLboolFlagMic3HeatingItem); // 3 Mics for stage 5-7
+	// Dispenser readiness + scan status
+	GetTag(g_CompInfo.pszDispenseReadinessVar, 'b', &Scratch);
+	GetTag(g_CompInfo.pszScanStartVar, 'b', &Scratch);
+	GetTag(g_CompInfo.pszDoorClosedVar, 'b', &Scratch);
+	GetTag(g_CompInfo.pszOKToOpenDoorVar, 'b', &Scratch);
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[8][1], delstringBCONLane1ChangeItem); // Just 1 variant @ Stage 8
+	// Scan data
+	if (g_CfgInfo.bAsyncScan)
+		GetTag(g_CompInfo.pszAsyncScanCompleteVar, 'b', &Scratch);
 	else
-		strcpy(g_szStageVars[8][1], delMLstringBCONLane1ChangeItem); // Just 1 variant @ Stage 8
+	{
+		GetTag(g_CompInfo.pszSyncScanCompleteVar, 'b', &Scratch);
+		GetTag(g_CompInfo.pszSyncBarCodeSlotNumberVar, 's', &Scratch);
+	}
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[9][1], delstringBCONLane1EndItem);
-	else
-		strcpy(g_szStageVars[9][1], delMLstringBCONLane1EndItem);
+	// Stage variables [1-based]
+	for (int i = 1; i <= MACHINESTAGECOUNT; i++)
+		for (int j = 1; j < 4; j++)
+			if (g_pszStageVars[i][j][0] != '\0')
+				GetTag(g_pszStageVars[i][j], g_cStageTypes[i][j], &Scratch);
 
-	if (g_CfgInfo.iPLCType == 0)
-		strcpy(g_szStageVars[9][2], delstringBCONLane2EndItem);
-	else
-		strcpy(g_szStageVars[9][2], delMLstringBCONLane2EndItem);
-
-	// Types - string, bool, etc for each var
-	g_szStageTypes[1][1][0] = 's';
-	g_szStageTypes[2][1][0] = 's';
-	g_szStageTypes[3][1][0] = 's';
-	g_szStageTypes[4][1][0] = 's';
-	g_szStageTypes[5][1][0] = 's';
-	g_szStageTypes[5][2][0] = 's';
-	g_szStageTypes[5][3][0] = 's';
-	g_szStageTypes[6][1][0] = 's';
-	g_szStageTypes[6][2][0] = 's';
-	g_szStageTypes[6][3][0] = 's';
-	g_szStageTypes[7][1][0] = 'b';
-	g_szStageTypes[7][2][0] = 'b';
-	g_szStageTypes[7][3][0] = 'b';
-	g_szStageTypes[8][1][0] = 's';
-	g_szStageTypes[8][2][0] = 's';
-	g_szStageTypes[9][1][0] = 's';
-	g_szStageTypes[9][2][0] = 's';
-} // end PopulateStageVarsAndTypes method, no return value
+	// Check them all against the PLC
+	ValidateTagRegistry(pConn);
+} // void function, no return value
 
 // Checks items currently dispensing for timeouts
 // (from item status list)
@@ -452,6 +574,9 @@ void CheckItemsForTimeouts()
 
 		pNode pPrev = NULL;
 
+		// Lock item-status-list
+		pthread_mutex_lock(&g_listLock);
+
 		// Loop through item-status-list
 		for (pNode pIter = g_pHead; pIter != NULL; )
 		{
@@ -477,6 +602,7 @@ void CheckItemsForTimeouts()
 
 								// Decrement
 								g_iStatusListNodeCount--;
+								g_iStatusListGen++;
 
 								// Move iterator to new list head
 								pIter = g_pHead;
@@ -491,6 +617,7 @@ void CheckItemsForTimeouts()
 
 								// Decrement
 								g_iStatusListNodeCount--;
+								g_iStatusListGen++;
 
 								// Move iterator to next node
 								pIter = pPrev->pNext;
@@ -506,6 +633,9 @@ void CheckItemsForTimeouts()
 				} // end of difftime not greater than timeout block
 
 		} // end of loop through list
+
+		// Unlock item-status-list
+		pthread_mutex_unlock(&g_listLock);
 } // end of check items for timeout function, no return value
 
 // This function pings local cloud for new items to dispense
@@ -518,7 +648,7 @@ pItemDispenseData *GetNewItemsFromLocalCloud()
 	/// Do a call to LocalCloud to fetch new items json
 	// Construct API URL
 	char szURL[1024] = {0};
-	sprintf(szURL, "http://%s/plcio/order_queue", g_szIPPort);
+	BuildLocalCloudURL(szURL, "order_queue");
 
 	char szMsg[1024] = {0};
 	sprintf(szMsg, "GetNewItemsFromLocalCloud:: Fetching order queue URL [%s]", szURL);
@@ -529,28 +659,13 @@ pItemDispenseData *GetNewItemsFromLocalCloud()
 	NewItemBuffer.pcBuffer = (char *)malloc(1);
 	NewItemBuffer.stSize = 0;
 
-fetchURL2:
-	// Init easy handle
-	CURL *curlEasyHandle = curl_easy_init();
-
-	// This is the URL to fetch
-	curl_easy_setopt(curlEasyHandle, CURLOPT_URL, szURL);
-
-	// Timeout 10 seconds
-	curl_easy_setopt(curlEasyHandle, CURLOPT_TIMEOUT, 10L);
-
-	// Writer callback function + Writer object
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlWriterCallback);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEDATA, (void *)&NewItemBuffer);
-
-	// Fetch it - this is a blocking call
-	CURLcode res = curl_easy_perform(curlEasyHandle);
+	// Fetch it - this is a blocking call [pooled keep-alive connection]
+	CURLcode res = LocalCloudRequest("order_queue", NULL, 0, &NewItemBuffer, NULL);
 
 	// Error check
 	if (res != CURLE_OK)
 	{
-		// Cleanup the handle
-		curl_easy_cleanup(curlEasyHandle);
+		free(NewItemBuffer.pcBuffer);
 
 		sprintf(szMsg, "GetNewItemsFromLocalCloud:: Error reading order-queue URL [%s]", curl_easy_strerror(res));
 		DoLog(szMsg, 1);
@@ -568,9 +683,6 @@ fetchURL2:
 	// Cleanup
 	free(NewItemBuffer.pcBuffer);
 
-	// Done with easy handle
-	curl_easy_cleanup(curlEasyHandle);
-
 	// Try loading into json_t
 	json_t *pRoot;
 	json_error_t Err;
@@ -682,7 +794,9 @@ fetchURL2:
 } // end of get-new-items-fromlocalcloud func
 
 // This function asks PLC to dispense the passed item
-// Params: pItem - ptr to item dispense struct
+// ..the order stub is encoded + queued for the order writer thread, which
+// ..writes it and, once the PLC has taken it, marks the item as started
+// Params: pItem - ptr to item dispense struct (copied, caller keeps ownership)
 void DispenseItemFromList(pItemDispenseData pItem)
 {
 		// Get barcode from order stub [chars 3 to 26 = 24 chars]
@@ -702,27 +816,121 @@ void DispenseItemFromList(pItemDispenseData pItem)
 			// Set heating flag to N
 			szStub[26] = 'N';
 #endif
-		/// Ask PLC to dispense this item
-		/// Write the order stub to PLC
-		WriteVarToPLC(g_pOrderPLC, g_CompInfo.szOrderVar, szStub, strlen(pItem->szOrderStub));
 
-		// Post status to local cloud - dispense started for this order stub
-		// ...Local Cloud will extract dispense id + daily bill number from the stub
-		PostItemStatusToLocalCloud(pItem->szOrderStub, pItem->szDispenseID, STARTED);
+		// Set flag for this dispense id now, so a re-fetched order list
+		// ..doesnt send it again while the write is in flight
+		g_bDispenseIDStarted[atoi(pItem->szDispenseID)] = TRUE;
 
-		/// Append this item to item-status-list with status 'started'
-		// Add to item-status-list
-		InsertListNode(pItem->szDispenseID, STARTED, pItem->szOrderStub);
+		/// Queue the order stub write for the PLC [encoded once, here]
+		pthread_mutex_lock(&g_writeLock);
 
-		// Set flag for this dispense id 
-		g_bDispenseIDStarted[atoi(pItem->szDispenseID)] = TRUE;
+		// Queue full? Wait for the writer
+		while (g_iOrderWriteCount == ORDERWRITEQUEUESIZE)
+			pthread_cond_wait(&g_writeCond, &g_writeLock);
+
+		pOrderWrite pWrite = &g_OrderWrites[(g_iOrderWriteHead + g_iOrderWriteCount) % ORDERWRITEQUEUESIZE];
+		pWrite->Item = *pItem;
+		EncodePLCString(szStub, &pWrite->Buf);
+		g_iOrderWriteCount++;
+		g_iOrderWritesPending++;
+
+		pthread_cond_broadcast(&g_writeCond);
+		pthread_mutex_unlock(&g_writeLock);
 
 		// Cleanup
 		delete []pszBarCode;
 } // end function streams new items to dispenser compartments [void, no return value]
 
+// Starts the order writer thread - called once at service start
+void StartOrderWriter()
+{
+		pthread_t tWriter;
+
+		pthread_create(&tWriter, NULL, &OrderWriterFunction, NULL);
+		pthread_detach(tWriter);
+} // void function, no return value
+
+// Order writer thread
+// ..writes queued order stubs to the PLC in order; a written item is
+// ..posted as started + added to the item-status-list, an item that
+// ..cant be written (PLC link down / write rejected) stays pending in
+// ..LocalCloud and is picked up again
+// params: pArg = NULL (no argument needs to be passed)
+void *OrderWriterFunction(void *pArg)
+{
+		char szMsg[1024] = {0};
+
+		while (!g_bAppDone)
+		{
+				// Wait for a write
+				pthread_mutex_lock(&g_writeLock);
+				while (g_iOrderWriteCount == 0)
+					pthread_cond_wait(&g_writeCond, &g_writeLock);
+
+				// Take it off the queue [copy, frees the slot]
+				OrderWrite Write = g_OrderWrites[g_iOrderWriteHead];
+				g_iOrderWriteHead = (g_iOrderWriteHead + 1) % ORDERWRITEQUEUESIZE;
+				g_iOrderWriteCount--;
+				pthread_cond_broadcast(&g_writeCond);
+				pthread_mutex_unlock(&g_writeLock);
+
+				pItemDispenseData pItem = &Write.Item;
+
+				/// Ask PLC to dispense this item
+				/// Write the order stub to PLC
+				int iResult = WriteEncodedToPLC(&g_OrderPLC, g_CompInfo.pszOrderVar, &Write.Buf);
+				if (iResult == PLCWRITELINKDOWN)
+				{
+					// PLC link down - item stays pending in LocalCloud and is picked up again
+					sprintf(szMsg, "OrderWriter:: PLC link down, DispenseID [%s] not sent", pItem->szDispenseID);
+					DoLog(szMsg, 1);
+
+					g_bDispenseIDStarted[atoi(pItem->szDispenseID)] = FALSE;
+				}
+				else if (iResult == PLCWRITEREJECTED)
+				{
+					// PLC rejected the write - item stays pending in LocalCloud,
+					// ..the next order fetch offers it again
+					sprintf(szMsg, "OrderWriter:: PLC rejected order stub [%s] [error %d], DispenseID [%s] not sent", \
+						pItem->szOrderStub, g_OrderPLC.iLastError, pItem->szDispenseID);
+					DoLog(szMsg, 1);
+
+					g_bDispenseIDStarted[atoi(pItem->szDispenseID)] = FALSE;
+				}
+				else
+				{
+					// Post status to local cloud - dispense started for this order stub
+					// ...Local Cloud will extract dispense id + daily bill number from the stub
+					PostItemStatusToLocalCloud(pItem->szOrderStub, pItem->szDispenseID, STARTED);
+
+					/// Append this item to item-status-list with status 'started'
+					// Add to item-status-list
+					InsertListNode(pItem->szDispenseID, STARTED, pItem->szOrderStub);
+				}
+
+				// Done with this one
+				pthread_mutex_lock(&g_writeLock);
+				g_iOrderWritesPending--;
+				pthread_mutex_unlock(&g_writeLock);
+		} // end of writer loop
+
+		return NULL;
+} // end of order writer thread
+
+// Is an order write queued or being written?
+// Returns: TRUE if the order writer has work in hand
+BOOL IsOrderWritePending()
+{
+		pthread_mutex_lock(&g_writeLock);
+		BOOL bPending = (g_iOrderWritesPending > 0);
+		pthread_mutex_unlock(&g_writeLock);
+
+		return bPending;
+} // end of pending write check
+
 // Checks item-status-list for the item with supplied dispense-id
 // ..and removes it from item-status-list
+// MUST be called with g_listLock held
 void PurgeItemFromStatusList(char *pszDispenseID)
 {
 		pNode pPrev = NULL;
@@ -746,6 +954,7 @@ void PurgeItemFromStatusList(char *pszDispenseID)
 
 								// Decrement list count
 								g_iStatusListNodeCount--;
+								g_iStatusListGen++;
 
 								// Move pIter
 								pIter = g_pHead;
@@ -761,6 +970,7 @@ void PurgeItemFromStatusList(char *pszDispenseID)
 
 								// Decrement list count
 								g_iStatusListNodeCount--;
+								g_iStatusListGen++;
 
 								// Move fwd [no change to prev, it remains the prev node]
 								pIter = pPrev->pNext;
@@ -781,132 +991,26 @@ void PurgeItemFromStatusList(char *pszDispenseID)
 		} // end for-loop iterating through nodes
 } // end function to purge item from item-status-list, no return value
 
+// Posts [STARTED/COMPLETE/TIMEOUT] status of item dispense to local cloud
+// ..queued on the LocalCloud async engine [batched with other items, in order],
+// ..which retries it until posted
 // Params:  char string order stub, char string dispense id, STATUS integer, [optional] timer string
 void PostItemStatusToLocalCloud(char *pszOrderStub, char *pszDispenseID, int iStatus, char *pszTimerString)
 {
-	ItemStatusData *pItemData = new ItemStatusData;
-	memset(pItemData, 0, sizeof(ItemStatusData));
-	strcpy(pItemData->szOrderStub, pszOrderStub);
-	strcpy(pItemData->szDispenseID, pszDispenseID);
-	pItemData->iStatus = iStatus;
-	if (pszTimerString)
-		strcpy(pItemData->szTimerString, pszTimerString);
-
-	pthread_t tData;
-
-	char szMsg[1024];
-	// Spawn our worker thread
-	int iRes = pthread_create(&tData, NULL, &PostItemStatusWorker, (void *)pItemData);
-	if (iRes != 0)
-	{
-		sprintf(szMsg, "PostItemStatusWorker:: Error [%d] spawning Worker Thread", iRes);
-
-		DoLog(szMsg, 2);
-	}
-	else
-	{
-		sprintf(szMsg, "PostItemStatusWorker:: Spawned Worker Thread");
-		DoLog(szMsg, 2);
-
-		// Detach the thread so it auto-cleans up when done
-		pthread_detach(tData);
-	}
-} // End of PostItemStatusToLocalCloud no return value
-
-// Posts [STARTED/COMPLETE] status of item dispense to local cloud
-// Params: void * struct containing char string order stub, char string dispense id, STATUS integer, [optional] timer string
-void *PostItemStatusWorker(void *pData)
-{
-	ItemStatusData *pItemData = (ItemStatusData *) pData;
-	char *pszOrderStub = (pItemData->szOrderStub);
-	char *pszDispenseID = (pItemData->szDispenseID);
-	int iStatus = pItemData->iStatus;
-	char *pszTimerString = NULL;
-	if(pItemData->szTimerString[0] != '\0')
-		pszTimerString = pItemData->szTimerString;
+	// Prepare item - JSON object [posted as {"data":item} or in a {"data":[items]} batch]
+	char szFmtString[] = "{\"dispense_id\":%d,\"status\":\"%s\",\"order_stub\":\"%s\"}";
+	char szItem[LCASYNCBODYLEN] = {0};
+	snprintf(szItem, sizeof(szItem), szFmtString, atoi(pszDispenseID), iStatus == STARTED?"dispensing":(iStatus == TIMEOUT?"timeout":"delivered"), pszOrderStub);
 
-	char szURL[1024] = {0};
-	sprintf(szURL, "http://%s/plcio/update_order_item_status", g_szIPPort);
 	char szMsg[1024];
-	sprintf(szMsg, "PostItemStatusWorkerXXXX:: POSTing id [%s] status [%d] to URL [%s]", pszDispenseID, iStatus, szURL);
+	sprintf(szMsg, "PostItemStatusToLocalCloud:: Queueing id [%s] status [%d]", pszDispenseID, iStatus);
 	DoLog(szMsg, 2);
 
-	// Initialize result struct
-	struct MemoryStruct CfgBuffer = {0};
-	CfgBuffer.pcBuffer = (char *)malloc(1);
-	CfgBuffer.stSize = 0;
-
-	// Prepare POST body - JSON array
-	char szFmtString[] = "{\"data\":{\"dispense_id\":%d,\"status\":\"%s\",\"order_stub\":\"%s\"}}";
-	char szData[4096] = {0};
-	sprintf(szData, szFmtString, atoi(pszDispenseID), iStatus == STARTED?"dispensing":(iStatus == TIMEOUT?"timeout":"delivered"), pszOrderStub);
-
 	DoLog("Item Status::", 5);
-	DoLog(szData, 5);
-fetchURLPISTLC:
-	// Init easy handle
-	CURL *curlEasyHandle = curl_easy_init();
-
-	// This is the URL to fetch
-	curl_easy_setopt(curlEasyHandle, CURLOPT_URL, szURL);
-
-	// Timeout 10 seconds
-	curl_easy_setopt(curlEasyHandle, CURLOPT_TIMEOUT, 10L);
-
-	// Writer callback function + Writer object
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlWriterCallback);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEDATA, (void *)&CfgBuffer);
-
-	// JSON request header setup
-	struct curl_slist *pHdrList = NULL;
-	pHdrList = curl_slist_append(pHdrList, "Content-Type: application/json");
-
-	// POST request - hardcoded data string
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POST, 1);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDS, szData);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDSIZE, strlen(szData));
-	curl_easy_setopt(curlEasyHandle, CURLOPT_HTTPHEADER, pHdrList);
-
-	// Fetch it - this is a blocking call
-	CURLcode res = curl_easy_perform(curlEasyHandle);
-
-	// Free our header list
-	curl_slist_free_all(pHdrList);
-
-	// Error check
-	if (res != CURLE_OK)
-	{
-		// Cleanup the handle
-		curl_easy_cleanup(curlEasyHandle);
-
-		sprintf(szMsg, "PostItemStatusWorker:: Error sending data to LocalCloud [%s], retrying in 5 seconds", curl_easy_strerror(res));
-		DoLog(szMsg, 1);
-
-		// Sleep 5 seconds
-		sleep(5);
+	DoLog(szItem, 5);
 
-		// Reset buffer
-		free(CfgBuffer.pcBuffer);
-		CfgBuffer.pcBuffer = (char *)malloc(1);
-		CfgBuffer.stSize = 0;
-
-		// Retry entire procedure
-		goto fetchURLPISTLC;
-	}
-
-	/// Nothing more to be done, the LocalCloud will process the signal
-	// Cleanup
-	free(CfgBuffer.pcBuffer);
-
-	// Done with easy handle
-	curl_easy_cleanup(curlEasyHandle);
-
-	DoLog("PostItemStatusWorker:: Posted item status", 2);
-
-	// Cleanup passed structure
-	delete pItemData;
-
-} // end function to post dispense status to local cloud, no return value
+	QueueItemStatus(szItem);
+} // End of PostItemStatusToLocalCloud no return value
 
 
 
@@ -921,61 +1025,37 @@ void InitializeCompartmentInfo()
 	// Slot count
 	pCurr->iSlotCount = g_CfgInfo.iSlotCount;
 
-	// ControlLogix PLC?
-	if (g_CfgInfo.iPLCType == 0)
-	{
-		// Order-Send Variables
-		strcpy(pCurr->szOrderVar, d1stringPlaceOrder);
-
-		// Scan signal variables
-		strcpy(pCurr->szDoorClosedVar, d1boolDoorClosed);
-		strcpy(pCurr->szOKToOpenDoorVar, d1boolOKToOpenDoor);
-
-		// The readiness variable tells us about dispenser readiness state
-		strcpy(pCurr->szDispenseReadinessVar, d1boolReadyForOrdering);
+	/// Variables from our PLC family's tag set
+	// Order-Send Variables
+	pCurr->pszOrderVar = g_pTagSet->pszOrderVar;
 
-		// Scan start signal - true when scan has started
-		strcpy(pCurr->szScanStartVar, d1boolScanStarted);
+	// Scan signal variables
+	pCurr->pszDoorClosedVar = g_pTagSet->pszDoorClosedVar;
+	pCurr->pszOKToOpenDoorVar = g_pTagSet->pszOKToOpenDoorVar;
 
-		// Sync mode :: scan data
-		strcpy(pCurr->szSyncBarCodeSlotNumberVar, d1stringsyncBCSlot);
-
-		// Sync mode :: scan complete bit
-		strcpy(pCurr->szSyncScanCompleteVar, d1boolsyncScanCompleted);
-
-		// Async mode :: scanned array
-		strcpy(pCurr->szAsyncBarCodeArrayVar, d1asyncScannedBarcode);
-
-		// Async mode :: Scan complete bit
-		strcpy(pCurr->szAsyncScanCompleteVar, d1boolasyncScanCompleted);
-	} // end if ControlLogix check
-	else
-	{
-		// Order-Send Variables
-		strcpy(pCurr->szOrderVar, d1MLstringPlaceOrder);
+	// The readiness variable tells us about dispenser readiness state
+	pCurr->pszDispenseReadinessVar = g_pTagSet->pszDispenseReadinessVar;
 
-		// Scan signal variables
-		strcpy(pCurr->szDoorClosedVar, d1MLboolDoorClosed);
-		strcpy(pCurr->szOKToOpenDoorVar, d1MLboolOKToOpenDoor);
+	// Scan start signal - true when scan has started
+	pCurr->pszScanStartVar = g_pTagSet->pszScanStartVar;
 
-		// Scan start signal - true when scan has started
-		strcpy(pCurr->szScanStartVar, d1MLboolScanStarted);
+	// Sync mode :: scan data
+	pCurr->pszSyncBarCodeSlotNumberVar = g_pTagSet->pszSyncBarCodeSlotNumberVar;
 
-		// The readiness variable tells us about dispenser readiness state
-		strcpy(pCurr->szDispenseReadinessVar, d1MLboolReadyForOrdering);
+	// Sync mode :: scan complete bit
+	pCurr->pszSyncScanCompleteVar = g_pTagSet->pszSyncScanCompleteVar;
 
-		// Sync mode :: scan data
-		strcpy(pCurr->szSyncBarCodeSlotNumberVar, d1MLstringsyncBCSlot);
+	// Async mode :: scanned array [ControlLogix only]
+	pCurr->pszAsyncBarCodeArrayVar = g_pTagSet->pszAsyncBarCodeArrayVar;
 
-		// Sync mode :: scan complete bit
-		strcpy(pCurr->szSyncScanCompleteVar, d1MLboolsyncScanCompleted);
-	} // end else if not controllogix (MicroLogix) check
+	// Async mode :: Scan complete bit [ControlLogix only]
+	pCurr->pszAsyncScanCompleteVar = g_pTagSet->pszAsyncScanCompleteVar;
 }
 
 // Waits until PLC has ALWAYS ON signalled
 // ..noting POWER ON status along the way
-// params: PLC fd of target PLC to wait for
-void WaitTillPLCReady(PLC *pPLC)
+// params: PLC connection of target PLC to wait for
+void WaitTillPLCReady(pPLCConnection pConn)
 {
 	BOOL bPowerON, bAlwaysON = FALSE;
 
@@ -986,42 +1066,11 @@ void WaitTillPLCReady(PLC *pPLC)
 		bPowerON = bAlwaysON = FALSE;
 
 		// Read PowerON state from PLC
-		char *pszPowerON;
-		if (g_CfgInfo.iPLCType == 0)
-		 	pszPowerON = ReadVarFromPLC(pPLC, gboolPLCPowerON, 'b');
-		else
-			pszPowerON = ReadVarFromPLC(pPLC, gMLboolPLCPowerON, 'b');
+		// ..(a failed read leaves the flag FALSE)
+		ReadBool(pConn, g_pTagSet->pszPowerOnVar, &bPowerON);
 
 		// Read AlwaysON state from PLC
-		char *pszAlwaysON;
-		if (g_CfgInfo.iPLCType == 0)
-			pszAlwaysON = ReadVarFromPLC(pPLC, gboolPLCAlwaysON, 'b');
-		else
-			pszAlwaysON = ReadVarFromPLC(pPLC, gMLboolPLCAlwaysON, 'b');
-
-		// Did we get some info?
-		if (pszPowerON)
-		{
-			// Was it a 1?
-			if (pszPowerON[0] == '1')
-				// Signal Power ON flag
-				bPowerON = TRUE;
-
-			// Cleanup memory
-			delete []pszPowerON;
-		} // end of was info provided check
-
-		// Did we get some info on 2nd read?
-		if (pszAlwaysON)
-		{
-			// Was it a 1?
-			if (pszAlwaysON[0] == '1')
-				// Signal Always ON flag
-				bAlwaysON = TRUE;
-
-			// Cleanup memory
-			delete []pszAlwaysON;
-		} // end of 2nd was info provided check
+		ReadBool(pConn, g_pTagSet->pszAlwaysOnVar, &bAlwaysON);
 
 		// Not Always on?
 		if (!bAlwaysON)
@@ -1054,6 +1103,20 @@ void ProcessMachineStateData()
 	sprintf(szMsg, "{ProcessMachineStateData} Active dispense count [%d]", g_iStatusListNodeCount);
 	DoLog(szMsg, 5);
 
+	/// Read the stage-variables active items can be at for this poll cycle in one batch
+	StageSnapshot Snapshot;
+	ReadStageSnapshot(&g_OrderPLC, &Snapshot, GetStagePollMask());
+
+	/// Has the list changed since the last poll? (new item, stage update, purge)
+	// ..then every stage-variable is applied again, as an unchanged value may
+	// ..match an item now (e.g heating flag of an item just seen inside a microwave)
+	// ..otherwise only the stage-variables that changed are applied
+	pthread_mutex_lock(&g_listLock);
+	BOOL bListChanged = (g_iStatusListGen != g_iStageCacheGen);
+	g_iStageCacheGen = g_iStatusListGen;
+	pthread_mutex_unlock(&g_listLock);
+	int iChanged = 0;
+
 	/// Loop through every stage-variable [1-base index for stages not 0]
 	// Stage 1 to MACHINESTAGECOUNT
 
@@ -1077,158 +1140,215 @@ void ProcessMachineStateData()
 		// Loop through the variants
 		for (int j = 1; j <= iVariants; j++)
 		{
-			char cType;
-			// Get variable type from substring search of variable name
-			// ...has to have string, bool in it - else is int
-			// printf("Stage Var: [%i][%j]: %s\n", g_szStageVars[i][j]);
-			cType = g_szStageTypes[i][j][0];
-
-			// Read stage-vars for this variant [1 or 2 of them]
-			char *pszDataVar1 = NULL;
-
-			// Read only non empty vars (MicroLogix may have some absent)
-			// ...and they will be represented as empty space
-			if (g_szStageVars[i][j][0] != ' ')
-			 	pszDataVar1 = ReadVarFromPLC(g_pOrderPLC, g_szStageVars[i][j], cType);
-
-		 	// No data?
-		 	if (!pszDataVar1)
+		 	// No data? (absent vars are never read)
+		 	if (!Snapshot.bRead[i][j])
 		 		// Iterate forward in loop
 		 		continue;
 
-			// Heating (Stage7) is the only stage which doesnt provide us with BCON
-			// .. [BarCode-OrderNumber]
-			if (i == STAGE7)
+			// Same value as last poll? Nothing new to apply
+			pStageCacheEntry pCache = &g_StageCache[i][j];
+			if (pCache->bValid && pCache->bFlag == Snapshot.bFlag[i][j] && \
+				!strcmp(pCache->szBCON, Snapshot.szBCON[i][j]))
 			{
-				/// Dont fetch DispenseID, we don't have BCON
-				// Check flag - is this microwave not heating yet?
-				if (!strcmp(pszDataVar1, "1"))
-				{
-					// Cleanup
-					delete []pszDataVar1;
-
-					// Nothing to do
+				if (!bListChanged)
 					continue;
-				}
-				/// This microwave is heating, need to figure out which item is being heated
-				// Trawl through item-status-list, find item with this variant [j]
-				// ..and status = STAGE6 [just previous stage]
-				// ..and update the status of that item to 'Heating' i.e STAGE7
-				for (pNode pIter = g_pHead; pIter != NULL; pIter = pIter->pNext)
-				{
-					// Check current item
-					if ((pIter->PayLoad.iDispenseStage == STAGE6) && \
-						(pIter->PayLoad.iVariant == j))
-					{
-						// Update Stage
-						pIter->PayLoad.iDispenseStage = STAGE7;
+			}
+			else
+			{
+				// Remember it [before ApplyStageData truncates the BCON]
+				pCache->bValid = TRUE;
+				pCache->bFlag = Snapshot.bFlag[i][j];
+				strcpy(pCache->szBCON, Snapshot.szBCON[i][j]);
+				iChanged++;
+			}
 
-						// Log
-						char szMsg[1024] = {0};
-						sprintf(szMsg, "ProcessMachineStateData:: Updated DispenseID [%s] to Stage %d Variant %d", \
-						 pIter->PayLoad.szDispenseID, STAGE7, j);
-						DoLog(szMsg, 4);
+			// Update item-status-list from this stage-variable
+			pthread_mutex_lock(&g_listLock);
+			ApplyStageData(i, j, Snapshot.bFlag[i][j], Snapshot.szBCON[i][j]);
+			pthread_mutex_unlock(&g_listLock);
+		} // end j loop
+	} // end i loop
 
-						// Exit Loop
-						break;
-					} // end of check current item
-				}	// end of pIter loop
-			} // end of if-block [stage7]
-			else
+	// Anything changed?
+	if (iChanged || bListChanged)
+	{
+		sprintf(szMsg, "{ProcessMachineStateData} %d stage-variables changed%s", iChanged, bListChanged ? ", list changed" : "");
+		DoLog(szMsg, 5);
+	}
+} // End ProcessMachineStateData functon, no return value
+
+// Works out which stages to read this poll cycle from where the
+// ..active items are (see STAGEPOLLLOOKAHEAD)
+// Returns: stage mask (bit i = read stage i), 0 if no active items
+unsigned int GetStagePollMask()
+{
+	int iMinStage = COMPLETE, iMaxStage = STARTED;
+
+	// Earliest + furthest stage of the active items
+	pthread_mutex_lock(&g_listLock);
+	for (pNode pIter = g_pHead; pIter != NULL; pIter = pIter->pNext)
+	{
+		if (pIter->PayLoad.iDispenseStage < iMinStage)
+			iMinStage = pIter->PayLoad.iDispenseStage;
+		if (pIter->PayLoad.iDispenseStage > iMaxStage)
+			iMaxStage = pIter->PayLoad.iDispenseStage;
+	}
+	pthread_mutex_unlock(&g_listLock);
+
+	// No items? Nothing to read
+	if (iMinStage == COMPLETE)
+		return 0;
+
+	// Time for the stages past the lookahead too?
+	long long llNowMS = MonotonicMS();
+	BOOL bCold = (llNowMS - g_llStageColdPollMS >= STAGECOLDPOLLMS);
+	if (bCold)
+		g_llStageColdPollMS = llNowMS;
+
+	unsigned int uMask = 0;
+	for (int i = iMinStage + 1; i <= MACHINESTAGECOUNT; i++)
+		if (bCold || i <= iMaxStage + STAGEPOLLLOOKAHEAD)
+			uMask |= (1 << i);
+
+	char szMsg[1024] = {0};
+	sprintf(szMsg, "{ProcessMachineStateData} Items at stages %d-%d, polling stages 0x%03x%s", \
+		iMinStage, iMaxStage, uMask, bCold ? " [all ahead]" : "");
+	DoLog(szMsg, 6);
+
+	return uMask;
+} // end of stage poll mask func
+
+// Updates item-status-list with the value of one stage-variable
+// ..from a poll (ProcessMachineStateData) or a PLC push (PLCPush.cpp)
+// ..and signals LocalCloud if the item COMPLETEd dispensing
+// MUST be called with g_listLock held
+// Params: stage, variant, flag (STAGE7 - heating when not set), BCON (other stages, gets modified)
+void ApplyStageData(int i, int j, BOOL bFlag, char *pszBCON)
+{
+	// Heating (Stage7) is the only stage which doesnt provide us with BCON
+	// .. [BarCode-OrderNumber]
+	if (i == STAGE7)
+	{
+		/// Dont fetch DispenseID, we don't have BCON
+		// Check flag - is this microwave not heating yet?
+		if (bFlag)
+			// Nothing to do
+			return;
+		/// This microwave is heating, need to figure out which item is being heated
+		// Trawl through item-status-list, find item with this variant [j]
+		// ..and status = STAGE6 [just previous stage]
+		// ..and update the status of that item to 'Heating' i.e STAGE7
+		for (pNode pIter = g_pHead; pIter != NULL; pIter = pIter->pNext)
+		{
+			// Check current item
+			if ((pIter->PayLoad.iDispenseStage == STAGE6) && \
+				(pIter->PayLoad.iVariant == j))
 			{
-				// Get Dispense ID from stage-var1 : char #24 to 33 [10 chars]
-				// ...this var holds BarCode [24 chars], Dispense ID [10 chars], and maybe Slot [3 chars]
-				char *pszDispenseID = &pszDataVar1[34];
+				// Update Stage
+				pIter->PayLoad.iDispenseStage = STAGE7;
+				g_iStatusListGen++;
+
+				// Log
+				char szMsg[1024] = {0};
+				sprintf(szMsg, "ProcessMachineStateData:: Updated DispenseID [%s] to Stage %d Variant %d", \
+				 pIter->PayLoad.szDispenseID, STAGE7, j);
+				DoLog(szMsg, 4);
 
-				// NOTE: [[we have asked for slot to be added, no certainty yet - Aug 7, 2015]]
-				// NOTE 2016 Jan: Slot won't be reported - pity? Currently we dont need it anyway
+				// Exit Loop
+				break;
+			} // end of check current item
+		}	// end of pIter loop
+	} // end of if-block [stage7]
+	else
+	{
+		// Get Dispense ID from stage-var1 : char #24 to 33 [10 chars]
+		// ...this var holds BarCode [24 chars], Dispense ID [10 chars], and maybe Slot [3 chars]
+		char *pszDispenseID = &pszBCON[34];
+
+		// NOTE: [[we have asked for slot to be added, no certainty yet - Aug 7, 2015]]
+		// NOTE 2016 Jan: Slot won't be reported - pity? Currently we dont need it anyway
 
-				// Truncate here [as the 10 chars are just numeric digits] Ignore the slot for now
-				// ..even if slot gets overwritten its no huge loss to us
-				pszDispenseID[6] = '\0';
+		// Truncate here [as the 10 chars are just numeric digits] Ignore the slot for now
+		// ..even if slot gets overwritten its no huge loss to us
+		pszDispenseID[6] = '\0';
 
 
-				// Update item-status-list for this item if stage is later than item status currently
-				// Trawl through item-status-list, find item with this dispenseid
-				// ..and check the status
-				// DoLog("ProcessMachineStateData:: Checking ISL for matches\n");
-				for (pNode pIter = g_pHead; pIter != NULL; pIter = pIter->pNext)
+		// Update item-status-list for this item if stage is later than item status currently
+		// Trawl through item-status-list, find item with this dispenseid
+		// ..and check the status
+		// DoLog("ProcessMachineStateData:: Checking ISL for matches\n");
+		for (pNode pIter = g_pHead; pIter != NULL; pIter = pIter->pNext)
+		{
+			char szMsg2[1024] = {0};
+			sprintf(szMsg2, "ProcessMachineStateData:: Comparing dispense id [%s] to ISL Item %s Stage %d\n", pszDispenseID, pIter->PayLoad.szDispenseID, pIter->PayLoad.iDispenseStage);
+			DoLog(szMsg2, 6);
+
+			// Does current DispenseID match passed Dispense ID?
+			if (atoi(pIter->PayLoad.szDispenseID) == atoi(pszDispenseID))
+			{
+				/// Yes, check status
+				// Was last recorded stage less than the current stage got from PLC?
+				if (pIter->PayLoad.iDispenseStage < i)
 				{
-					char szMsg2[1024] = {0};
-					sprintf(szMsg2, "ProcessMachineStateData:: Comparing dispense id [%s] to ISL Item %s Stage %d\n", pszDispenseID, pIter->PayLoad.szDispenseID, pIter->PayLoad.iDispenseStage);
-					DoLog(szMsg2, 6);
+					// Update the stage
+					pIter->PayLoad.iDispenseStage = i;
+					g_iStatusListGen++;
 
-					// Does current DispenseID match passed Dispense ID?
-					if (atoi(pIter->PayLoad.szDispenseID) == atoi(pszDispenseID))
-					{
-						/// Yes, check status
-						// Was last recorded stage less than the current stage got from PLC?
-						if (pIter->PayLoad.iDispenseStage < i)
-						{
-							// Update the stage
-							pIter->PayLoad.iDispenseStage = i;
-
-							// Update the variant - e.g dispenser2 can goto mic1 to lane2, etc
-							// so variant would be 2 then 1 then 2 in the e.g
-							pIter->PayLoad.iVariant = j;
-
-							/// Time this stage
-							char szTimerData[1024];
-							time_t ttTimeNow;
-
-							// Get time_t value (# of seconds since EPOCH)
-							time(&ttTimeNow);
-
-							// Build timer string segment to add to string
-							sprintf(szTimerData, "%d:%ld|", i, ttTimeNow);
-
-							// Do we already have data in the string?
-							if (pIter->PayLoad.szTimerString[0])
-								// Append to end of existing string
-								strcat(pIter->PayLoad.szTimerString, szTimerData);
-							// No existing timer-data so far
-							else
-								// Begin string with this timer string-segment
-							 	strcpy(pIter->PayLoad.szTimerString, szTimerData);
-
-							char szMsg[1024] = {0};
-							sprintf(szMsg, "ProcessMachineStateDataxxxx:: Updated DispenseID [%s] to Stage %d Variant %d TimerString [%s]", \
-							 pIter->PayLoad.szDispenseID, i, j, pIter->PayLoad.szTimerString);
-							DoLog(szMsg, 4);
-
-							// Is this an item dispense completion?
-							if (i == COMPLETE)
-							{
-								sprintf(szMsg, "ProcessMachineStateData:: Item Complete! DispenseID: [%s]",\
-								 	pIter->PayLoad.szDispenseID);
-								DoLog(szMsg, 1);
-DoLog("WriteCompletionStatusToFile",1);
+					// Update the variant - e.g dispenser2 can goto mic1 to lane2, etc
+					// so variant would be 2 then 1 then 2 in the e.g
+					pIter->PayLoad.iVariant = j;
 
-								// Write the order # to file so that the machine can display it
-								// (also pass the variant == lane number)
-								WriteCompletionStatusToFile(pIter->PayLoad.szOrderStub, j);
+					/// Time this stage
+					char szTimerData[1024];
+					time_t ttTimeNow;
 
-								// Post status to local cloud [dont remove this item from list here]
-								// ..also posting the Timer Data String
-								PostItemStatusToLocalCloud(pIter->PayLoad.szOrderStub, pszDispenseID, COMPLETE, pIter->PayLoad.szTimerString);
+					// Get time_t value (# of seconds since EPOCH)
+					time(&ttTimeNow);
 
-								// Purge from status list
-								PurgeItemFromStatusList(pszDispenseID);
-							}
-						} // end status check
+					// Build timer string segment to add to string
+					sprintf(szTimerData, "%d:%ld|", i, ttTimeNow);
 
-						// Done with loop, we found the right dispenseID!
-						break;
-					} // end dispenseID check
-				} // end pNode iter loop
-			} // end else case [not STAGE7]
+					// Do we already have data in the string?
+					if (pIter->PayLoad.szTimerString[0])
+						// Append to end of existing string
+						strcat(pIter->PayLoad.szTimerString, szTimerData);
+					// No existing timer-data so far
+					else
+						// Begin string with this timer string-segment
+					 	strcpy(pIter->PayLoad.szTimerString, szTimerData);
 
-			// Cleanup strings we read
-			delete []pszDataVar1;
+					char szMsg[1024] = {0};
+					sprintf(szMsg, "ProcessMachineStateDataxxxx:: Updated DispenseID [%s] to Stage %d Variant %d TimerString [%s]", \
+					 pIter->PayLoad.szDispenseID, i, j, pIter->PayLoad.szTimerString);
+					DoLog(szMsg, 4);
 
-		} // end j loop
-	} // end i loop
-} // End ProcessMachineStateData functon, no return value
+					// Is this an item dispense completion?
+					if (i == COMPLETE)
+					{
+						sprintf(szMsg, "ProcessMachineStateData:: Item Complete! DispenseID: [%s]",\
+						 	pIter->PayLoad.szDispenseID);
+						DoLog(szMsg, 1);
+DoLog("WriteCompletionStatusToFile",1);
+
+						// Write the order # to file so that the machine can display it
+						// (also pass the variant == lane number)
+						WriteCompletionStatusToFile(pIter->PayLoad.szOrderStub, j);
+
+						// Post status to local cloud [dont remove this item from list here]
+						// ..also posting the Timer Data String
+						PostItemStatusToLocalCloud(pIter->PayLoad.szOrderStub, pszDispenseID, COMPLETE, pIter->PayLoad.szTimerString);
+
+						// Purge from status list
+						PurgeItemFromStatusList(pszDispenseID);
+					}
+				} // end status check
+
+				// Done with loop, we found the right dispenseID!
+				break;
+			} // end dispenseID check
+		} // end pNode iter loop
+	} // end else case [not STAGE7]
+} // End ApplyStageData functon, no return value
 
 // Writes order # of completed item to Lane1.txt or Lane2.txt in 
 // the /home/ubuntu folder
@@ -1270,8 +1390,316 @@ DoLog(pszOrderNum ,1);
 } // End of write completion status function, no return value
 
 
-// Scan worker function
-// ..this is spawned at Service startup
+// Starts processing of a dispenser scan
+// ..informs LocalCloud and clears the scan results
+// Params: scan results to clear, scan mode name for logs (Sync/Async)
+void BeginScan(pScanResults pResults, const char *pszMode)
+{
+	// Log scan start
+	char szMsg[1024] = {0};
+	sprintf(szMsg, "ScanWorker:: %s Scan started [signal received]", pszMode);
+	DoLog(szMsg);
+
+	// Inform local cloud that scan has started
+	pthread_create(&scanSignalThreadID, NULL, &SendScanStartSignalToLocalCloud, NULL);
+
+	// Reset for this scan [arrays are only read upto the item count]
+	pResults->iNumScannedItems = 0;
+	pResults->bDataReceived = FALSE;
+	pResults->szLastSyncData[0] = '\0';
+	pResults->iSyncReads = 0;
+	pResults->iRepeatBackoffMS = 0;
+	memset(pResults->ucSlotSeen, 0, sizeof(pResults->ucSlotSeen));
+
+	// Start time - for throughput
+	pResults->llStartMS = MonotonicMS();
+} // void function, no return value
+
+// Async Mode :: Reads scanned barcodes of all slots once the scan is complete
+// ..the barcode array is read in runs of upto PLC_CHAR_MAX bytes (a few
+// ..requests for the whole dispenser), falling back to one read per slot
+// ..for a run the PLC wont return in one go
+// Params: scan results to add to
+void ReadAsyncScanResults(pScanResults pResults)
+{
+		// Barcodes of one run [83 chars each]
+		static char szBarCodes[ASYNCSCANRUNSLOTS][83];
+		char szMsg[1024] = {0};
+		int iRequests = 0;
+
+		// Iterate through slots, a run at a time
+		for (int iFirst = 0; iFirst < g_CompInfo.iSlotCount && pResults->iNumScannedItems < pResults->iMaxItems; iFirst += ASYNCSCANRUNSLOTS)
+		{
+				int iCount = g_CompInfo.iSlotCount - iFirst;
+				if (iCount > ASYNCSCANRUNSLOTS)
+					iCount = ASYNCSCANRUNSLOTS;
+
+				// Read the run
+				iRequests++;
+				int iRead = ReadString82Array(&g_ScanPLC, g_CompInfo.pszAsyncBarCodeArrayVar, iFirst, iCount, szBarCodes[0]);
+
+				// Got it? Split into slots
+				if (iRead == iCount)
+				{
+					for (int k = 0; k < iCount; k++)
+						AddAsyncScanItem(pResults, iFirst + k, szBarCodes[k]);
+					continue;
+				}
+
+				sprintf(szMsg, "ScanWorker:: Async run read of slots %d-%d failed, reading slot by slot", iFirst, iFirst + iCount - 1);
+				DoLog(szMsg, 2);
+
+				// One read per slot
+				for (int iIdx = iFirst; iIdx < iFirst + iCount; iIdx++)
+				{
+						/// Does this slot have a barcode?
+						// Construct varname - we have to read an ARRAY
+						// ..so the varnames are X[1], X[2], etc.
+						char szVarName[1024] = {0};
+						sprintf(szVarName, "%s[%d]", g_CompInfo.pszAsyncBarCodeArrayVar, iIdx);
+
+						// Read from PLC
+						char szBarCode[83] = {0};
+						iRequests++;
+
+						// No result?
+						if (!ReadString82(&g_ScanPLC, szVarName, szBarCode))
+								// Iterate fwd to next slot
+								continue;
+
+						AddAsyncScanItem(pResults, iIdx, szBarCode);
+				} // end loop through slots of run
+		} // end loop through runs
+
+		sprintf(szMsg, "ScanWorker:: Read %d async slots in %d requests", g_CompInfo.iSlotCount, iRequests);
+		DoLog(szMsg, 2);
+} // void function, no return value
+
+// Async Mode :: Adds the barcode read from one slot to the scan results
+// Params: scan results to add to, slot #, barcode string read from the slot
+void AddAsyncScanItem(pScanResults pResults, int iIdx, char *pszBarCode)
+{
+		// Full? [only if the slot count is over MAXITEMS]
+		if (pResults->iNumScannedItems >= pResults->iMaxItems)
+		{
+			char szMsg[1024] = {0};
+			sprintf(szMsg, "ScanWorker:: Scan results full [%d items], slot %d dropped", pResults->iMaxItems, iIdx);
+			DoLog(szMsg, 1);
+			return;
+		}
+
+		// Did we get at-least 24 chars? (Barcode length)
+		if (strlen(pszBarCode) > 33)
+		{
+				char szSlotNumber[10];
+				/// Note: in sync case, there may be duplicates of same
+				/// {barcode, slot} as we poll just one variable for data
+				/// ...But in async case, there are no such issues as we
+				/// ...read one variable for each slot, so no de-duping required
+				// Convert slot # to string to do comparisons and logging
+				sprintf(szSlotNumber, "%d", iIdx);
+
+				// Add to scan results and increment scanned item count
+				strncpy(pResults->szBarCodeArray[pResults->iNumScannedItems], pszBarCode, 34);
+				pResults->szBarCodeArray[pResults->iNumScannedItems][34] = '\0';
+				pResults->iSlotNumArray[pResults->iNumScannedItems] = iIdx;
+				pResults->iNumScannedItems++;
+
+				char szMsg[1024] = {0};
+				sprintf(szMsg, "ScanWorker:: Got Async Scan Item: Numitems: %d and extracted [bc: %s slot: %s]", \
+									pResults->iNumScannedItems, pszBarCode, szSlotNumber);
+				DoLog(szMsg, 2);
+
+		} // end valid barcode check
+		// Else if we got ANY data (at least 1 char)
+		else if (strlen(pszBarCode) > 0)
+		{
+				char szMsg[1024] = {0};
+				sprintf(szMsg, "ScanWorker:: Got Invalid Async scan data [%s]", pszBarCode);
+				DoLog(szMsg, 1);
+		} // end else [valid barcode slot number check]
+} // void function, no return value
+
+// Sync Mode :: How long to wait before the next barcode read
+// ..none after new data (and repeats start again from about one round trip
+// ..of the scan PLC), doubling per repeat upto SYNCSCANIDLEMS
+// Params: scan results, did the last read bring new data?
+// Returns: ms to wait
+int SyncScanBackoffMS(pScanResults pResults, BOOL bNewData)
+{
+	if (bNewData)
+	{
+		pResults->iRepeatBackoffMS = 0;
+		return 0;
+	}
+
+	// First repeat - one round trip, else double it
+	if (!pResults->iRepeatBackoffMS)
+	{
+		int iRTTMS = (int)(g_ScanPLC.llSRTTUS / 1000);
+		pResults->iRepeatBackoffMS = iRTTMS > SYNCSCANMINBACKOFFMS ? iRTTMS : SYNCSCANMINBACKOFFMS;
+	}
+	else
+		pResults->iRepeatBackoffMS *= 2;
+
+	if (pResults->iRepeatBackoffMS > SYNCSCANIDLEMS)
+		pResults->iRepeatBackoffMS = SYNCSCANIDLEMS;
+
+	return pResults->iRepeatBackoffMS;
+} // end of sync scan back off func
+
+// Sync Mode :: Reads one barcode + slot number from the PLC
+// ..and adds it to scan results unless that slot is already stored
+// Params: scan results to add to
+// Returns: TRUE if the tag held new data (changed since the last read),
+// ..FALSE if the read failed, or the tag is empty / repeats
+BOOL ReadSyncScanData(pScanResults pResults)
+{
+		// Read a barcode + slot number from PLC
+		char szBarCodeSlotNumber[83] = {0};
+		pResults->iSyncReads++;
+
+		// Check barcode and slot number strings for
+		// ...valid result: i.e read failed, or string is empty?
+		if (!ReadString82(&g_ScanPLC, g_CompInfo.pszSyncBarCodeSlotNumberVar, szBarCodeSlotNumber) || (szBarCodeSlotNumber[0] == '\0'))
+				// No data
+				return FALSE;
+
+		// Same as last time? PLC hasnt moved on yet
+		if (!strcmp(szBarCodeSlotNumber, pResults->szLastSyncData))
+				return FALSE;
+		strcpy(pResults->szLastSyncData, szBarCodeSlotNumber);
+
+		// Need atleast 24 chars for barcode and 1 for slot number
+		if (strlen(szBarCodeSlotNumber) >= 35)
+		{
+				/// OK, this is a valid result string
+				if (!pResults->bDataReceived)
+				{
+						// Data received
+						pResults->bDataReceived = TRUE;
+
+						DoLog("ScanWorker:: Sync Scan [data received]");
+				}
+				// Extract barcode & slot number
+				char *pszBarCode = substr(szBarCodeSlotNumber, 0, 34);
+				char *pszSlotNumber = substr(szBarCodeSlotNumber, 34, strlen(szBarCodeSlotNumber) - 34);
+
+				char szMsg1[1024] = {0};
+				sprintf(szMsg1, "ScanWorker:: PLC Scan-data: [%s] Items so far: %d; Extracted [bc: %s slot: %s]; Checking if already stored", \
+									szBarCodeSlotNumber, pResults->iNumScannedItems, pszBarCode, pszSlotNumber);
+				DoLog(szMsg1, 5);
+
+				int iSlot = ParseSlotNumber(pszSlotNumber);
+
+				/// Non-Duplication of scanned {barcode, slot}: SYNC scan only
+				// Do we already have this scan result? i.e. same slot? [one bit test]
+				BOOL bPresent = iSlot >= 0 && ((pResults->ucSlotSeen[iSlot / 8] >> (iSlot % 8)) & 1);
+
+				// Not a slot number? Nowhere to stock it
+				if (iSlot < 0)
+				{
+					char szMsg[1024] = {0};
+					sprintf(szMsg, "ScanWorker:: Got Invalid slot number [%s] for bc [%s]", pszSlotNumber, pszBarCode);
+					DoLog(szMsg, 1);
+				}
+				// New but no space for it?
+				else if (!bPresent && pResults->iNumScannedItems >= pResults->iMaxItems)
+				{
+					char szMsg[1024] = {0};
+					sprintf(szMsg, "ScanWorker:: Scan results full [%d items], dropped bc [%s] slot [%s]", pResults->iMaxItems, pszBarCode, pszSlotNumber);
+					DoLog(szMsg, 1);
+				}
+				// Was it not already present?
+				else if (!bPresent)
+				{
+					// Add to scan results and increment scanned item count
+					strcpy(pResults->szBarCodeArray[pResults->iNumScannedItems], pszBarCode);
+					pResults->iSlotNumArray[pResults->iNumScannedItems] = iSlot;
+					pResults->iNumScannedItems++;
+
+					// Mark slot as stored
+					pResults->ucSlotSeen[iSlot / 8] |= 1 << (iSlot % 8);
+
+					char szMsg[1024] = {0};
+					sprintf(szMsg, "ScanWorker:: Got New Item - Scan Data: [%s] Items so far: %d Item [bc: %s slot: %s]", \
+										szBarCodeSlotNumber, pResults->iNumScannedItems, pszBarCode, pszSlotNumber);
+					DoLog(szMsg, 2);
+				}
+
+				// Cleanup
+				delete []pszBarCode;
+				delete []pszSlotNumber;
+		} // end 25+ char barcode-slotnumber check
+		else
+		{
+				char szMsg[1024] = {0};
+				sprintf(szMsg, "ScanWorker:: Got Invalid scan data [%25s]", szBarCodeSlotNumber);
+				DoLog(szMsg, 5);
+		} // end else [valid barcode slot number check]
+
+		return TRUE;
+} // end of sync scan data read func
+
+// Parses the slot number part of sync scan data
+// Params: slot string (digits, may be space padded)
+// Returns: slot number, -1 if not a number below MAXSCANSLOT
+int ParseSlotNumber(char *pszSlotNumber)
+{
+	char *pszEnd = NULL;
+
+	// Digits only - no sign, must fit in the 9 chars we store
+	if (!isdigit((unsigned char)pszSlotNumber[0]) || strlen(pszSlotNumber) > 9)
+		return -1;
+
+	long lSlot = strtol(pszSlotNumber, &pszEnd, 10);
+
+	// Trailing padding is fine, anything else isnt
+	while (*pszEnd == ' ')
+		pszEnd++;
+
+	if (*pszEnd || lSlot >= MAXSCANSLOT)
+		return -1;
+
+	return (int)lSlot;
+} // end of slot number parse func
+
+// Finishes processing of a dispenser scan
+// ..updates local stock tables and posts them to LocalCloud
+// Params: scan results of the completed scan
+void FinishScan(pScanResults pResults)
+{
+	LogScanThroughput(pResults);
+
+	// Update local stock tables
+	UpdateDispenserStock(pResults->iSlotNumArray, pResults->szBarCodeArray, pResults->iNumScannedItems);
+
+	// Post total stock (now modified by scan results) to Local Cloud
+	PostTotalStockToLocalCloud();
+} // void function, no return value
+
+// Logs items scanned, time taken and slots/s of a scan
+// Params: scan results of the completed scan
+void LogScanThroughput(pScanResults pResults)
+{
+	long long llTookMS = MonotonicMS() - pResults->llStartMS;
+
+	char szMsg[1024] = {0};
+	sprintf(szMsg, "ScanWorker:: Scan done - %d items in %lld ms [%.1f slots/s, %d barcode reads]", \
+		pResults->iNumScannedItems, llTookMS, \
+		llTookMS > 0 ? pResults->iNumScannedItems * 1000.0 / llTookMS : 0.0, pResults->iSyncReads);
+	DoLog(szMsg, 2);
+
+	// Stopped because it was full? The rest of the scan was never read
+	if (pResults->iNumScannedItems >= pResults->iMaxItems)
+	{
+		sprintf(szMsg, "ScanWorker:: Scan results full [%d items], any further items of this scan were dropped", pResults->iMaxItems);
+		DoLog(szMsg, 1);
+	}
+} // void function, no return value
+
+// Scan worker function
+// ..this is spawned at Service startup
 // ..and remains active, checking for a machine-scan
 // ..handling both sync and async cases
 // params: pArg = NULL (no argument needs to be passed)
@@ -1284,7 +1712,7 @@ void *ScanWorkerFunction(void *pArg)
 
 	// Connect to PLC (for scan detection, solicited mode)
 	// USED FOR BOTH SYNC ANC ASYNC CASES
-	g_pScanPLC = ConnectToPLC(g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
+	ConnectToPLC(&g_ScanPLC, g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
 
 	DoLog("ScanWorker:: Connected to PLC for Scan Processing");
 
@@ -1297,119 +1725,38 @@ void *ScanWorkerFunction(void *pArg)
 		while (!g_bAppDone)
 		{
 				// Get scan status from the PLC
-				BOOL bScanStatus = GetScanStatus(g_pScanPLC);
+				BOOL bScanStatus = GetScanStatus(&g_ScanPLC);
 
 				// Is a scan in progress?
 				if (bScanStatus)
 				{
-						// Log scan start
-						char szMsg[1024];
-						sprintf(szMsg, "ScanWorker:: Async Scan started!");
-						DoLog(szMsg);
-
-						// Inform local cloud that scan has started
-						pthread_create(&scanThreadID, NULL, &SendScanStartSignalToLocalCloud, NULL);
+						// Log scan start + inform local cloud
+						BeginScan(&g_ScanResults, "Async");
 
 						/// Check scan completion bit and loop until it is set
 						// Loop forever - this breaks from within
 						while (TRUE)
 						{
 								// Read async scan completion variable from PLC
-								char *pszScanComplete = ReadVarFromPLC(g_pScanPLC, g_CompInfo.szAsyncScanCompleteVar, 'b');
-
-								// Did we get a result?
-								if (pszScanComplete)
-								{
-										// Scan complete bit set to 1?
-										if (!strcmp(pszScanComplete, "1"))
-										{
-												// Cleanup
-												delete []pszScanComplete;
-
-												// Exit WHILE loop
-												break;
-										}
-								} // End did we get result check
+								BOOL bScanComplete = FALSE;
 
-								// Cleanup
-								delete []pszScanComplete;
+								// Did we get a result? And is the scan complete bit set to 1?
+								if (ReadBool(&g_ScanPLC, g_CompInfo.pszAsyncScanCompleteVar, &bScanComplete) && bScanComplete)
+										// Exit WHILE loop
+										break;
 
 								// Sleep half a second = 500K microseconds to avoid hogging CPU
 								usleep(0.5 * 1000000);
 						}
 
 						/// Scan is complete, we need to process this compartment
-						char szScannedBarCodeArray[MAXITEMS][35] = {0};
-						char szScannedSlotArray[MAXITEMS][10] = {0};
-						int iNumScannedItems;
+						ReadAsyncScanResults(&g_ScanResults);
 
-						// NULL the arrays for this loop iteration
-						memset(szScannedSlotArray, 0, sizeof(szScannedSlotArray));
-						memset(szScannedBarCodeArray, 0, sizeof(szScannedBarCodeArray));
-						iNumScannedItems = 0;
-
-						// Iterate through slots
-						for (int iIdx = 0; iIdx < g_CompInfo.iSlotCount; iIdx++)
-						{
-								/// Does this slot have a barcode?
-								// Construct varname - we have to read an ARRAY
-								// ..so the varnames are X[1], X[2], etc.
-								char szVarName[1024] = {0};
-								sprintf(szVarName, "%s[%d]", g_CompInfo.szAsyncBarCodeArrayVar, iIdx);
-
-								// printf("Reading %s\n", szVarName);
-
-								// Read from PLC
-								char *pszBarCode = ReadVarFromPLC(g_pScanPLC, szVarName, 's');
-
-								// No result?
-								if(!pszBarCode)
-										// Iterate fwd to next slot
-										continue;
-
-								// Did we get at-least 24 chars? (Barcode length)
-								if (strlen(pszBarCode) > 33)
-								{
-										char szSlotNumber[10];
-										/// Note: in sync case, there may be duplicates of same
-										/// {barcode, slot} as we poll just one variable for data
-										/// ...But in async case, there are no such issues as we
-										/// ...read one variable for each slot, so no de-duping required
-										// Convert slot # to string to do comparisons and logging
-										sprintf(szSlotNumber, "%d", iIdx);
-
-										// Add to scan results and increment scanned item count
-										strcpy(szScannedBarCodeArray[iNumScannedItems], pszBarCode);
-										// Safe string copy for the 2nd chunk (slot string) - upto 9 chars
-										strncpy(szScannedSlotArray[iNumScannedItems], szSlotNumber, 9 * sizeof(char));
-										iNumScannedItems++;
-
-										char szMsg[1024] = {0};
-										sprintf(szMsg, "ScanWorker:: Got Async Scan Item: Numitems: %d and extracted [bc: %s slot: %s]", \
-															iNumScannedItems, pszBarCode, szSlotNumber);
-										DoLog(szMsg, 2);
-
-								} // end valid barcode check
-								// Else if we got ANY data (at least 1 char)
-								else if (strlen(pszBarCode) > 0)
-								{
-										char szMsg[1024] = {0};
-										sprintf(szMsg, "ScanWorker:: Got Invalid Async scan data [%s]", pszBarCode);
-										DoLog(szMsg, 1);
-								} // end else [valid barcode slot number check]
-
-								// Done with barcode, cleanup
-								delete []pszBarCode;
-						} // end loop through slots
-
-						// Update local stock tables
-						UpdateDispenserStock(szScannedSlotArray, szScannedBarCodeArray, iNumScannedItems);
-
-						// Post total stock (now modified by scan results) to Local Cloud
-						PostTotalStockToLocalCloud();
+						// Update local stock tables + post to Local Cloud
+						FinishScan(&g_ScanResults);
 
 						// Wait until scan-vars reset by PLC (as they may remain true for a while)
-						while (bScanStatus == GetScanStatus(g_pScanPLC))
+						while (bScanStatus == GetScanStatus(&g_ScanPLC))
 								// Sleep a while (0.1 second) to avoid hogging CPU
 								// = 0.1 x 1M microseconds
 								usleep(0.1 * 1000000);
@@ -1425,147 +1772,50 @@ void *ScanWorkerFunction(void *pArg)
 		while (!g_bAppDone)
 		{
 			// Get scan status from the PLC
-			BOOL bScanStatus = GetScanStatus(g_pScanPLC);
+			BOOL bScanStatus = GetScanStatus(&g_ScanPLC);
 
 			// Is a scan in progress?
 			if (bScanStatus)
 			{
-				// Log scan start
-				char szMsg[1024] = {0};
-				sprintf(szMsg, "ScanWorker:: Sync Scan started [signal received]");
-				DoLog(szMsg);
-
-				// Inform local cloud that scan has started
-				pthread_create(&scanThreadID, NULL, &SendScanStartSignalToLocalCloud, NULL);
-
-				BOOL bDataReceived = FALSE;
-
-				char szScannedBarCodeArray[MAXITEMS][35] = {0};
-				char szScannedSlotArray[MAXITEMS][10] = {0};
-				int iNumScannedItems;
-
-				// NULL the arrays for this loop iteration
-				memset(szScannedSlotArray, 0, sizeof(szScannedSlotArray));
-				memset(szScannedBarCodeArray, 0, sizeof(szScannedBarCodeArray));
-				iNumScannedItems = 0;
+				// Log scan start + inform local cloud
+				BeginScan(&g_ScanResults, "Sync");
 
 				// Do until num scanned items exceeds max
 				// ...this is just a sanity check, the loop will break due
 				// ...to other conditions being fulfilled (scancomplete set and no more
 				// ...barcodes coming in)
-				while (iNumScannedItems < MAXITEMS)
+				while (g_ScanResults.iNumScannedItems < g_ScanResults.iMaxItems)
 				{
 						// Read a barcode + slot number from PLC
-						char *pszBarCodeSlotNumber = ReadVarFromPLC(g_pScanPLC, g_CompInfo.szSyncBarCodeSlotNumberVar, 's');
-
-						// Check barcode and slot number strings for
-						// ...valid result: i.e non NULL PTR, and string isnt empty?
-						if ((pszBarCodeSlotNumber != NULL) && (*pszBarCodeSlotNumber != '\0'))
-						{
-								// Need atleast 24 chars for barcode and 1 for slot number
-								if (strlen(pszBarCodeSlotNumber) >= 35)
-								{
-										/// OK, this is a valid result string
-										if (!bDataReceived)
-										{
-												// Data received
-												bDataReceived = TRUE;
-
-												sprintf(szMsg, "ScanWorker:: Sync Scan [data received]");
-												DoLog(szMsg);
-										}
-										// Extract barcode & slot number
-										char *pszBarCode = substr(pszBarCodeSlotNumber, 0, 34);
-										char *pszSlotNumber = substr(pszBarCodeSlotNumber, 34, strlen(pszBarCodeSlotNumber) - 34);
-
-										char szMsg1[1024] = {0};
-										sprintf(szMsg1, "ScanWorker:: PLC Scan-data: [%s] Items so far: %d; Extracted [bc: %s slot: %s]; Checking if already stored", \
-															pszBarCodeSlotNumber, iNumScannedItems, pszBarCode, pszSlotNumber);
-										DoLog(szMsg1, 5);
-
-										BOOL bPresent = FALSE;
-										/// Non-Duplication of scanned {barcode, slot}: SYNC scan only
-										// Do we already have this scan result? i.e. same slot?
-										for (int iCheck = 0; iCheck < iNumScannedItems; iCheck++)
-										{
-											// Match the iterator slot?
-											if (!strcmp(szScannedSlotArray[iCheck], pszSlotNumber))
-											{
-												// Yes, already present
-												bPresent = TRUE;
-
-												// Exit loop
-												break;
-											}
-										}
-
-										// Was it not already present?
-										if (!bPresent)
-										{
-											// Add to scan results and increment scanned item count
-											strcpy(szScannedBarCodeArray[iNumScannedItems], pszBarCode);
-											// Safe string copy for the 2nd chunk (slot string) - upto 9 chars
-											strncpy(szScannedSlotArray[iNumScannedItems], pszSlotNumber, 9 * sizeof(char));
-											iNumScannedItems++;
-
-											char szMsg[1024] = {0};
-											sprintf(szMsg, "ScanWorker:: Got New Item - Scan Data: [%s] Items so far: %d Item [bc: %s slot: %s]", \
-																pszBarCodeSlotNumber, iNumScannedItems, pszBarCode, pszSlotNumber);
-											DoLog(szMsg, 2);
-										}
-
-										// Cleanup
-										delete []pszBarCode;
-										delete []pszSlotNumber;
-								} // end 25+ char barcode-slotnumber check
-								else
-								{
-										char szMsg[1024] = {0};
-										sprintf(szMsg, "ScanWorker:: Got Invalid scan data [%25s]", pszBarCodeSlotNumber[0] != '\0' ? pszBarCodeSlotNumber : "NULL");
-										DoLog(szMsg, 5);
-								} // end else [valid barcode slot number check]
+						BOOL bNewData = ReadSyncScanData(&g_ScanResults);
 
-								// Cleanup
-								delete []pszBarCodeSlotNumber;
-
-						} // end valid barcode + slotnumber strings check
+						// New data? Drain - read again straight away, checking
+						// ..the complete bit only every SYNCSCANCHECKREADS reads
+						if (bNewData && (g_ScanResults.iSyncReads % SYNCSCANCHECKREADS))
+								continue;
 
 						/// Has scan been completed?
 						// Check if scan complete bit is set
-						char *pszScanComplete = ReadVarFromPLC(g_pScanPLC, g_CompInfo.szSyncScanCompleteVar, 'b');
-
-						// Non-Null result?
-						if (pszScanComplete)
-						{
-								// Check if bit is set
-								if (!strcmp(pszScanComplete, "1"))
-								{
-									// Cleanup memory
-									delete []pszScanComplete;
-
-									// Exit loop
-									break;
-								}
+						BOOL bScanComplete = FALSE;
 
-								// Cleanup memory
-								delete []pszScanComplete;
-						} // end of non-null result check
+						// Did we get a result? And is the bit set?
+						if (ReadBool(&g_ScanPLC, g_CompInfo.pszSyncScanCompleteVar, &bScanComplete) && bScanComplete)
+								// Exit loop
+								break;
 
-						// Sleep a while to avoid hogging CPU
-						// = 0.1 x 1M microseconds
-						usleep(0.1 * 1000000);
+						// Tag repeats / empty - back off a while to avoid hogging CPU
+						int iBackoffMS = SyncScanBackoffMS(&g_ScanResults, bNewData);
+						if (iBackoffMS)
+								usleep(iBackoffMS * 1000);
 				} // end of until-scan-complete loop
 
-				// Update local stock tables
-				UpdateDispenserStock(szScannedSlotArray, szScannedBarCodeArray, iNumScannedItems);
-
-				// Post total stock (now modified by scan results) to Local Cloud
-				PostTotalStockToLocalCloud();
+				// Update local stock tables + post to Local Cloud
+				FinishScan(&g_ScanResults);
 
 				int iWait = 0;
 
 				// Wait until scan-vars reset by PLC (as they may remain true for a while)
-				while (GetScanStatus(g_pScanPLC))
+				while (GetScanStatus(&g_ScanPLC))
 				{
 						// Sleep a while (0.1 second) to avoid hogging CPU
 						// = 0.1 x 1M microseconds
@@ -1591,7 +1841,7 @@ void *ScanWorkerFunction(void *pArg)
 
 	/// Close PLC Connections
 	// Scan PLC
-	DisconnectFromPLC(g_pScanPLC);
+	DisconnectFromPLC(&g_ScanPLC);
 
 	// Done
 	return NULL;
@@ -1599,26 +1849,17 @@ void *ScanWorkerFunction(void *pArg)
 
 // Checks dispenser for scan activity
 // Also: Checks for wipe-off and sets wipe off flag if wipe-off done
-// Param: PLC fd
+// Param: PLC connection
 // Returns: TRUE if scan in progress, FALSE otherwise
-BOOL GetScanStatus(PLC *pPLC)
+BOOL GetScanStatus(pPLCConnection pConn)
 {
 		/// First check scan started var
-		char *pszScanStarted = ReadVarFromPLC(pPLC, g_CompInfo.szScanStartVar, 'b');
+		BOOL bScanStarted = FALSE;
 
 		// Did we get a result? And is it TRUE (1) ?
-		if (pszScanStarted && !strcmp(pszScanStarted, "1"))
-		{
-				// Cleanup
-				delete []pszScanStarted;
-
+		if (ReadBool(pConn, g_CompInfo.pszScanStartVar, &bScanStarted) && bScanStarted)
 				// Success!
 				return TRUE;
-		} // end scan started result present & true check
-
-		// Cleanup
-		if (pszScanStarted)
-				delete []pszScanStarted;
 
 		// Is the wipe-off already signalled? No need to check again if so
 		if (g_bWipeOffDone)
@@ -1630,22 +1871,24 @@ BOOL GetScanStatus(PLC *pPLC)
 		/// (a) Door Closed == FALSE and
 		/// (b) OK to open door == TRUE
 		// Door Closed = FALSE?
-	  	char *pszDoorClosed = ReadVarFromPLC(pPLC, g_CompInfo.szDoorClosedVar, 'b');
+		BOOL bDoorClosed = FALSE;
+	  	BOOL bDoorRead = ReadBool(pConn, g_CompInfo.pszDoorClosedVar, &bDoorClosed);
 		char szMsg[1024] = {0};
-		sprintf(szMsg, "GetScanStatus:: DoorClosed [%s]", pszDoorClosed);
+		sprintf(szMsg, "GetScanStatus:: DoorClosed [%d] Read [%d]", bDoorClosed, bDoorRead);
 		DoLog(szMsg, 6);
 
 		// Has the door been opened?
-		if (pszDoorClosed && !strcmp(pszDoorClosed, "0"))
+		if (bDoorRead && !bDoorClosed)
 		{
 				// Read OK to open door
-				char *pszOKToOpenDoor = ReadVarFromPLC(pPLC, g_CompInfo.szOKToOpenDoorVar, 'b');
+				BOOL bOKToOpenDoor = FALSE;
+				BOOL bOKRead = ReadBool(pConn, g_CompInfo.pszOKToOpenDoorVar, &bOKToOpenDoor);
 
-				sprintf(szMsg, "GetScanStatus:: OKToOpenDoor [%s]", pszOKToOpenDoor);
+				sprintf(szMsg, "GetScanStatus:: OKToOpenDoor [%d] Read [%d]", bOKToOpenDoor, bOKRead);
 				DoLog(szMsg, 5);
 
 				// Is it OK to open door?
-				if (pszOKToOpenDoor && !strcmp(pszOKToOpenDoor, "1"))
+				if (bOKRead && bOKToOpenDoor)
 				{
 						// Wipe off has been done
 						g_bWipeOffDone = TRUE;
@@ -1657,26 +1900,62 @@ BOOL GetScanStatus(PLC *pPLC)
 						g_iBarCodeCount = 0;
 						PostTotalStockToLocalCloud();
 				} // end check if result present & ok to open door
-
-				// Cleanup
-				if (pszOKToOpenDoor)
-					delete []pszOKToOpenDoor;
 		} // end check if result present & door closed
 
-		// Cleanup
-		if (pszDoorClosed)
-			delete []pszDoorClosed;
-
 		// Default, no scan
 		return FALSE;
 } // end get-scan-status (+ set wipe-off status) function
 
+// Allocates stock table + scan results storage for the dispenser's slots
+// ..one arena, structure of arrays [one item per slot, upto MAXITEMS]
+// Params: # of items a scan can return (async: slot count from config)
+// Returns: TRUE on success
+BOOL InitStockStorage(int iSlotCount)
+{
+	int iCap = iSlotCount < 1 ? 1 : (iSlotCount > MAXITEMS ? MAXITEMS : iSlotCount);
+
+	// Hash at most half full
+	int iHashSize = 16;
+	while (iHashSize < 2 * iCap)
+		iHashSize *= 2;
+
+	// int arrays first, then the barcodes [stock + scan]
+	size_t stSize = (6 * iCap + iHashSize) * sizeof(int) + 2 * iCap * sizeof(g_szBarCodeArray[0]);
+	char *pArena = (char *)calloc(1, stSize);
+	if (!pArena)
+		return FALSE;
+
+	char *pNext = pArena;
+	g_iStockHash = (int *)pNext;                 pNext += iHashSize * sizeof(int);
+	g_iSlotCountArray = (int *)pNext;            pNext += iCap * sizeof(int);
+	g_iStockFirstSlot = (int *)pNext;            pNext += iCap * sizeof(int);
+	g_iStockLastSlot = (int *)pNext;             pNext += iCap * sizeof(int);
+	g_iStockSlotNums = (int *)pNext;             pNext += iCap * sizeof(int);
+	g_iStockSlotNext = (int *)pNext;             pNext += iCap * sizeof(int);
+	g_ScanResults.iSlotNumArray = (int *)pNext;  pNext += iCap * sizeof(int);
+	g_szBarCodeArray = (char (*)[35])pNext;      pNext += iCap * sizeof(g_szBarCodeArray[0]);
+	g_ScanResults.szBarCodeArray = (char (*)[35])pNext;
+
+	g_iStockCapacity = g_ScanResults.iMaxItems = iCap;
+	g_iStockHashSize = iHashSize;
+
+	// Delta posts? Snapshots of the same size
+	if (g_bStockDelta && !(AllocStockSnapshot(g_pAckedStock) && AllocStockSnapshot(g_pPostedStock)))
+		return FALSE;
+
+	char szMsg[1024] = {0};
+	sprintf(szMsg, "Main:: Stock storage for %d items [%d bytes]", iCap, (int)stSize);
+	DoLog(szMsg, 2);
+
+	return TRUE;
+} // end of stock storage init func
+
 // This function gets scanned results of a single compartment scan
-// ...in arrays {barcode}, {slot}, and builds {barcode, slotstring} arrays
-// ...slotstring is just combination of all slots for 1 barcode into a string
+// ...in arrays {barcode}, {slot}, and builds {barcode, slots} stock table
+// ...each barcode is looked up in the barcode hash, its slots chained in scan order
 // ...(then overwrites global stock table for that compartment with the new data)
 // Params: container #, scanned slots array, scanned barcodes array, num items scanned
-void UpdateDispenserStock(char pszSlotArray[][10], char pszBarCodeArray[][35], int iNumScanned)
+void UpdateDispenserStock(int iSlotNumArray[], char pszBarCodeArray[][35], int iNumScanned)
 {
 		char szMsg[1024] = {0};
 		sprintf(szMsg, "UpdateStock:: NumScanned %d", iNumScanned);
@@ -1687,83 +1966,306 @@ void UpdateDispenserStock(char pszSlotArray[][10], char pszBarCodeArray[][35], i
 
 		/// We need to process the stock array and convert it into a form
 		/// ..that can be stored
-		/// Our global stock array: {Barcode, SlotString, Qty}
+		/// Our global stock array: {Barcode, Slots, Qty}
 		g_iBarCodeCount = 0;
+		memset(g_iStockHash, 0, g_iStockHashSize * sizeof(int));
 
 		// Loop through each scanned item
-		for (int iLoop = 0; iLoop < iNumScanned; iLoop++)
+		for (int iLoop = 0; iLoop < iNumScanned && iLoop < g_iStockCapacity; iLoop++)
 		{
-				// Check if this barcode is already in array
-				int iLoop2;
-				for (iLoop2 = 0; iLoop2 < g_iBarCodeCount; iLoop2++)
-				{
-						// Try to string match barcodes
-						if (!strcmp(pszBarCodeArray[iLoop], g_szBarCodeArray[iLoop2]))
-						{
-								/// We have a match
-								// Append separator (comma) and slot number to slot string for this barcode
-								strcat(g_szSlotStringArray[iLoop2], ",");
-								strcat(g_szSlotStringArray[iLoop2], pszSlotArray[iLoop]);
-								g_iSlotCountArray[iLoop2]++;
+				// Barcode's entry [added if new]
+				int iEntry = FindOrAddStockEntry(pszBarCodeArray[iLoop]);
 
-								sprintf(szMsg, "UpdateStock:: Got BarCode [%s] New Slot %s",
-								  g_szBarCodeArray[iLoop2], pszSlotArray[iLoop]);
-								DoLog(szMsg, 2);
+				// Append slot to the entry's chain
+				g_iStockSlotNums[iLoop] = iSlotNumArray[iLoop];
+				g_iStockSlotNext[iLoop] = -1;
 
-								// Done with loop
-								break;
-						}
-				}
-
-				// Did we pass loop end? ie was barcode not found ?
-				if (iLoop2 == g_iBarCodeCount)
-				{
-						// Yes, add this item to stock table for this container, and increment item count
-						strcpy(g_szBarCodeArray[g_iBarCodeCount], pszBarCodeArray[iLoop]);
-						strcpy(g_szSlotStringArray[g_iBarCodeCount], pszSlotArray[iLoop]);
-						g_iSlotCountArray[g_iBarCodeCount] = 1;
-						g_iBarCodeCount++;
-
-						sprintf(szMsg, "UpdateStock:: Got new BarCode [%s]", \
-							g_szBarCodeArray[g_iBarCodeCount - 1]);
-						DoLog(szMsg, 2);
-				}
+				if (g_iSlotCountArray[iEntry]++)
+					g_iStockSlotNext[g_iStockLastSlot[iEntry]] = iLoop;
+				else
+					g_iStockFirstSlot[iEntry] = iLoop;
+				g_iStockLastSlot[iEntry] = iLoop;
 		} // end scanned-item loop
 
+		int iBarCodeCount = g_iBarCodeCount;
+
 		// Unlock the stock table mutex
 		pthread_mutex_unlock(&g_stockLock);
 
-		sprintf(szMsg, "UpdateStock:: Got %d BarCodes", g_iBarCodeCount);
+		sprintf(szMsg, "UpdateStock:: Got %d BarCodes", iBarCodeCount);
 		DoLog(szMsg, 2);
 
 		// Log each barcode
-		for (int iL = 0; iL < g_iBarCodeCount; iL++)
+		for (int iL = 0; iL < iBarCodeCount; iL++)
 		{
-			sprintf(szMsg, "UpdateStock:: Barcode [%s] Slots [%s]\n", g_szBarCodeArray[iL], g_szSlotStringArray[iL]);
+			char szSlots[900] = {0};
+			BuildStockSlotString(iL, szSlots, sizeof(szSlots));
+
+			sprintf(szMsg, "UpdateStock:: Barcode [%s] Qty %d Slots [%s]\n", g_szBarCodeArray[iL], g_iSlotCountArray[iL], szSlots);
 			DoLog(szMsg, 2);
 		}
 }
 
-// This function does a HTTP POST to Local Cloud
-// Passing the barcode/slot arrays to local cloud
-// To local Cloud
-void PostTotalStockToLocalCloud()
+// Looks a barcode up in the stock table, adding an empty entry if not there
+// ..caller holds g_stockLock
+// Params: barcode
+// Returns: stock table entry #
+int FindOrAddStockEntry(char *pszBarCode)
 {
-	char szURL[1024] = {0};
-	sprintf(szURL, "http://%s/plcio/submit_scanned_stock", g_szIPPort);
-	char szMsg[1024];
-	sprintf(szMsg, "PostTotalStockToLocalCloud:: POSTing data to URL [%s]", szURL);
-	DoLog(szMsg, 2);
+	unsigned int uHash = HashBarCode(pszBarCode);
 
-	// Initialize result struct
-	struct MemoryStruct CfgBuffer = {0};
-	CfgBuffer.pcBuffer = (char *)malloc(1);
-	CfgBuffer.stSize = 0;
+	// Probe until we hit the barcode or an empty hash slot
+	// ..table is never more than half full, so this ends
+	for (unsigned int uIdx = uHash & (g_iStockHashSize - 1); ; uIdx = (uIdx + 1) & (g_iStockHashSize - 1))
+	{
+		int iEntry = g_iStockHash[uIdx] - 1;
+
+		// Found it?
+		if (iEntry >= 0 && !strcmp(g_szBarCodeArray[iEntry], pszBarCode))
+			return iEntry;
+
+		// Empty - new barcode, add it
+		if (iEntry < 0)
+		{
+			iEntry = g_iBarCodeCount++;
+			strncpy(g_szBarCodeArray[iEntry], pszBarCode, 34);
+			g_szBarCodeArray[iEntry][34] = '\0';
+			g_iSlotCountArray[iEntry] = 0;
+			g_iStockHash[uIdx] = iEntry + 1;
+
+			return iEntry;
+		}
+	} // end probe loop
+}
+
+// FNV-1a hash of a barcode
+unsigned int HashBarCode(const char *pszBarCode)
+{
+	unsigned int uHash = 2166136261u;
+	for (const char *pszC = pszBarCode; *pszC; pszC++)
+		uHash = (uHash ^ (unsigned char)*pszC) * 16777619u;
+
+	return uHash;
+}
+
+// FNV-1a hash of the slot numbers of a stock table entry [in chain order]
+// ..caller holds g_stockLock
+unsigned int StockSlotHash(int iEntry)
+{
+	unsigned int uHash = 2166136261u;
+	for (int iSlot = g_iSlotCountArray[iEntry] ? g_iStockFirstSlot[iEntry] : -1; iSlot >= 0; iSlot = g_iStockSlotNext[iSlot])
+		uHash = (uHash ^ (unsigned int)g_iStockSlotNums[iSlot]) * 16777619u;
+
+	return uHash;
+}
+
+// Allocates a stock snapshot the size of the stock table [one block]
+// Returns: TRUE on success
+BOOL AllocStockSnapshot(pStockSnapshot pSnap)
+{
+	int iCap = g_iStockCapacity;
+	char *pBlock = (char *)calloc(1, (2 * iCap + g_iStockHashSize) * sizeof(int) + iCap * (35 + 1));
+	if (!pBlock)
+		return FALSE;
+
+	pSnap->piHash = (int *)pBlock;                    pBlock += g_iStockHashSize * sizeof(int);
+	pSnap->piQty = (int *)pBlock;                     pBlock += iCap * sizeof(int);
+	pSnap->puSlotHash = (unsigned int *)pBlock;       pBlock += iCap * sizeof(int);
+	pSnap->szBarCodes = (char (*)[35])pBlock;         pBlock += iCap * 35;
+	pSnap->pucSeen = (unsigned char *)pBlock;
+	pSnap->bValid = FALSE;
+	pSnap->iCount = 0;
+
+	return TRUE;
+}
+
+// Looks a barcode up in a stock snapshot
+// Returns: snapshot entry #, -1 if not there
+int FindSnapshotEntry(pStockSnapshot pSnap, char *pszBarCode)
+{
+	for (unsigned int uIdx = HashBarCode(pszBarCode) & (g_iStockHashSize - 1); ; uIdx = (uIdx + 1) & (g_iStockHashSize - 1))
+	{
+		int iEntry = pSnap->piHash[uIdx] - 1;
+
+		// Empty - not there
+		if (iEntry < 0)
+			return -1;
+
+		if (!strcmp(pSnap->szBarCodes[iEntry], pszBarCode))
+			return iEntry;
+	}
+}
+
+// Adds a stock table entry to a snapshot [barcodes are unique, as in the table]
+void AddSnapshotEntry(pStockSnapshot pSnap, char *pszBarCode, int iQty, unsigned int uSlotHash)
+{
+	int iEntry = pSnap->iCount++;
+	strcpy(pSnap->szBarCodes[iEntry], pszBarCode);
+	pSnap->piQty[iEntry] = iQty;
+	pSnap->puSlotHash[iEntry] = uSlotHash;
+
+	unsigned int uIdx = HashBarCode(pszBarCode) & (g_iStockHashSize - 1);
+	while (pSnap->piHash[uIdx])
+		uIdx = (uIdx + 1) & (g_iStockHashSize - 1);
+	pSnap->piHash[uIdx] = iEntry + 1;
+}
+
+// Builds the comma separated slot string of a stock table entry
+// ..caller holds g_stockLock (or owns the table, as in the update)
+// Params: stock table entry #, [out] buffer, buffer size
+// Returns: length of the string (slots that dont fit are dropped)
+int BuildStockSlotString(int iEntry, char *pszOut, int iMaxLen)
+{
+	int iLen = 0;
+	pszOut[0] = '\0';
+
+	// Walk the entry's slot chain
+	for (int iSlot = g_iSlotCountArray[iEntry] ? g_iStockFirstSlot[iEntry] : -1; iSlot >= 0; iSlot = g_iStockSlotNext[iSlot])
+	{
+		char szSlot[16];
+		int iSlotLen = sprintf(szSlot, "%d", g_iStockSlotNums[iSlot]);
+
+		// Room for separator + slot + NUL?
+		if (iLen + iSlotLen + 2 > iMaxLen)
+			break;
+
+		if (iLen)
+			pszOut[iLen++] = ',';
+		memcpy(pszOut + iLen, szSlot, iSlotLen + 1);
+		iLen += iSlotLen;
+	}
+
+	return iLen;
+}
+
+// Empties a JSON writer [keeps its buffer]
+void JSONReset(pJSONWriter pWriter)
+{
+	pWriter->stSize = 0;
+	pWriter->bError = FALSE;
+	if (pWriter->pcBuffer)
+		pWriter->pcBuffer[0] = '\0';
+}
+
+// Makes room for stMore more bytes [+ NUL], doubling the buffer as needed
+// Returns: FALSE if out of memory (writer is then flagged + ignores appends)
+BOOL JSONReserve(pJSONWriter pWriter, size_t stMore)
+{
+	if (pWriter->bError)
+		return FALSE;
+
+	// Enough room already?
+	if (pWriter->stSize + stMore + 1 <= pWriter->stCapacity)
+		return TRUE;
+
+	size_t stNewCap = pWriter->stCapacity ? pWriter->stCapacity : 4096;
+	while (stNewCap < pWriter->stSize + stMore + 1)
+		stNewCap *= 2;
+
+	char *pcNew = (char *)realloc(pWriter->pcBuffer, stNewCap);
+	if (!pcNew)
+	{
+		pWriter->bError = TRUE;
+		return FALSE;
+	}
+
+	pWriter->pcBuffer = pcNew;
+	pWriter->stCapacity = stNewCap;
+
+	return TRUE;
+}
+
+// Appends text as is [JSON syntax or already valid JSON]
+void JSONAppendRaw(pJSONWriter pWriter, const char *pszText)
+{
+	size_t stLen = strlen(pszText);
+
+	if (!JSONReserve(pWriter, stLen))
+		return;
+
+	memcpy(pWriter->pcBuffer + pWriter->stSize, pszText, stLen + 1);
+	pWriter->stSize += stLen;
+}
+
+// Appends a quoted, escaped JSON string
+void JSONAppendString(pJSONWriter pWriter, const char *pszVal)
+{
+	// Worst case every char is a \u00XX escape
+	if (!JSONReserve(pWriter, strlen(pszVal) * 6 + 2))
+		return;
+
+	char *pcOut = pWriter->pcBuffer + pWriter->stSize;
+	*pcOut++ = '"';
+
+	for (const unsigned char *pucC = (const unsigned char *)pszVal; *pucC; pucC++)
+	{
+		if (*pucC == '"' || *pucC == '\\')
+		{
+			*pcOut++ = '\\';
+			*pcOut++ = *pucC;
+		}
+		else if (*pucC < 0x20)
+			pcOut += sprintf(pcOut, "\\u%04x", *pucC);
+		else
+			*pcOut++ = *pucC;
+	}
+
+	*pcOut++ = '"';
+	*pcOut = '\0';
+	pWriter->stSize = pcOut - pWriter->pcBuffer;
+}
+
+// Appends an integer
+void JSONAppendInt(pJSONWriter pWriter, int iVal)
+{
+	if (!JSONReserve(pWriter, 12))
+		return;
+
+	pWriter->stSize += sprintf(pWriter->pcBuffer + pWriter->stSize, "%d", iVal);
+}
+
+// Appends the slots of a stock table entry as a quoted comma separated string
+// ..caller holds g_stockLock
+void JSONAppendStockSlots(pJSONWriter pWriter, int iEntry)
+{
+	// Upto 10 digits + comma per slot, + quotes
+	if (!JSONReserve(pWriter, g_iSlotCountArray[iEntry] * 12 + 2))
+		return;
+
+	char *pcOut = pWriter->pcBuffer + pWriter->stSize;
+	*pcOut++ = '"';
+
+	// Walk the entry's slot chain
+	for (int iSlot = g_iSlotCountArray[iEntry] ? g_iStockFirstSlot[iEntry] : -1; iSlot >= 0; iSlot = g_iStockSlotNext[iSlot])
+		pcOut += sprintf(pcOut, iSlot == g_iStockFirstSlot[iEntry] ? "%d" : ",%d", g_iStockSlotNums[iSlot]);
+
+	*pcOut++ = '"';
+	*pcOut = '\0';
+	pWriter->stSize = pcOut - pWriter->pcBuffer;
+}
+
+// Builds the stock post body from the stock table
+// ..full: every barcode, delta: barcodes added / changed (qty or slots) since
+// ..the previous snapshot + the barcodes removed since
+// Params: body to write, previous (acknowledged) snapshot or NULL for a full
+// ..body, snapshot to fill with the table as posted or NULL
+// Returns: TRUE if the stock table was empty
+BOOL BuildStockPostBody(pJSONWriter pBody, pStockSnapshot pPrev, pStockSnapshot pNext)
+{
+	int iRows = 0;
 
 	// Prepare POST body - json array
-	char szFmtString[] = "{\"data\":[%s], \"append_only\": %s}";
-	char szData[MAXITEMS * 105] = {0};
-	char szRows[MAXITEMS * 100] = {0};
+	// ..{"data":[{"barcode":..,"count":..,"slot_ids":".."}, ...], "append_only": ..}
+	// ..delta adds "removed":[barcodes], "delta":true
+	JSONAppendRaw(pBody, "{\"data\":[");
+
+	if (pPrev)
+		memset(pPrev->pucSeen, 0, pPrev->iCount);
+	if (pNext)
+	{
+		pNext->iCount = 0;
+		memset(pNext->piHash, 0, g_iStockHashSize * sizeof(int));
+	}
 
 	// Lock the stock table mutex
 	pthread_mutex_lock(&g_stockLock);
@@ -1771,67 +2273,144 @@ void PostTotalStockToLocalCloud()
 	// Loop through stock table - each row key is 1 barcode
 	for (int iL = 0; iL < g_iBarCodeCount; iL++)
 	{
-			char szRow[1024];
-			memset(szRow, 1024 * sizeof(char), 0);
-			sprintf(szRow, "{\"barcode\":\"%s\",\"count\":%d,\"slot_ids\":\"%s\"}", \
-				g_szBarCodeArray[iL], g_iSlotCountArray[iL], g_szSlotStringArray[iL]);
-
-			// Append comma if not at end
-			if (iL < (g_iBarCodeCount - 1))
-				strcat(szRow, ", ");
-
-			// Append to our rows array
-			if (szRows[0] != '\0')
-				strcat(szRows, szRow);
-			else
-				strcpy(szRows, szRow);
+			unsigned int uSlotHash = (pPrev || pNext) ? StockSlotHash(iL) : 0;
+
+			if (pNext)
+				AddSnapshotEntry(pNext, g_szBarCodeArray[iL], g_iSlotCountArray[iL], uSlotHash);
+
+			// Delta? Skip it if LocalCloud has it as is
+			if (pPrev)
+			{
+				int iPrev = FindSnapshotEntry(pPrev, g_szBarCodeArray[iL]);
+				if (iPrev >= 0)
+				{
+					pPrev->pucSeen[iPrev] = 1;
+					if (pPrev->piQty[iPrev] == g_iSlotCountArray[iL] && pPrev->puSlotHash[iPrev] == uSlotHash)
+						continue;
+				}
+			}
+
+			// Comma if not first
+			if (iRows++)
+				JSONAppendRaw(pBody, ", ");
+
+			JSONAppendRaw(pBody, "{\"barcode\":");
+			JSONAppendString(pBody, g_szBarCodeArray[iL]);
+			JSONAppendRaw(pBody, ",\"count\":");
+			JSONAppendInt(pBody, g_iSlotCountArray[iL]);
+			JSONAppendRaw(pBody, ",\"slot_ids\":");
+			JSONAppendStockSlots(pBody, iL);
+			JSONAppendRaw(pBody, "}");
 	} // end loop through stock table
 
+	BOOL bEmpty = (g_iBarCodeCount == 0);
+
 	// Unlock the stock table mutex
 	pthread_mutex_unlock(&g_stockLock);
 
+	JSONAppendRaw(pBody, iRows ? "]" : " ]");
+
+	// Delta? Barcodes LocalCloud has that are gone
+	if (pPrev)
+	{
+		JSONAppendRaw(pBody, ", \"removed\":[");
+		for (int iP = 0, iRemoved = 0; iP < pPrev->iCount; iP++)
+		{
+			if (pPrev->pucSeen[iP])
+				continue;
+
+			if (iRemoved++)
+				JSONAppendRaw(pBody, ", ");
+			JSONAppendString(pBody, pPrev->szBarCodes[iP]);
+		}
+		JSONAppendRaw(pBody, "], \"delta\": true");
+	}
+
 	// Append Only = No Wipe off done. Append Only False == Wipe Off Done
-	// Build final POST body string
-	sprintf(szData, szFmtString, szRows[0] != '\0' ? szRows:" ", g_bWipeOffDone ? "false": "true");
-	DoLog("Scan Data::", 5);
-	DoLog(szData, 5);
+	JSONAppendRaw(pBody, g_bWipeOffDone ? ", \"append_only\": false}" : ", \"append_only\": true}");
 
-fetchURLPTSTLC:
-	// Init easy handle
-	CURL *curlEasyHandle = curl_easy_init();
+	return bEmpty;
+}
+
+// Checks a stock post response for LocalCloud asking for the full stock
+// ..{"resync": true}
+// Returns: TRUE if a full resync was asked for
+BOOL StockResyncRequested(struct MemoryStruct *pResp)
+{
+	if (!pResp->stSize)
+		return FALSE;
+
+	json_error_t Err;
+	json_t *pRoot = json_loads(pResp->pcBuffer, 0, &Err);
+
+	// Not json - nothing asked for
+	if (!pRoot)
+		return FALSE;
+
+	json_t *pResync = json_is_object(pRoot) ? json_object_get(pRoot, "resync") : NULL;
+	BOOL bResync = (pResync && json_is_true(pResync));
+
+	json_decref(pRoot);
 
-	// This is the URL to fetch
-	curl_easy_setopt(curlEasyHandle, CURLOPT_URL, szURL);
+	return bResync;
+}
 
-	// Timeout 10 seconds
-	curl_easy_setopt(curlEasyHandle, CURLOPT_TIMEOUT, 10L);
+// This function does a HTTP POST to Local Cloud
+// Passing the barcode/slot arrays to local cloud
+// To local Cloud
+// ..the body is streamed into g_StockPostBody (linear in stock size) and
+// ..handed to curl as is, posts take turns so an older stock post can
+// ..never land after a newer one
+// ..delta mode (PLCStockDelta=1) posts only the changes since the stock
+// ..LocalCloud last acknowledged [2xx], falling back to a full post when there
+// ..is none (startup, wipe-off, rejected delta) or LocalCloud asks for a resync
+void PostTotalStockToLocalCloud()
+{
+	char szURL[1024] = {0};
+	BuildLocalCloudURL(szURL, "submit_scanned_stock");
+	char szMsg[1024];
+	sprintf(szMsg, "PostTotalStockToLocalCloud:: POSTing data to URL [%s]", szURL);
+	DoLog(szMsg, 2);
 
-	// Writer callback function + Writer object
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlWriterCallback);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEDATA, (void *)&CfgBuffer);
+	// Initialize result struct
+	struct MemoryStruct CfgBuffer = {0};
+	CfgBuffer.pcBuffer = (char *)malloc(1);
+	CfgBuffer.stSize = 0;
 
-	// JSON request header setup
-	struct curl_slist *pHdrList = NULL;
-	pHdrList = curl_slist_append(pHdrList, "Content-Type: application/json");
+	// Our turn with the post body
+	pthread_mutex_lock(&g_stockPostLock);
+	pJSONWriter pBody = &g_StockPostBody;
 
-	// POST request - hardcoded data string
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POST, 1);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDS, szData);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDSIZE, strlen(szData));
-	curl_easy_setopt(curlEasyHandle, CURLOPT_HTTPHEADER, pHdrList);
+	// Delta? Needs stock LocalCloud acknowledged, wipe-offs are always full
+	BOOL bDelta = g_bStockDelta && g_pAckedStock->bValid && !g_bWipeOffDone;
 
-	// Fetch it - this is a blocking call
-	CURLcode res = curl_easy_perform(curlEasyHandle);
+buildPTSTLC:
+	JSONReset(pBody);
+	BOOL bEmpty = BuildStockPostBody(pBody, bDelta ? g_pAckedStock : NULL, g_bStockDelta ? g_pPostedStock : NULL);
+
+	// Out of memory? Nothing sensible to post
+	if (pBody->bError)
+	{
+		pthread_mutex_unlock(&g_stockPostLock);
+		free(CfgBuffer.pcBuffer);
 
-	// Free our header list
-	curl_slist_free_all(pHdrList);
+		DoLog("PostTotalStockToLocalCloud:: Out of memory building post body, stock not posted", 1);
+		return;
+	}
+
+	sprintf(szMsg, "PostTotalStockToLocalCloud:: %s body, %d bytes", bDelta ? "Delta" : "Full", (int)pBody->stSize);
+	DoLog(szMsg, 2);
+	DoLog("Scan Data::", 5);
+	DoLog(pBody->pcBuffer, 5);
+
+fetchURLPTSTLC:
+	// POST it - this is a blocking call [pooled keep-alive connection]
+	long lHTTPCode = 0;
+	CURLcode res = LocalCloudRequest("submit_scanned_stock", pBody->pcBuffer, pBody->stSize, &CfgBuffer, &lHTTPCode);
 
 	// Error check
 	if (res != CURLE_OK)
 	{
-		// Cleanup the handle
-		curl_easy_cleanup(curlEasyHandle);
-
 		sprintf(szMsg, "PostTotalStockToLocalCloud:: Error sending data to LocalCloud [%s], retrying in 5 seconds", curl_easy_strerror(res));
 		DoLog(szMsg, 1);
 
@@ -1847,18 +2426,49 @@ fetchURLPTSTLC:
 		goto fetchURLPTSTLC;
 	}
 
+	if (g_bStockDelta)
+	{
+		BOOL bAcked = (lHTTPCode / 100 == 2);
+
+		// Delta not taken, or LocalCloud wants everything? Post full stock now
+		if (bDelta && (!bAcked || StockResyncRequested(&CfgBuffer)))
+		{
+			sprintf(szMsg, "PostTotalStockToLocalCloud:: Delta not applied [HTTP %ld], posting full stock", lHTTPCode);
+			DoLog(szMsg, 1);
+
+			g_pAckedStock->bValid = FALSE;
+			bDelta = FALSE;
+
+			free(CfgBuffer.pcBuffer);
+			CfgBuffer.pcBuffer = (char *)malloc(1);
+			CfgBuffer.stSize = 0;
+
+			goto buildPTSTLC;
+		}
+
+		// Acknowledged? What we posted is what LocalCloud has now
+		// ..else the next post is a full one
+		if (bAcked)
+		{
+			pStockSnapshot pTemp = g_pAckedStock;
+			g_pAckedStock = g_pPostedStock;
+			g_pPostedStock = pTemp;
+		}
+		g_pAckedStock->bValid = bAcked;
+	}
+
 	/// Nothing more to be done, the LocalCloud will process the signal
 	// Cleanup
 	free(CfgBuffer.pcBuffer);
 
-	// Done with easy handle
-	curl_easy_cleanup(curlEasyHandle);
-
 	// Reset wipe-off done variable - only if this was a regular submit (else
 	// ..the system will keep posting wipe-offs to local cloud)
-	if (g_iBarCodeCount > 0)
+	if (!bEmpty)
 		g_bWipeOffDone = FALSE;
 
+	// Done with the post body
+	pthread_mutex_unlock(&g_stockPostLock);
+
 	DoLog("PostTotalStockToLocalCloud:: Posted total stock", 2);
 
 
@@ -1869,7 +2479,7 @@ fetchURLPTSTLC:
 void *SendScanStartSignalToLocalCloud(void *pArg)
 {
 	char szURL[1024] = {0};
-	sprintf(szURL, "http://%s/plcio/dispenser_status", g_szIPPort);
+	BuildLocalCloudURL(szURL, "dispenser_status");
 	char szMsg[1024];
 	sprintf(szMsg, "SendScanStartSignalToLocalCloud:: POSTing data to URL [%s]", szURL);
 	DoLog(szMsg, 2);
@@ -1883,41 +2493,12 @@ void *SendScanStartSignalToLocalCloud(void *pArg)
 	char szData[100] = "{\"status\": \"loading\"}";
 
 fetchURLSSSSTLC:
-	// Init easy handle
-	CURL *curlEasyHandle = curl_easy_init();
-
-	// This is the URL to fetch
-	curl_easy_setopt(curlEasyHandle, CURLOPT_URL, szURL);
-
-	// Timeout 10 seconds
-	curl_easy_setopt(curlEasyHandle, CURLOPT_TIMEOUT, 10L);
-
-	// Writer callback function + Writer object
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlWriterCallback);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEDATA, (void *)&CfgBuffer);
-
-	// JSON request header setup
-	struct curl_slist *pHdrList = NULL;
-	pHdrList = curl_slist_append(pHdrList, "Content-Type: application/json");
-
-	// POST request - hardcoded data string
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POST, 1);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDS, szData);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_POSTFIELDSIZE, strlen(szData));
-	curl_easy_setopt(curlEasyHandle, CURLOPT_HTTPHEADER, pHdrList);
-
-	// Fetch it - this is a blocking call
-	CURLcode res = curl_easy_perform(curlEasyHandle);
-
-	// Free our header list
-	curl_slist_free_all(pHdrList);
+	// POST it - this is a blocking call [pooled keep-alive connection]
+	CURLcode res = LocalCloudRequest("dispenser_status", szData, strlen(szData), &CfgBuffer, NULL);
 
 	// Error check
 	if (res != CURLE_OK)
 	{
-		// Cleanup the handle
-		curl_easy_cleanup(curlEasyHandle);
-
 		sprintf(szMsg, "SendScanStartSignalToLocalCloud:: Error sending data to LocalCloud [%s], retrying in 5 seconds", curl_easy_strerror(res));
 		DoLog(szMsg, 1);
 
@@ -1937,9 +2518,6 @@ fetchURLSSSSTLC:
 	// Cleanup
 	free(CfgBuffer.pcBuffer);
 
-	// Done with easy handle
-	curl_easy_cleanup(curlEasyHandle);
-
 	DoLog("SendScanStartSignalToLocalCloud:: Posted scan start signal", 2);
 } // end of send scan start signal to local cloud, no return value
 
@@ -1979,7 +2557,7 @@ void GetConfigFromLocalCloud(ConfigInfo *pCfgInfo)
 	DoLog(szMsg, 1);
 
 	char szURL[1024] = {0};
-	sprintf(szURL, "http://%s/plcio/config", g_szIPPort);
+	BuildLocalCloudURL(szURL, "config");
 	sprintf(szMsg, "GetConfigFromLocalCloud:: Fetching config URL [%s]", szURL);
 	DoLog(szMsg, 1);
 
@@ -1989,28 +2567,12 @@ void GetConfigFromLocalCloud(ConfigInfo *pCfgInfo)
 	CfgBuffer.stSize = 0;
 
 fetchURL:
-	// Init easy handle
-	CURL *curlEasyHandle = curl_easy_init();
-
-	// This is the URL to fetch
-	curl_easy_setopt(curlEasyHandle, CURLOPT_URL, szURL);
-
-	// Timeout 10 seconds
-	curl_easy_setopt(curlEasyHandle, CURLOPT_TIMEOUT, 10L);
-
-	// Writer callback function + Writer object
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEFUNCTION, CurlWriterCallback);
-	curl_easy_setopt(curlEasyHandle, CURLOPT_WRITEDATA, (void *)&CfgBuffer);
-
-	// Fetch it - this is a blocking call
-	CURLcode res = curl_easy_perform(curlEasyHandle);
+	// Fetch it - this is a blocking call [pooled keep-alive connection]
+	CURLcode res = LocalCloudRequest("config", NULL, 0, &CfgBuffer, NULL);
 
 	// Error check
 	if (res != CURLE_OK)
 	{
-		// Cleanup the handle
-		curl_easy_cleanup(curlEasyHandle);
-
 		sprintf(szMsg, "GetConfigFromLocalCloud:: Error reading config URL [%s], retrying in 5 seconds", curl_easy_strerror(res));
 		DoLog(szMsg, 1);
 
@@ -2032,9 +2594,6 @@ fetchURL:
 	// Cleanup
 	free(CfgBuffer.pcBuffer);
 
-	// Done with easy handle
-	curl_easy_cleanup(curlEasyHandle);
-
 	// Check if we got valid data: If not, we need to retry
 	// Did we get the PLC IP? And Lower slot count, lane count, dispenser count
 	if (!(pCfgInfo->szPLCIP[0] && pCfgInfo->iSlotCount && pCfgInfo->iLaneCount))
@@ -2064,29 +2623,6 @@ fetchURL:
 	*/
 } // void func, no return value
 
-// Curl Writer callback used for getconfig url-fetch
-// See CURLOPT_WRITEFUNCTION spec for desc of this function
-// Parameters: ReadData, Size, # of items, user-specified struct
-static size_t CurlWriterCallback(void *pContents, size_t stSize,
-	size_t stNum, void *pUser)
-{
-	size_t stRealSize = stSize * stNum;
-  struct MemoryStruct *pMem = (struct MemoryStruct *)pUser;
-
-  pMem->pcBuffer = (char *)realloc(pMem->pcBuffer, pMem->stSize + stRealSize + 1);
-
-	// Ran out of memory ?
-  if(pMem->pcBuffer == NULL)
-    // Fail
-		return 0;
-
-  memcpy(&(pMem->pcBuffer[pMem->stSize]), pContents, stRealSize);
-  pMem->stSize += stRealSize;
-  pMem->pcBuffer[pMem->stSize] = 0;
-
-  return stRealSize;
-} // end of curl writer callback
-
 // Extracts configuration info from a jsonized response from LocalCloud
 // Parameters: ConfigInfo pointer (to write data to), Memory Struct buffer with data to process
 void ProcessCfgResponse(ConfigInfo *pCfgInfo, struct MemoryStruct *pData)
@@ -2332,6 +2868,8 @@ pNode InsertListNode(char *pszDispenseID, int iStatus, char *pszOrderStub)
 	// Get time_t value (# of seconds since EPOCH)
 	time(&pNew->PayLoad.ttStartTime);
 
+	// Lock item-status-list
+	pthread_mutex_lock(&g_listLock);
 
 	// Is head NULL? i.e. List empty?
 	if (g_pHead == NULL)
@@ -2389,6 +2927,10 @@ pNode InsertListNode(char *pszDispenseID, int iStatus, char *pszOrderStub)
 
 	// Increment list size
 	g_iStatusListNodeCount++;
+	g_iStatusListGen++;
+
+	// Unlock item-status-list
+	pthread_mutex_unlock(&g_listLock);
 
 	// Done, return the new node
 	return pNew;
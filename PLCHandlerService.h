@@ -5,9 +5,13 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <curl/curl.h>
 #include <jansson.h>
 #include <signal.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/time.h>
 
 #include "plc.h"
 #include "PLCVariables.h"
@@ -51,14 +55,23 @@ enum
 #define MACHINESTAGECOUNT 9
 
 // 5000 Max items per dispenser
+// ..stock + scan storage is sized from the slot count (async scans) or this (sync)
 #define MAXITEMS 5000
 
-// 1025 MAX LENGTH OF VARIABLE Name (1024 + 1 NULL char)
-#define MAXPLCVARNAMELEN 1025
+// Sync scan slot numbers must be below this [de-duped by bitmap]
+#define MAXSCANSLOT 65536
 
 // One-second timeout for PLC reads
 #define PLCTIMEOUT 1000
 
+// Adaptive PLC timeouts in ms - per-call timeout comes from the connection's
+// ..round trip estimate (PLCTIMEOUT until the first sample), clamped to min/max
+// ..and doubled per timeout in a row. A call that keeps timing out gives up
+// ..(link down) once the next try would take it past the stall budget
+#define PLCMINTIMEOUT 100
+#define PLCMAXTIMEOUT 2500
+#define PLCSTALLBUDGETMS 3000
+
 // Main loop polling (PLC/OrderQueue) interval in seconds
 #define MAINDELAYSECONDS 5
 
@@ -67,9 +80,100 @@ enum
 // ...can atmost wait until the staff fixes the issue, a max of 25 mins
 #define ITEMREADINESSTIMEOUT 1500
 
+// Background PLC reconnect backoff in milliseconds
+// ..doubles after each failed attempt upto the max, with +/- 25% jitter
+#define PLCRECONNECTMINMS 500
+#define PLCRECONNECTMAXMS 30000
+
 // Max bytes readable by PLC
 #define MAXPLCREAD 8192
 
+// Max tags in the tag registry
+#define MAXTAGS 256
+
+// Tag the PLC calls a bad address at runtime (program download / online
+// ..edit) - ms before it is read again [startup validation stays permanent]
+#define TAGABSENTRETRYMS 30000
+
+// Event loop mode (PLCEventLoop=1) timer intervals in milliseconds
+// ..order queue fetch (when idle), dispenser readiness re-check,
+// ..machine-state (stage) poll, scan status poll, gap after sending an item
+// ..(so the PLC can drop its ready flag before the next readiness check)
+#define REACTORORDERPOLLMS 4000
+#define REACTORREADYPOLLMS 250
+#define REACTORDISPENSEGAPMS 1000
+#define REACTORSTAGEPOLLMS 250
+#define REACTORSCANPOLLMS 250
+
+// Stage poll scheduling (ProcessMachineStateData) - only stages where an
+// ..active item can show up next are read every sweep: those after the
+// ..earliest item's stage, upto STAGEPOLLLOOKAHEAD stages past the furthest
+// ..item's stage. Later stages are read every STAGECOLDPOLLMS (an item can
+// ..move on while a poll misses it), stages at or before the earliest item never
+#define STAGEPOLLLOOKAHEAD 2
+#define STAGECOLDPOLLMS 2000
+
+// Sync scan drain mode - the barcode tag is read back-to-back while it keeps
+// ..changing, the scan complete bit is checked when it repeats / is empty
+// ..or every SYNCSCANCHECKREADS reads. Repeats back off from about one PLC
+// ..round trip (at least SYNCSCANMINBACKOFFMS), doubling per repeat upto
+// ..SYNCSCANIDLEMS - the next barcode usually shows up within a few ms
+#define SYNCSCANCHECKREADS 16
+#define SYNCSCANMINBACKOFFMS 2
+#define SYNCSCANIDLEMS 100
+
+// Async scan - barcode array slots read per request (runs of String82
+// ..structs, 88 bytes each, upto PLC_CHAR_MAX bytes)
+#define ASYNCSCANRUNSLOTS (PLC_CHAR_MAX / 88)
+
+// LocalCloud HTTP client - idle easy handles kept for reuse, share lock slots
+// ..(one per curl lock data type)
+#define LCHANDLEPOOLSIZE 8
+#define LCSHARELOCKS 8
+
+// LocalCloud async engine (curl multi, one thread) - queued requests [bounded],
+// ..requests in flight at once, delay before retrying after a failure (ms),
+// ..max body of a queued request, response kept for the callback (truncated)
+#define LCASYNCQUEUESIZE 256
+#define LCASYNCMAXINFLIGHT 4
+#define LCASYNCRETRYMS 5000
+#define LCASYNCBODYLEN 1280
+#define LCASYNCRESPLEN 2048
+
+// Item status batching (PLCStatusBatch=1, off by default) - default window
+// ..(ms) a batch is held open for more items (PLCStatusBatchMS), max items per
+// ..batch (PLCStatusBatchMax, upto LCSTATUSBATCHMAX)
+// ..tries of an item status post [single item or batch] LocalCloud answers
+// ..with 5xx - a batch is then posted item by item, an item given up on
+#define LCSTATUSBATCHMS 200
+#define LCSTATUSBATCHMAX 8
+#define LCSTATUSPOSTTRIES 3
+
+// PLC stage push (PLCPushListen=<PLCIO slave open string>)
+// ..the PLC pushes each stage-variable as an unsolicited register write to
+// ..file PUSHSTAGEFILE, element stage * 10 + variant (e.g N50:53 = stage 5 variant 3)
+// ..payload is the BCON string, or the flag in the 1st byte for STAGE7
+// ..receive timeout in ms (listener checks app done between receives)
+#define PUSHSTAGEFILE 50
+#define PUSHRECEIVETIMEOUT 1000
+
+// PLC I/O stats - latency histogram buckets (4 per power of 2 microseconds,
+// ..upto ~30 seconds) + seconds between periodic stats dumps (SIGUSR1 dumps now)
+#define LATHISTBUCKETS 100
+#define PLCSTATSINTERVAL 300
+
+// PLC traffic recorder (PLCRecord=<file>) - binary log of every tag read + write
+// ..file = PLCRecordFileHeader, then per call a PLCRecordHeader followed by the
+// ..tag name + the bytes read (raw, as PLCIO returned them) or the string written
+// ..replayed by the mock PLC library (MOCKPLC_REPLAY=<file>, see test-tools/mockplc.c)
+// ..buffered, flushed every PLCRECORDFLUSHMS
+#define PLCRECORDMAGIC "PLCREC01"
+#define PLCRECORDFLUSHMS 1000
+
+// Order writes waiting for the order writer thread (DispenseItemFromList
+// ..blocks only if this many are queued)
+#define ORDERWRITEQUEUESIZE 8
+
 // Log Priority is 5 = super deep
 #define LOGPRIORITY 4
 
@@ -102,6 +206,238 @@ typedef struct
 } ItemStatusNode, *pItemStatusNode;
 
 
+// Latency Histogram struct
+// HDR style: log-linear buckets in microseconds, 4 buckets per power of 2
+// ..(so any recorded value is within 25% of its bucket)
+typedef struct
+{
+	unsigned int auBuckets[LATHISTBUCKETS];
+	unsigned int uCount;
+	long long llTotalUS;
+	long long llMaxUS;
+} LatencyHist, *pLatencyHist;
+
+// PLC Connection struct
+// One PLCIO session (order or scan) with its own lock,
+// ..link state and error counters
+// Sessions are independent, so one session's reads/reconnects
+// ..never block the other one
+// A session whose link drops is handed to the background reconnect
+// ..manager; until it recovers, reads + writes on it fail straight away
+typedef struct
+{
+	// PLCIO handle (NULL while disconnected)
+	PLC *pPLC;
+
+	// Serializes PLCIO calls on this session
+	pthread_mutex_t Lock;
+
+	// Session name for logs (OrderPLC / ScanPLC)
+	char szName[16];
+
+	// Is the link down? (reconnect manager is recovering it)
+	BOOL bLinkDown;
+
+	// Reconnect state - monotonic ms of link down + next attempt, current backoff
+	long long llDownSinceMS;
+	long long llNextAttemptMS;
+	int iBackoffMS;
+
+	// Round trip estimate in microseconds, like TCP's SRTT/RTTVAR
+	// ..(0 = no samples yet, reset on reconnect)
+	long long llSRTTUS;
+	long long llRTTVarUS;
+
+	// Time to recover (link down until link up again) in ms
+	// ..last, worst and total (total / iReconnects = average)
+	long long llLastRecoverMS;
+	long long llMaxRecoverMS;
+	long long llTotalRecoverMS;
+
+	// Counters since service start
+	int iReconnects;
+	int iTimeouts;
+	int iErrors;
+
+	// PLCIO error of the last failed read/write (for the traffic recorder)
+	int iLastError;
+
+	// Latency of reads/writes on this session + time spent waiting for
+	// ..its lock (incl. g_plcLock with PLCIO_GLOBAL_LOCK)
+	LatencyHist CallHist;
+	LatencyHist LockWaitHist;
+} PLCConnection, *pPLCConnection;
+
+// Tag Info struct
+// Tag registry entry for one PLC tag: read params are worked out once,
+// ..existence + size are validated once at startup (plc_validaddr)
+typedef struct
+{
+	// Tag (PLC address) name
+	char szName[64];
+
+	// Type of var ('b'/'s'/'i')
+	char cType;
+
+	// Cached plc_read params: op, format, bytes to read
+	int iOp;
+	char *pszFormat;
+	int iReadLen;
+
+	// Offset of the value in the bytes read (String82 text past its length)
+	int iDataOffset;
+
+	// Size reported by plc_validaddr (0 if not validated)
+	int iSize;
+
+	// Has the tag been checked against the PLC?
+	BOOL bValidated;
+
+	// Tag doesnt exist on this PLC - never read it
+	BOOL bAbsent;
+
+	// Bad address on a read - not read again before this time (0 = none)
+	long long llAbsentUntilMS;
+
+	// I/O stats since service start [guarded by the registry lock]
+	// ..latency of each read/write (incl. retries), failed calls, timeouts
+	LatencyHist Hist;
+	int iErrors;
+	int iTimeouts;
+} TagInfo, *pTagInfo;
+
+// PLC Write Buffer struct
+// A String82 value encoded once for plc_write in the layout of the PLC type
+// ..(ControlLogix String82 struct / MicroLogix word swapped ST element)
+// ..owned by the caller, so concurrent writers dont share a buffer
+typedef struct
+{
+	// Encoded bytes + plc_write params
+	char acData[100];
+	int iLen;
+	int iOp;
+	char *pszFormat;
+
+	// Value as passed in (for logs)
+	char szValue[83];
+} PLCWriteBuf, *pPLCWriteBuf;
+
+// PLC write results [WriteEncodedToPLC] - written, link (went) down [try again
+// ..once reconnected], rejected by the PLC (bad address, invalid reply, ..)
+enum
+{
+	PLCWRITEOK = 0,
+	PLCWRITELINKDOWN,
+	PLCWRITEREJECTED
+};
+
+// PLC Read Params struct
+// plc_read op, format string + bytes to read for one type of var
+typedef struct
+{
+	int iOp;
+	char *pszFormat;
+	int iReadLen;
+} PLCReadParams;
+
+// PLC Tag Set struct
+// Everything that differs between PLC families (ControlLogix / MicroLogix):
+// ..tag names from PLCVariables.h, read params per var type, string layout
+// One constant table per family is built at compile time (PLCFunctions.cpp),
+// ..the one for our PLC is picked once at startup (SelectPLCTagSet)
+// ..so the read/write/stage-poll paths dont check the PLC type per call
+// Tags a family doesnt have are "" (or " " for MicroLogix gaps)
+typedef struct
+{
+	// Family name for logs
+	const char *pszName;
+
+	// Power + ready state
+	char *pszPowerOnVar;
+	char *pszAlwaysOnVar;
+
+	// Dispenser order + scan vars (see CompartmentInfo)
+	char *pszDispenseReadinessVar;
+	char *pszOrderVar;
+	char *pszDoorClosedVar;
+	char *pszOKToOpenDoorVar;
+	char *pszScanStartVar;
+	char *pszSyncScanCompleteVar;
+	char *pszSyncBarCodeSlotNumberVar;
+	char *pszAsyncScanCompleteVar;
+	char *pszAsyncBarCodeArrayVar;
+
+	// Stage variables + their types ('s'/'b') [stage][variant], 1-based
+	// ..NULL = no such stage variable
+	char *pszStageVars[MACHINESTAGECOUNT + 1][4];
+	char cStageTypes[MACHINESTAGECOUNT + 1][4];
+
+	// plc_read params for bool, string + int vars
+	PLCReadParams BoolRead;
+	PLCReadParams StringRead;
+	PLCReadParams IntRead;
+
+	// Offset of the text in a string read (past the String82 length)
+	int iStringOffset;
+
+	// Bools are bits of words (MicroLogix B3:13/6) - read a word once for all its bits
+	BOOL bBitWords;
+
+	// Encodes a String82 value for plc_write
+	void (*pfnEncodeString)(pPLCWriteBuf pBuf);
+} PLCTagSet, *pPLCTagSet;
+
+// PLC traffic log structs (PLCRecord) - fixed size, no padding
+// ..mockplc.c has its own copy, keep them in step
+// File header: magic, PLC type (0 = ControlLogix, 1 = MicroLogix),
+// ..wall clock time recording started in microseconds
+typedef struct
+{
+	char szMagic[8];
+	int iPLCType;
+	int iSpare;
+	long long llStartUS;
+} PLCRecordFileHeader;
+
+// Record header: microseconds since recording started, connection (0 = order,
+// ..1 = scan), tag type ('b'/'s'/'i' read, 'w' write), tag name length,
+// ..result (bytes read/written, -1 = failed), PLCIO error if failed
+typedef struct
+{
+	long long llTimeUS;
+	unsigned char cConn;
+	char cType;
+	unsigned char cNameLen;
+	unsigned char cSpare;
+	short sResult;
+	short sError;
+} PLCRecordHeader;
+
+// Stage Snapshot struct
+// Typed values of all stage variables, read in one batch per poll cycle
+// Indexed [Stage][Variant], 1-based like the stage-vars array
+typedef struct
+{
+	// Was this stage variable read successfully?
+	BOOL bRead[MACHINESTAGECOUNT + 1][4];
+
+	// Bool stage variables (microwave heating flags)
+	BOOL bFlag[MACHINESTAGECOUNT + 1][4];
+
+	// String stage variables (BarCode + Order Number)
+	char szBCON[MACHINESTAGECOUNT + 1][4][83];
+} StageSnapshot, *pStageSnapshot;
+
+// Stage Cache Entry struct
+// Last value of one stage-variable applied to the item-status-list
+// ..(change detection - unchanged values are not applied again)
+typedef struct
+{
+	BOOL bValid;
+	BOOL bFlag;
+	char szBCON[83];
+} StageCacheEntry, *pStageCacheEntry;
+
 // Linked List Node
 typedef struct NodeStruct
 {
@@ -123,9 +459,19 @@ typedef struct
 	char szOrderStub[60];
 }ItemDispenseData, *pItemDispenseData;
 
+// Order Write struct
+// An item queued for the order writer thread, with its order stub
+// ..already encoded for the PLC
+typedef struct
+{
+	ItemDispenseData Item;
+	PLCWriteBuf Buf;
+} OrderWrite, *pOrderWrite;
+
 // Compartment Info struct
 // Stores config info, variables, etc. for a single compartment
 // of the dispensers.
+// Variable names point into the PLC family's tag set (PLCTagSet)
 // We now have only 1 compartment - for all dispensers
 typedef struct
 {
@@ -133,31 +479,31 @@ typedef struct
 	int iSlotCount;
 
 	// Dispense readiness state PLC variable
-	char szDispenseReadinessVar[MAXPLCVARNAMELEN];
+	char *pszDispenseReadinessVar;
 
 	// Name of variable to post order to PLC
-	char szOrderVar[MAXPLCVARNAMELEN];
+	char *pszOrderVar;
 
 	// Name of variable to check Door Closure State (for scan)
-	char szDoorClosedVar[MAXPLCVARNAMELEN];
+	char *pszDoorClosedVar;
 
 	// Name of variable to check OK to Open Door State (for scan)
-	char szOKToOpenDoorVar[MAXPLCVARNAMELEN];
+	char *pszOKToOpenDoorVar;
 
 	// Scan started variable name
-	char szScanStartVar[MAXPLCVARNAMELEN];
+	char *pszScanStartVar;
 
 	// Sync Mode :: Scan complete var
-	char szSyncScanCompleteVar[MAXPLCVARNAMELEN];
+	char *pszSyncScanCompleteVar;
 
 	// Sync Mode :: Name of variable for scanning 1 barcode + slotnumber
-	char szSyncBarCodeSlotNumberVar[MAXPLCVARNAMELEN];
+	char *pszSyncBarCodeSlotNumberVar;
 
 	// Async Mode :: Scan complete var
-	char szAsyncScanCompleteVar[MAXPLCVARNAMELEN];
+	char *pszAsyncScanCompleteVar;
 
 	// Async Mode :: Name of variable for barcode array [async mode]
-	char szAsyncBarCodeArrayVar[MAXPLCVARNAMELEN];
+	char *pszAsyncBarCodeArrayVar;
 }CompartmentInfo, *pCompartmentInfo;
 
 // Configuration Info Struct
@@ -174,17 +520,117 @@ typedef struct
 	int iPLCType; 							// PLC Type 0: ControlLogix, 1: MicroLogix etc.
 } ConfigInfo, *pConfigInfo;
 
+// Scan Results struct
+// {barcode, slot} pairs collected during one dispenser scan
+typedef struct
+{
+	// Scanned barcodes + their slot numbers [iMaxItems each, in the stock arena]
+	char (*szBarCodeArray)[35];
+	int *iSlotNumArray;
+
+	// Sync Mode :: slots already stored, bit per slot number
+	unsigned char ucSlotSeen[MAXSCANSLOT / 8];
+
+	// # of {barcode, slot} pairs stored, room for
+	int iNumScannedItems;
+	int iMaxItems;
+
+	// Sync Mode :: has any valid scan data arrived yet?
+	BOOL bDataReceived;
+
+	// Sync Mode :: last string read from the barcode tag (repeat = no new data)
+	// ..and # of barcode tag reads this scan
+	char szLastSyncData[83];
+	int iSyncReads;
+
+	// Sync Mode :: current back off after a repeat (ms, 0 = new data last)
+	int iRepeatBackoffMS;
+
+	// Scan start (monotonic ms) - for throughput
+	long long llStartMS;
+} ScanResults, *pScanResults;
+
 // Struct for curl reads
 struct MemoryStruct {
 	char *pcBuffer;
 	size_t stSize;
 };
 
-// Struct for posting item status data to local cloud
+// Streaming JSON writer - appends into one buffer, grown geometrically
+// ..and kept between uses [stSize = bytes written, excluding the NUL]
 typedef struct
 {
-	char szOrderStub[1024];
-	char szDispenseID[1024];
-	int iStatus;
-	char szTimerString[1024];
-} ItemStatusData, *pItemStatusData;
+	char *pcBuffer;
+	size_t stSize;
+	size_t stCapacity;
+	BOOL bError;			// allocation failed, output is incomplete
+} JSONWriter, *pJSONWriter;
+
+// Stock snapshot - the stock table as posted to / acknowledged by LocalCloud
+// ..(delta stock posts, PLCStockDelta=1) - barcode, qty + slot list hash per entry
+// ..barcode hash -> entry + 1 as in the stock table, seen flags are diff scratch
+typedef struct
+{
+	BOOL bValid;
+	int iCount;
+	char (*szBarCodes)[35];
+	int *piQty;
+	unsigned int *puSlotHash;
+	int *piHash;
+	unsigned char *pucSeen;
+} StockSnapshot, *pStockSnapshot;
+
+// Async LocalCloud request states
+enum
+{
+	LCREQFREE = 0,
+	LCREQQUEUED,
+	LCREQINFLIGHT,
+	LCREQDONE
+};
+
+// Async LocalCloud request callback results - done, post it again at once,
+// ..post it again after LCASYNCRETRYMS [like a failed post]
+// ..posted again, it keeps its place in the queue
+enum
+{
+	LCCBDONE = 0,
+	LCCBREPOST,
+	LCCBRETRY
+};
+
+// Async LocalCloud request callback - called on the engine thread once it is
+// ..posted, with the (truncated) response
+// Returns: LCCBDONE / LCCBREPOST / LCCBRETRY
+struct LCAsyncRequest;
+typedef int (*pfnLCAsyncDone)(struct LCAsyncRequest *pReq, CURLcode res, long lHTTPCode, const char *pszResp);
+
+// Queued async LocalCloud POST [slot of the engine's request queue]
+// ..in-order requests start one at a time, in queue order
+// ..a batch keeps where each item of its "data" array starts / ends in the
+// ..body; split, it is posted an item at a time as {"data":item}
+typedef struct LCAsyncRequest
+{
+	char szPath[64];
+	char szBody[LCASYNCBODYLEN];
+	int iBodyLen;
+	int iState;
+	int iTries;
+	BOOL bInOrder;
+	int iItems;
+	short sItemStart[LCSTATUSBATCHMAX];
+	short sItemEnd[LCSTATUSBATCHMAX];
+	BOOL bSplit;
+	int iNextItem;
+	int iSlot;
+	pfnLCAsyncDone pfnDone;
+} LCAsyncRequest, *pLCAsyncRequest;
+
+// Async engine in-flight slot - response + the body of a split batch item
+typedef struct LCInFlight
+{
+	BOOL bUsed;
+	char szResp[LCASYNCRESPLEN];
+	size_t stResp;
+	char szBody[LCASYNCBODYLEN];
+} LCInFlight, *pLCInFlight;
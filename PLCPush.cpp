@@ -0,0 +1,176 @@
+// Just one include file - everything is referenced there
+#include "PLCHandlerService.h"
+
+/// PLC stage push - enabled with PLCPushListen=<PLCIO slave open string>
+/// A listener thread runs a PLCIO slave session and takes unsolicited
+/// ..register writes (PLC_SLAVE_WREGS) of the stage-variables, so a stage
+/// ..change updates the item-status-list as soon as the PLC sends it
+/// ..instead of on the next poll sweep
+/// Addressing: file PUSHSTAGEFILE, element stage * 10 + variant
+/// ..(e.g N50:53 = stage 5 variant 3), payload = BCON string (82 bytes)
+/// ..or, for STAGE7, the heating flag in the first byte
+/// Polling (ProcessMachineStateData) stays on as the fallback
+/// ..pushes that are lost or rejected are picked up by the next sweep
+
+// Global functions
+void StartPushListener(char *pszOpenString);
+void *PushListenerFunction(void *pArg);
+PLC *OpenPushSession(char *pszOpenString);
+BOOL HandleStagePush(PLCSLAVE *pSlave, char *pszData, int iLen);
+
+// External vars + funcs
+extern BOOL g_bAppDone;
+extern pthread_mutex_t g_plcLock, g_listLock;
+extern char *g_pszStageVars[10][4];
+
+extern void DoLog(const char *pszLogMsg, int iPriority = 0);
+extern void ApplyStageData(int i, int j, BOOL bFlag, char *pszBCON);
+
+// Push counters since service start - applied / rejected
+int g_iPushesApplied = 0;
+int g_iPushesRejected = 0;
+
+
+// Starts the push listener thread
+// Params: PLCIO open string of the slave session (from PLCPushListen)
+void StartPushListener(char *pszOpenString)
+{
+	pthread_t tPush;
+
+	char szMsg[1024] = {0};
+	sprintf(szMsg, "PushListener:: Starting, slave session [%s]", pszOpenString);
+	DoLog(szMsg, 1);
+
+	pthread_create(&tPush, NULL, &PushListenerFunction, (void *)pszOpenString);
+	pthread_detach(tPush);
+} // void func, no return value
+
+// Push listener thread
+// ..receives unsolicited writes until app done, reopening the
+// ..slave session if it fails
+// params: pArg = PLCIO open string
+void *PushListenerFunction(void *pArg)
+{
+	char *pszOpenString = (char *)pArg;
+	PLC *pPLC = NULL;
+
+	// Loop until app done
+	while (!g_bAppDone)
+	{
+		// Need a session?
+		if (!pPLC && !(pPLC = OpenPushSession(pszOpenString)))
+		{
+			// wait 10 seconds
+			sleep(10);
+			continue;
+		}
+
+		PLCSLAVE Slave;
+		char szData[MAXPLCREAD + 1] = {0};
+
+		// Wait for a push [own session, no connection lock needed]
+		int iLen = plc_receive(pPLC, PLC_SLAVE_WREGS, &Slave, szData, MAXPLCREAD, PUSHRECEIVETIMEOUT);
+
+		// Nothing arrived?
+		if (iLen == -1 && pPLC->j_error == PLCE_TIMEOUT)
+			continue;
+
+		// Session failed?
+		if (iLen == -1)
+		{
+			plc_print_error(pPLC, "plc_receive");
+
+			char szErr[1024] = {0};
+			sprintf(szErr, "PushListener:: plc_receive Error [%s], reopening", pPLC->ac_errmsg);
+			DoLog(szErr, 1);
+
+			pthread_mutex_lock(&g_plcLock);
+			plc_close(pPLC);
+			pthread_mutex_unlock(&g_plcLock);
+			pPLC = NULL;
+			continue;
+		}
+
+		// Apply it + ACK, or NAK what we dont understand
+		BOOL bOK = HandleStagePush(&Slave, szData, iLen);
+		if (plc_reply(pPLC, bOK ? PLC_SLAVE_ACK : PLC_SLAVE_NAK, NULL, 0, PUSHRECEIVETIMEOUT) == -1)
+			plc_print_error(pPLC, "plc_reply");
+	} // end of listener loop
+
+	// Cleanup
+	if (pPLC)
+	{
+		pthread_mutex_lock(&g_plcLock);
+		plc_close(pPLC);
+		pthread_mutex_unlock(&g_plcLock);
+	}
+
+	return NULL;
+} // end of push listener thread
+
+// Opens the slave session - one attempt
+// Params: PLCIO open string
+// Returns: PLCIO handle, NULL on failure (error logged)
+PLC *OpenPushSession(char *pszOpenString)
+{
+	// plc_open uses library globals
+	pthread_mutex_lock(&g_plcLock);
+	PLC *pPLC = plc_open(pszOpenString);
+
+	if (!pPLC)
+	{
+		plc_print_error(pPLC, "plc_open");
+
+		char szErr[1024] = {0};
+		sprintf(szErr, "PushListener:: plc_open Error [%s]", plc_open_ptr->ac_errmsg);
+		pthread_mutex_unlock(&g_plcLock);
+		DoLog(szErr, 1);
+
+		return NULL;
+	}
+	pthread_mutex_unlock(&g_plcLock);
+
+	DoLog("PushListener:: Slave session open, waiting for stage pushes", 2);
+
+	return pPLC;
+}
+
+// Decodes one unsolicited write and applies it to the item-status-list
+// Params: slave message info, payload, payload length
+// Returns: TRUE if it was a stage push we know (ACK), FALSE otherwise (NAK)
+BOOL HandleStagePush(PLCSLAVE *pSlave, char *pszData, int iLen)
+{
+	char szMsg[1024] = {0};
+
+	// Stage = tens, variant = units of the element number
+	int i = pSlave->j_offset / 10;
+	int j = pSlave->j_offset % 10;
+
+	// Is it for us? Stage + variant must be one we poll
+	if (pSlave->j_type != PLC_SLAVE_WREGS || pSlave->j_fileno != PUSHSTAGEFILE || iLen < 1 || \
+		i < 1 || i > MACHINESTAGECOUNT || j < 1 || j > 3 || !g_pszStageVars[i][j][0])
+	{
+		g_iPushesRejected++;
+		sprintf(szMsg, "PushListener:: Rejected push File %d Element %d Len %d [%d rejected so far]", \
+			pSlave->j_fileno, pSlave->j_offset, iLen, g_iPushesRejected);
+		DoLog(szMsg, 2);
+
+		return FALSE;
+	}
+
+	// BCON is upto 82 chars, NUL terminated
+	char szBCON[83] = {0};
+	strncpy(szBCON, pszData, iLen < 82 ? iLen : 82);
+
+	sprintf(szMsg, "PushListener:: Stage %d Variant %d [%s]", i, j, i == STAGE7 ? (pszData[0] ? "1" : "0") : szBCON);
+	DoLog(szMsg, 5);
+
+	// Update item-status-list
+	pthread_mutex_lock(&g_listLock);
+	ApplyStageData(i, j, pszData[0] != 0, szBCON);
+	pthread_mutex_unlock(&g_listLock);
+
+	g_iPushesApplied++;
+
+	return TRUE;
+} // end of stage push func
@@ -0,0 +1,571 @@
+// Just one include file - everything is referenced there
+#include "PLCHandlerService.h"
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+#include <errno.h>
+#include <stdint.h>
+
+/// Event loop (reactor) mode - enabled with PLCEventLoop=1
+/// One thread multiplexes both PLC sessions and a set of timers with select():
+/// ..order processing (queue fetch, readiness check, dispense), machine-state
+/// ..(stage) polling, scan polling and dispense-timeout sweeps all run as small
+/// ..state machines driven by timerfds, instead of the sleep/usleep loops of
+/// ..the main thread + scan worker thread
+/// PLCIO master-mode reads are request/response calls, so each timer tick still
+/// ..does short blocking reads. The PLC fds are watched too: a session whose
+/// ..socket turns readable while idle has been dropped by the PLC, so it is
+/// ..probed straight away (and reconnected by the read error handling)
+/// LocalCloud calls that block (order queue fetch, stock post - both can take
+/// ..the whole curl timeout while LocalCloud is away) run on two worker threads:
+/// ..the fetched order list comes back through an eventfd the loop watches,
+/// ..stock posts requested while one is running are coalesced into one more
+
+// Global functions
+void RunReactor();
+void ArmTimer(int iTimer, int iDelayMS);
+void OnOrderTimer();
+void OnStageTimer();
+void OnScanTimer();
+void OnTimeoutTimer();
+void ProbePLC(pPLCConnection pConn, time_t *pttNextProbe);
+void FinishReactorScan();
+void FreeItemList();
+void StartReactorWorkers();
+void OnOrdersFetched();
+void *OrderFetchWorker(void *pArg);
+void *StockPostWorker(void *pArg);
+
+// Reactor timers
+enum
+{
+	ORDERTIMER,
+	STAGETIMER,
+	SCANTIMER,
+	TIMEOUTTIMER,
+	TIMERCOUNT
+};
+
+// Scan state machine states
+enum
+{
+	SCANIDLE,         // Polling for scan start
+	SCANWAITCOMPLETE, // Async :: waiting for scan complete bit
+	SCANREADING,      // Sync :: reading barcodes until scan complete bit
+	SCANWAITRESET     // Waiting for PLC to reset scan signals
+};
+
+// External vars + funcs
+extern BOOL g_bAppDone;
+extern ConfigInfo g_CfgInfo;
+extern CompartmentInfo g_CompInfo;
+extern PLCConnection g_OrderPLC, g_ScanPLC;
+extern ScanResults g_ScanResults;
+extern const PLCTagSet *g_pTagSet;
+
+extern void DoLog(const char *pszLogMsg, int iPriority = 0);
+extern void ConnectToPLC(pPLCConnection pConn, char *pszIP, int iPort, BOOL bMicroLogix);
+extern void DisconnectFromPLC(pPLCConnection pConn);
+extern BOOL ReadBool(pPLCConnection pConn, char *pszVarName, BOOL *pbVal);
+extern BOOL PLCFdSet(pPLCConnection pConn, fd_set *pReadSet, int *piMaxFd);
+extern BOOL PLCFdIsSet(pPLCConnection pConn, fd_set *pReadSet);
+extern pItemDispenseData *GetNewItemsFromLocalCloud();
+extern void DispenseItemFromList(pItemDispenseData pItem);
+extern BOOL IsOrderWritePending();
+extern void PostItemStatusToLocalCloud(char *pszOrderStub, char *pszDispenseID, int iStatus, char *pszTimerString = NULL);
+extern void ProcessMachineStateData();
+extern void CheckItemsForTimeouts();
+extern BOOL GetScanStatus(pPLCConnection pConn);
+extern void BeginScan(pScanResults pResults, const char *pszMode);
+extern void ReadAsyncScanResults(pScanResults pResults);
+extern BOOL ReadSyncScanData(pScanResults pResults);
+extern int SyncScanBackoffMS(pScanResults pResults, BOOL bNewData);
+extern void LogScanThroughput(pScanResults pResults);
+extern void UpdateDispenserStock(int iSlotNumArray[], char pszBarCodeArray[][35], int iNumScanned);
+extern void PostTotalStockToLocalCloud();
+
+/// Reactor state
+// Timer fds
+int g_iTimerFd[TIMERCOUNT];
+
+// Order state: current new-item list, index + item being dispensed
+pItemDispenseData *g_pNewItemList = NULL, g_pListItem = NULL;
+int g_iItemIdx = 0;
+
+// Time we started waiting for dispenser readiness (0 = not waiting)
+time_t g_ttReadyWaitStart = 0;
+
+// Scan state + # of polls spent waiting for scan signals to reset
+int g_iScanState = SCANIDLE;
+int g_iScanResetWait = 0;
+
+// Earliest time each PLC session may be probed again
+time_t g_ttOrderProbe = 0, g_ttScanProbe = 0;
+
+// LocalCloud workers [g_reactorWorkLock] - requests, the fetched order list
+// ..(handed back through g_iOrderFetchFd), fetch outstanding (loop only)
+pthread_mutex_t g_reactorWorkLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_reactorWorkCond = PTHREAD_COND_INITIALIZER;
+BOOL g_bFetchRequested = FALSE, g_bStockPostRequested = FALSE;
+pItemDispenseData *g_pFetchedList = NULL;
+int g_iOrderFetchFd = -1;
+BOOL g_bFetchOutstanding = FALSE;
+
+
+// Runs the event loop until app done
+// ..called from main once the order PLC is ready and compartment info is set up
+// No parameters, no return value
+void RunReactor()
+{
+	DoLog("Reactor:: Event loop mode, connecting ScanPLC");
+
+	// Connect to PLC for scan detection (order PLC is already connected)
+	ConnectToPLC(&g_ScanPLC, g_CfgInfo.szPLCIP, g_CfgInfo.iPLCPort, g_CfgInfo.iPLCType == 1);
+
+	// LocalCloud workers [order fetch, stock post]
+	StartReactorWorkers();
+
+	// Create the timers - all fire straight away
+	for (int i = 0; i < TIMERCOUNT; i++)
+	{
+		g_iTimerFd[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+		if (g_iTimerFd[i] == -1)
+		{
+			DoLog("Reactor:: timerfd_create failed!", 1);
+			exit(1);
+		}
+		ArmTimer(i, 0);
+	}
+
+	DoLog("Reactor:: Event loop started");
+
+	// Loop until app done
+	while (!g_bAppDone)
+	{
+		fd_set ReadSet;
+		int iMaxFd = -1;
+		FD_ZERO(&ReadSet);
+
+		// Timers
+		for (int i = 0; i < TIMERCOUNT; i++)
+		{
+			FD_SET(g_iTimerFd[i], &ReadSet);
+			if (g_iTimerFd[i] > iMaxFd)
+				iMaxFd = g_iTimerFd[i];
+		}
+
+		// Order list fetched
+		FD_SET(g_iOrderFetchFd, &ReadSet);
+		if (g_iOrderFetchFd > iMaxFd)
+			iMaxFd = g_iOrderFetchFd;
+
+		// PLC sessions [unless probed very recently]
+		time_t ttNow = time(NULL);
+		BOOL bOrderFd = (ttNow >= g_ttOrderProbe) && PLCFdSet(&g_OrderPLC, &ReadSet, &iMaxFd);
+		BOOL bScanFd = (ttNow >= g_ttScanProbe) && PLCFdSet(&g_ScanPLC, &ReadSet, &iMaxFd);
+
+		// Wait for something to happen
+		if (select(iMaxFd + 1, &ReadSet, NULL, NULL, NULL) == -1)
+		{
+			// Signal? Just go round again
+			if (errno == EINTR)
+				continue;
+
+			char szMsg[1024] = {0};
+			sprintf(szMsg, "Reactor:: select failed [%s]", strerror(errno));
+			DoLog(szMsg, 1);
+
+			// Avoid spinning on a persistent error
+			sleep(1);
+			continue;
+		}
+
+		// PLC session readable while idle?
+		if (bOrderFd && PLCFdIsSet(&g_OrderPLC, &ReadSet))
+			ProbePLC(&g_OrderPLC, &g_ttOrderProbe);
+		if (bScanFd && PLCFdIsSet(&g_ScanPLC, &ReadSet))
+			ProbePLC(&g_ScanPLC, &g_ttScanProbe);
+
+		// New order list?
+		if (FD_ISSET(g_iOrderFetchFd, &ReadSet))
+			OnOrdersFetched();
+
+		// Expired timers
+		for (int i = 0; i < TIMERCOUNT; i++)
+		{
+			if (!FD_ISSET(g_iTimerFd[i], &ReadSet))
+				continue;
+
+			// Clear expiry count
+			uint64_t u64Expiries;
+			if (read(g_iTimerFd[i], &u64Expiries, sizeof(u64Expiries)) != sizeof(u64Expiries))
+				continue;
+
+			switch (i)
+			{
+				case ORDERTIMER:
+					OnOrderTimer();
+					break;
+				case STAGETIMER:
+					OnStageTimer();
+					break;
+				case SCANTIMER:
+					OnScanTimer();
+					break;
+				default:
+					OnTimeoutTimer();
+			}
+		} // end timer loop
+	} // end event loop
+
+	DoLog("Reactor:: Event loop done, doing cleanup");
+
+	// Cleanup
+	for (int i = 0; i < TIMERCOUNT; i++)
+		close(g_iTimerFd[i]);
+	FreeItemList();
+	DisconnectFromPLC(&g_ScanPLC);
+} // void func, no return value
+
+// Arms a one-shot reactor timer
+// Params: timer, delay in milliseconds (0 = as soon as possible)
+void ArmTimer(int iTimer, int iDelayMS)
+{
+	struct itimerspec Spec;
+	memset(&Spec, 0, sizeof(Spec));
+
+	Spec.it_value.tv_sec = iDelayMS / 1000;
+	Spec.it_value.tv_nsec = (iDelayMS % 1000) * 1000000L;
+
+	// An all-zero value disarms a timerfd, so 'now' is 1 nanosecond
+	if (iDelayMS <= 0)
+		Spec.it_value.tv_nsec = 1;
+
+	timerfd_settime(g_iTimerFd[iTimer], 0, &Spec, NULL);
+} // void func, no return value
+
+// Order state machine
+// ..fetches new items when idle, then checks dispenser readiness and
+// ..dispenses items one by one, timing out items that wait too long
+void OnOrderTimer()
+{
+	// Do we have no new item list? Or do we have no remaining-items?
+	if (!g_pNewItemList || !g_pListItem)
+	{
+		// Fetch dispense-list from local cloud on the worker
+		// ..OnOrdersFetched takes it from there [timer stays idle till then]
+		if (!g_bFetchOutstanding)
+		{
+			DoLog("Reactor:: Getting new items from LocalCloud", 5);
+
+			FreeItemList();
+			g_bFetchOutstanding = TRUE;
+
+			pthread_mutex_lock(&g_reactorWorkLock);
+			g_bFetchRequested = TRUE;
+			pthread_cond_broadcast(&g_reactorWorkCond);
+			pthread_mutex_unlock(&g_reactorWorkLock);
+		}
+		return;
+	}
+
+	// Read the dispenser ready-var
+	BOOL bReady = FALSE;
+	if (!ReadBool(&g_OrderPLC, g_CompInfo.pszDispenseReadinessVar, &bReady))
+	{
+		// No result - retry later
+		ArmTimer(ORDERTIMER, REACTORORDERPOLLMS);
+		return;
+	}
+
+	// Ready? [and the previous item written - until then the PLC may
+	// ..not have dropped its ready flag for it yet]
+	if (bReady && !IsOrderWritePending())
+	{
+		DoLog("Dispenser ready; sending item", 1);
+
+		// Send item from list + move current-item fwd
+		DispenseItemFromList(g_pListItem);
+		g_pListItem = g_pNewItemList[++g_iItemIdx];
+		g_ttReadyWaitStart = 0;
+
+		// Give the PLC time to drop its ready flag before the next item
+		ArmTimer(ORDERTIMER, REACTORDISPENSEGAPMS);
+		return;
+	}
+
+	/// Not ready - have we been waiting for readiness too long?
+	if (!g_ttReadyWaitStart)
+		time(&g_ttReadyWaitStart);
+
+	if (difftime(time(NULL), g_ttReadyWaitStart) > ITEMREADINESSTIMEOUT)
+	{
+		// Expire this item
+		char szMsg[1024] = {0};
+		sprintf(szMsg, "{Reactor} Item readiness timeout DispenseID [%s] OrderStub [%s]", g_pListItem->szDispenseID, g_pListItem->szOrderStub);
+		DoLog(szMsg, 2);
+
+		// Post timeout to LC
+		PostItemStatusToLocalCloud(g_pListItem->szOrderStub, g_pListItem->szDispenseID, TIMEOUT);
+
+		// Move current-item fwd - remaining items keep the wait start
+		// ..so they get timed out also
+		g_pListItem = g_pNewItemList[++g_iItemIdx];
+		ArmTimer(ORDERTIMER, 0);
+		return;
+	}
+
+	DoLog("Reactor:: [item waiting to dispense]", 5);
+
+	// Check again soon
+	ArmTimer(ORDERTIMER, REACTORREADYPOLLMS);
+} // void func, no return value
+
+// New order list from the fetch worker [its eventfd is readable]
+// ..starts dispensing it, or checks again later if there is nothing to dispense
+void OnOrdersFetched()
+{
+	// Clear the event
+	uint64_t u64Events;
+	if (read(g_iOrderFetchFd, &u64Events, sizeof(u64Events)) != sizeof(u64Events))
+		return;
+
+	pthread_mutex_lock(&g_reactorWorkLock);
+	pItemDispenseData *pList = g_pFetchedList;
+	g_pFetchedList = NULL;
+	pthread_mutex_unlock(&g_reactorWorkLock);
+
+	g_bFetchOutstanding = FALSE;
+	g_pNewItemList = pList;
+	g_pListItem = g_pNewItemList ? g_pNewItemList[0] : NULL;
+	g_iItemIdx = 0;
+	g_ttReadyWaitStart = 0;
+
+	// Nothing to dispense? Check again later
+	if (!g_pListItem)
+	{
+		ArmTimer(ORDERTIMER, REACTORORDERPOLLMS);
+		return;
+	}
+
+	DoLog("Reactor:: There is a new item to dispense", 4);
+	ArmTimer(ORDERTIMER, 0);
+} // void func, no return value
+
+// Machine state (stage) poll
+void OnStageTimer()
+{
+	// Updates the item-status-list with any updates to item-stage
+	ProcessMachineStateData();
+
+	ArmTimer(STAGETIMER, REACTORSTAGEPOLLMS);
+} // void func, no return value
+
+// Dispense timeout sweep - once a second
+void OnTimeoutTimer()
+{
+	CheckItemsForTimeouts();
+
+	ArmTimer(TIMEOUTTIMER, 1000);
+} // void func, no return value
+
+// Scan state machine
+// ..sync mode reads barcodes back-to-back while new data keeps arriving
+void OnScanTimer()
+{
+	BOOL bComplete = FALSE;
+
+	switch (g_iScanState)
+	{
+		case SCANIDLE:
+			// Scan started?
+			if (!GetScanStatus(&g_ScanPLC))
+				break;
+
+			// Log scan start + inform local cloud
+			BeginScan(&g_ScanResults, g_CfgInfo.bAsyncScan ? "Async" : "Sync");
+			g_iScanState = g_CfgInfo.bAsyncScan ? SCANWAITCOMPLETE : SCANREADING;
+			ArmTimer(SCANTIMER, 0);
+			return;
+
+		case SCANWAITCOMPLETE:
+			// Async scan complete bit set?
+			if (!ReadBool(&g_ScanPLC, g_CompInfo.pszAsyncScanCompleteVar, &bComplete) || !bComplete)
+				break;
+
+			// Scan is complete, read the barcode array
+			ReadAsyncScanResults(&g_ScanResults);
+			FinishReactorScan();
+
+			g_iScanState = SCANWAITRESET;
+			g_iScanResetWait = 0;
+			break;
+
+		case SCANREADING:
+		{
+			// Read a barcode + slot number
+			BOOL bNewData = ReadSyncScanData(&g_ScanResults);
+
+			// New data? Read again straight away, checking the complete bit
+			// ..only every SYNCSCANCHECKREADS reads
+			if (bNewData && (g_ScanResults.iSyncReads % SYNCSCANCHECKREADS) && g_ScanResults.iNumScannedItems < g_ScanResults.iMaxItems)
+			{
+				ArmTimer(SCANTIMER, 0);
+				return;
+			}
+
+			// Not complete yet? New data - read again straight away, else back off
+			// ..[short at first - the next barcode is usually due within ms]
+			if ((!ReadBool(&g_ScanPLC, g_CompInfo.pszSyncScanCompleteVar, &bComplete) || !bComplete) \
+				&& g_ScanResults.iNumScannedItems < g_ScanResults.iMaxItems)
+			{
+				ArmTimer(SCANTIMER, SyncScanBackoffMS(&g_ScanResults, bNewData));
+				return;
+			}
+
+			// Scan complete
+			FinishReactorScan();
+
+			g_iScanState = SCANWAITRESET;
+			g_iScanResetWait = 0;
+			break;
+		}
+
+		default:
+			// Wait until scan-vars reset by PLC (as they may remain true for a while)
+			if (!GetScanStatus(&g_ScanPLC))
+				g_iScanState = SCANIDLE;
+			else if ((++g_iScanResetWait % 20) == 0)
+				DoLog("Reactor:: Delay waiting for scan signals to reset to 0", 2);
+	} // end scan state switch
+
+	ArmTimer(SCANTIMER, REACTORSCANPOLLMS);
+} // void func, no return value
+
+// Probes a PLC session whose socket turned readable while no request
+// ..was outstanding (PLC closed the connection) - the read error
+// ..handling reconnects it
+// Params: PLC connection, [out] earliest time of next probe
+void ProbePLC(pPLCConnection pConn, time_t *pttNextProbe)
+{
+	char szMsg[1024] = {0};
+	sprintf(szMsg, "Reactor:: %s socket readable while idle, probing", pConn->szName);
+	DoLog(szMsg, 2);
+
+	BOOL bAlwaysON;
+	ReadBool(pConn, g_pTagSet->pszAlwaysOnVar, &bAlwaysON);
+
+	// Dont watch this session's socket again for a second
+	*pttNextProbe = time(NULL) + 1;
+} // void func, no return value
+
+// Cleans up the current new-item list
+void FreeItemList()
+{
+	if (g_pNewItemList)
+	{
+		// Cleanup the pointers in array
+		for (int i = 0; g_pNewItemList[i] != NULL; i++)
+			delete g_pNewItemList[i];
+
+		// Cleanup the array itself
+		delete []g_pNewItemList;
+	}
+
+	g_pNewItemList = NULL;
+	g_pListItem = NULL;
+} // void func, no return value
+
+// Updates local stock from the scan results and posts total stock
+// ..to LocalCloud on the stock post worker, so an unreachable LocalCloud
+// ..does not stall the event loop
+void FinishReactorScan()
+{
+	LogScanThroughput(&g_ScanResults);
+
+	// Update local stock tables
+	UpdateDispenserStock(g_ScanResults.iSlotNumArray, g_ScanResults.szBarCodeArray, g_ScanResults.iNumScannedItems);
+
+	// Post is built from the stock table when it runs - one more post
+	// ..covers any number of scans finished meanwhile
+	pthread_mutex_lock(&g_reactorWorkLock);
+	g_bStockPostRequested = TRUE;
+	pthread_cond_broadcast(&g_reactorWorkCond);
+	pthread_mutex_unlock(&g_reactorWorkLock);
+} // void func, no return value
+
+// Starts the order fetch + stock post workers and the fetch eventfd
+void StartReactorWorkers()
+{
+	g_iOrderFetchFd = eventfd(0, EFD_NONBLOCK);
+	if (g_iOrderFetchFd == -1)
+	{
+		DoLog("Reactor:: eventfd failed!", 1);
+		exit(1);
+	}
+
+	pthread_t tFetch, tPost;
+	if (pthread_create(&tFetch, NULL, &OrderFetchWorker, NULL) != 0 || pthread_create(&tPost, NULL, &StockPostWorker, NULL) != 0)
+	{
+		DoLog("Reactor:: Unable to start LocalCloud worker threads!", 1);
+		exit(1);
+	}
+	pthread_detach(tFetch);
+	pthread_detach(tPost);
+} // void func, no return value
+
+// Order fetch worker
+// ..fetches the order queue when asked, hands the list back through the eventfd
+void *OrderFetchWorker(void *pArg)
+{
+	pthread_mutex_lock(&g_reactorWorkLock);
+
+	while (!g_bAppDone)
+	{
+		if (!g_bFetchRequested)
+		{
+			pthread_cond_wait(&g_reactorWorkCond, &g_reactorWorkLock);
+			continue;
+		}
+		g_bFetchRequested = FALSE;
+		pthread_mutex_unlock(&g_reactorWorkLock);
+
+		pItemDispenseData *pList = GetNewItemsFromLocalCloud();
+
+		pthread_mutex_lock(&g_reactorWorkLock);
+		g_pFetchedList = pList;
+
+		uint64_t u64Event = 1;
+		if (write(g_iOrderFetchFd, &u64Event, sizeof(u64Event)) != sizeof(u64Event))
+			DoLog("Reactor:: Unable to signal fetched orders", 1);
+	}
+
+	pthread_mutex_unlock(&g_reactorWorkLock);
+	return NULL;
+} // end of order fetch worker
+
+// Stock post worker
+// ..one post at a time (the post retries until LocalCloud takes it), scans
+// ..finished meanwhile are coalesced into the next post
+void *StockPostWorker(void *pArg)
+{
+	pthread_mutex_lock(&g_reactorWorkLock);
+
+	while (!g_bAppDone)
+	{
+		if (!g_bStockPostRequested)
+		{
+			pthread_cond_wait(&g_reactorWorkCond, &g_reactorWorkLock);
+			continue;
+		}
+		g_bStockPostRequested = FALSE;
+		pthread_mutex_unlock(&g_reactorWorkLock);
+
+		PostTotalStockToLocalCloud();
+
+		pthread_mutex_lock(&g_reactorWorkLock);
+	}
+
+	pthread_mutex_unlock(&g_reactorWorkLock);
+	return NULL;
+} // end of stock post worker
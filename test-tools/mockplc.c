@@ -0,0 +1,864 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "plc.h"
+#include "PLCVariables.h"
+
+/// Mock PLCIO library
+/// Stands in for libplc + libplccip so PLCHandler can run without a PLC:
+/// ..make clean; make plc MOCKPLC=1
+/// Implements the plc.h calls the service uses over an in-memory tag table
+/// ..(ControlLogix + MicroLogix names from PLCVariables.h, others are created
+/// ..as 0 on first use), and plays the machine:
+/// - an order written to Disp_New_Order / ST9:0.LEN makes the dispenser busy
+///   ..(ready flag 0) for MOCKPLC_DISPENSEMS, then walks the item through
+///   ..stages 1 to 9, one stage every MOCKPLC_STAGEMS (microwaves round robin)
+/// - every call takes MOCKPLC_LATENCYUS +/- MOCKPLC_JITTERUS, and fails with
+///   ..a timeout / COMM error (session stays dead until reopened) with
+///   ..MOCKPLC_TIMEOUTPCT / MOCKPLC_COMMERRPCT percent probability
+/// Time runs MOCKPLC_SPEED times faster than real time: the mock also provides
+/// ..sleep(), usleep() and time() for the binary, so the service's own sleeps
+/// ..speed up with the machine. Only that pacing is accelerated - the thread
+/// ..mode loops. MonotonicUS/MS (clock_gettime), timerfds, select() and curl
+/// ..waits stay in real time: the stall budget, RTT based timeouts, the bad
+/// ..address cool down, reconnect backoff, LocalCloud retry + batch timers,
+/// ..and the whole event loop (PLCEventLoop=1, no speed up at all). A replay
+/// ..at MOCKPLC_SPEED > 1 is a faithful re-run of the thread mode polls only;
+/// ..replay at 1 to re-run those timers / the event loop. Other settings (env):
+/// ..MOCKPLC_BCONOFFSET - order stub offset of the BCON the stages report (2)
+/// ..MOCKPLC_TAGS - file of name=value lines to preset tags
+/// ..MOCKPLC_STRICT=1 - unknown tags are bad addresses instead of 0
+/// ..MOCKPLC_REPORTSECS - simulated seconds between throughput lines on stderr
+/// Replay (MOCKPLC_REPLAY=<file>): instead of the simulated machine, reads
+/// ..return what the real PLC returned in a traffic log recorded by the
+/// ..service (PLCRecord=<file>) - each tag reads as its latest recorded
+/// ..result at the current simulated time (failures included), so stage
+/// ..tracking + scans see the recorded shift at MOCKPLC_SPEED times real
+/// ..time. Writes are accepted but change nothing; tags the log never
+/// ..touched are bad addresses
+
+#define MOCKMAXTAGS 512
+#define MOCKMAXORDERS 1024
+#define MOCKMICS 3
+
+// Traffic log structs - same layout as PLCRecordFileHeader / PLCRecordHeader
+// ..in PLCHandlerService.h
+typedef struct
+{
+  char szMagic[8];
+  int iPLCType;
+  int iSpare;
+  long long llStartUS;
+} MockRecordFileHeader;
+
+typedef struct
+{
+  long long llTimeUS;
+  unsigned char cConn;
+  char cType;
+  unsigned char cNameLen;
+  unsigned char cSpare;
+  short sResult;
+  short sError;
+} MockRecordHeader;
+
+// Replayed read - result at a point in time, chained per tag
+typedef struct
+{
+  long long llTimeUS;
+  short sResult;
+  short sError;
+  char *pData;
+  int iNext;            // Next record of the same tag, -1 = last
+} MockReplayRecord;
+
+// Tag - strings in szValue, bools/ints/words in iValue
+typedef struct
+{
+  char szName[64];
+  char szValue[83];
+  int iValue;
+  int iFirstRecord;     // Replay - first + current record (-1 = none)
+  int iCurRecord;
+} MockTag;
+
+// Order in progress
+typedef struct
+{
+  char szBCON[83];
+  long long llStartUS;  // Simulated time the order was written
+  int iMic;             // Microwave (variant) used for stages 5-7
+  int iStageDone;       // Last stage reported
+  int bMicroLogix;
+} MockOrder;
+
+/// Globals
+// Settings
+double g_dSpeed = 1.0;
+long long g_llLatencyUS = 2000, g_llJitterUS = 1000;
+double g_dTimeoutPct = 0.0, g_dCommErrPct = 0.0;
+long long g_llStageUS = 15000000, g_llDispenseUS = 5000000;
+int g_iBCONOffset = 2;
+int g_bStrict = 0;
+long long g_llReportUS = 60000000;
+
+// Clock - real start (monotonic) + wall clock at start
+long long g_llRealStartUS = 0;
+time_t g_ttWallStart = 0;
+
+// Machine state [guarded by g_mockLock]
+MockTag g_MockTags[MOCKMAXTAGS];
+int g_iMockTagCount = 0;
+MockOrder g_MockOrders[MOCKMAXORDERS];
+int g_iMockOrderCount = 0;
+long long g_llReadyAtUS = 0;
+int g_iNextMic = 0;
+long g_lReads = 0, g_lWrites = 0, g_lFailures = 0;
+int g_iCompleted = 0;
+long long g_llNextReportUS = 0;
+unsigned int g_uSeed = 1;
+pthread_mutex_t g_mockLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Replay state - records (time order), log contents, end of log
+MockReplayRecord *g_pReplay = NULL;
+int g_iReplayCount = 0;
+char *g_pReplayData = NULL;
+long long g_llReplayEndUS = 0;
+int g_bReplay = 0, g_bReplayDone = 0;
+pthread_once_t g_mockOnce = PTHREAD_ONCE_INIT;
+
+// PLCIO globals
+PLC *plc_open_ptr = NULL;
+int j_plcio_open_timeout = 0;
+int j_plcio_ipaddr = 0;
+int j_plcio_logsize = 0;
+char *plcio_version = "mockplc";
+
+// Error storage for failed plc_open
+PLC g_OpenError;
+
+// Mock session data (PLC->pvoid)
+typedef struct
+{
+  int bMicroLogix;
+  int bDead;
+} MockSession;
+
+/// Stage tags [stage][variant] - ControlLogix + MicroLogix
+const char *g_pszStageTags[2][10][MOCKMICS + 1] =
+{
+  {
+    {0}, {0, d1stringBCONPickedItem}, {0, d1stringBCONStagingItem}, {0, d1stringBCONRotaryItem},
+    {0, d1stringBCONPiercingItem},
+    {0, delstringBCONMic1FrontItem, delstringBCONMic2FrontItem, delstringBCONMic3FrontItem},
+    {0, delstringBCONMic1InsideItem, delstringBCONMic2InsideItem, delstringBCONMic3InsideItem},
+    {0, delboolFlagMic1HeatingItem, delboolFlagMic2HeatingItem, delboolFlagMic3HeatingItem},
+    {0, delstringBCONLane1ChangeItem}, {0, delstringBCONLane1EndItem}
+  },
+  {
+    {0}, {0, d1MLstringBCONPickedItem}, {0, d1MLstringBCONStagingItem}, {0, d1MLstringBCONRotaryItem},
+    {0, d1MLstringBCONPiercingItem},
+    {0, delMLstringBCONMic1FrontItem, delMLstringBCONMic2FrontItem, delMLstringBCONMic3FrontItem},
+    {0, delMLstringBCONMic1InsideItem, delMLstringBCONMic2InsideItem, delMLstringBCONMic3InsideItem},
+    {0, delMLboolFlagMic1HeatingItem, delMLboolFlagMic2HeatingItem, delMLboolFlagMic3HeatingItem},
+    {0, delMLstringBCONLane1ChangeItem}, {0, delMLstringBCONLane1EndItem}
+  }
+};
+
+/// Clock
+// Real monotonic time in microseconds
+long long MockRealUS()
+{
+  struct timespec tsNow;
+  clock_gettime(CLOCK_MONOTONIC, &tsNow);
+  return (long long)tsNow.tv_sec * 1000000 + tsNow.tv_nsec / 1000;
+}
+
+// Simulated time since start in microseconds
+long long MockSimUS()
+{
+  return (long long)((MockRealUS() - g_llRealStartUS) * g_dSpeed);
+}
+
+// Sleeps for a simulated duration
+void MockSleepUS(long long llSimUS)
+{
+  long long llRealUS = (long long)(llSimUS / g_dSpeed);
+  struct timespec tsWait;
+
+  if (llRealUS <= 0)
+    return;
+  tsWait.tv_sec = llRealUS / 1000000;
+  tsWait.tv_nsec = (llRealUS % 1000000) * 1000;
+  nanosleep(&tsWait, NULL);
+}
+
+/// Tag table [call with g_mockLock held]
+// Finds a tag, creating it (as 0) if asked
+MockTag *MockFindTag(const char *pszName, int bCreate)
+{
+  for (int i = 0; i < g_iMockTagCount; i++)
+    if (!strcmp(g_MockTags[i].szName, pszName))
+      return &g_MockTags[i];
+
+  if (!bCreate || g_iMockTagCount == MOCKMAXTAGS || strlen(pszName) >= 64)
+    return NULL;
+
+  MockTag *pTag = &g_MockTags[g_iMockTagCount++];
+  memset(pTag, 0, sizeof(MockTag));
+  strcpy(pTag->szName, pszName);
+  pTag->iFirstRecord = pTag->iCurRecord = -1;
+  return pTag;
+}
+
+// Sets a tag (absent MicroLogix tags are " " - skipped)
+void MockSetTag(const char *pszName, const char *pszValue, int iValue)
+{
+  if (!pszName || !pszName[0] || pszName[0] == ' ')
+    return;
+
+  MockTag *pTag = MockFindTag(pszName, 1);
+  if (!pTag)
+    return;
+  if (pszValue)
+    strncpy(pTag->szValue, pszValue, 82);
+  pTag->iValue = iValue;
+}
+
+// Splits a MicroLogix bit address "B3:8/8" into word "B3:8" + bit
+// Returns: bit #, -1 if not a bit address
+int MockSplitBit(const char *pszAddr, char *pszWord)
+{
+  const char *pszSlash = strchr(pszAddr, '/');
+
+  strncpy(pszWord, pszAddr, 63);
+  pszWord[63] = '\0';
+  if (!pszSlash || pszSlash - pszAddr >= 63)
+    return -1;
+
+  pszWord[pszSlash - pszAddr] = '\0';
+  return atoi(pszSlash + 1);
+}
+
+// Gets a bool/int value (bit addresses read a bit of their word)
+int MockGetValue(const char *pszAddr)
+{
+  char szWord[64];
+  int iBit = MockSplitBit(pszAddr, szWord);
+  MockTag *pTag = MockFindTag(iBit == -1 ? pszAddr : szWord, 1);
+
+  if (!pTag)
+    return 0;
+  return iBit == -1 ? pTag->iValue : (pTag->iValue >> iBit) & 1;
+}
+
+// Sets a bool/int value (bit addresses set a bit of their word)
+void MockSetValue(const char *pszAddr, int iValue)
+{
+  char szWord[64];
+
+  if (!pszAddr[0] || pszAddr[0] == ' ')
+    return;
+
+  int iBit = MockSplitBit(pszAddr, szWord);
+  MockTag *pTag = MockFindTag(iBit == -1 ? pszAddr : szWord, 1);
+
+  if (!pTag)
+    return;
+  if (iBit == -1)
+    pTag->iValue = iValue;
+  else if (iValue)
+    pTag->iValue |= (1 << iBit);
+  else
+    pTag->iValue &= ~(1 << iBit);
+}
+
+/// Machine simulation [call with g_mockLock held]
+// Moves orders through their stages + updates dispenser readiness
+void MockAdvance()
+{
+  long long llNow = MockSimUS();
+
+  // Dispenser ready again?
+  int bReady = llNow >= g_llReadyAtUS;
+  MockSetValue(d1boolReadyForOrdering, bReady);
+  MockSetValue(d1MLboolReadyForOrdering, bReady);
+
+  for (int i = 0; i < g_iMockOrderCount; i++)
+  {
+    MockOrder *pOrder = &g_MockOrders[i];
+    if (pOrder->iStageDone >= 9)
+      continue;
+
+    // Stage due now (first stage once the dispenser is done with it)
+    long long llElapsed = llNow - pOrder->llStartUS - g_llDispenseUS;
+    int iStage = llElapsed < 0 ? 0 : 1 + (int)(llElapsed / g_llStageUS);
+    if (iStage > 9)
+      iStage = 9;
+
+    for (int s = pOrder->iStageDone + 1; s <= iStage; s++)
+    {
+      const char **ppszTags = g_pszStageTags[pOrder->bMicroLogix][s];
+      int iVariant = (s >= 5 && s <= 7) ? pOrder->iMic : 1;
+
+      // Heating flag - 0 while heating (as PLCHandler reads it), 1 again after
+      if (s == 7)
+        MockSetValue(ppszTags[iVariant], 0);
+      else
+        MockSetTag(ppszTags[iVariant], pOrder->szBCON, 0);
+      if (s == 8)
+        MockSetValue(g_pszStageTags[pOrder->bMicroLogix][7][pOrder->iMic], 1);
+    }
+    pOrder->iStageDone = iStage;
+
+    if (iStage == 9)
+      g_iCompleted++;
+  }
+
+  // Drop completed orders from the front
+  int iDone = 0;
+  while (iDone < g_iMockOrderCount && g_MockOrders[iDone].iStageDone >= 9)
+    iDone++;
+  if (iDone)
+  {
+    memmove(g_MockOrders, g_MockOrders + iDone, (g_iMockOrderCount - iDone) * sizeof(MockOrder));
+    g_iMockOrderCount -= iDone;
+  }
+
+  // Throughput report
+  if (llNow >= g_llNextReportUS)
+  {
+    fprintf(stderr, "mockplc:: sim %.0f s real %.1f s reads %ld writes %ld failures %ld in progress %d completed %d (%.1f/sim-hour)\n", \
+      llNow / 1e6, (MockRealUS() - g_llRealStartUS) / 1e6, g_lReads, g_lWrites, g_lFailures, g_iMockOrderCount, \
+      g_iCompleted, llNow ? g_iCompleted * 3600e6 / llNow : 0.0);
+    g_llNextReportUS = llNow + g_llReportUS;
+  }
+
+  if (g_bReplay && !g_bReplayDone && llNow > g_llReplayEndUS)
+  {
+    fprintf(stderr, "mockplc:: replay reached end of log (%.0f s) after %.1f s real, reads %ld writes %ld\n", \
+      g_llReplayEndUS / 1e6, (MockRealUS() - g_llRealStartUS) / 1e6, g_lReads, g_lWrites);
+    g_bReplayDone = 1;
+  }
+}
+
+/// Replay [call with g_mockLock held, except MockLoadReplay]
+// Loads a traffic log recorded by the service
+// Returns: 0 if loaded, -1 otherwise (reason on stderr)
+int MockLoadReplay(const char *pszFile)
+{
+  FILE *pFile = fopen(pszFile, "rb");
+  long lSize = 0;
+
+  if (pFile && !fseek(pFile, 0, SEEK_END))
+    lSize = ftell(pFile);
+  if (!pFile || lSize < (long)sizeof(MockRecordFileHeader))
+  {
+    fprintf(stderr, "mockplc:: cant read replay log [%s]\n", pszFile);
+    if (pFile)
+      fclose(pFile);
+    return -1;
+  }
+
+  // Whole log in memory - records point into it
+  g_pReplayData = (char *)malloc(lSize);
+  rewind(pFile);
+  if (!g_pReplayData || fread(g_pReplayData, 1, lSize, pFile) != (size_t)lSize)
+  {
+    fprintf(stderr, "mockplc:: cant read replay log [%s]\n", pszFile);
+    fclose(pFile);
+    return -1;
+  }
+  fclose(pFile);
+
+  MockRecordFileHeader *pHeader = (MockRecordFileHeader *)g_pReplayData;
+  if (memcmp(pHeader->szMagic, "PLCREC01", 8))
+  {
+    fprintf(stderr, "mockplc:: [%s] is not a PLC traffic log\n", pszFile);
+    return -1;
+  }
+
+  // Upper bound on records: every record is atleast a header
+  g_pReplay = (MockReplayRecord *)malloc((lSize / sizeof(MockRecordHeader) + 1) * sizeof(MockReplayRecord));
+  int *piLast = (int *)malloc(MOCKMAXTAGS * sizeof(int));
+  if (!g_pReplay || !piLast)
+    return -1;
+
+  long lPos = sizeof(MockRecordFileHeader);
+  int iWrites = 0;
+  while (lPos + (long)sizeof(MockRecordHeader) <= lSize)
+  {
+    MockRecordHeader Record;
+    char szName[256] = {0};
+
+    memcpy(&Record, g_pReplayData + lPos, sizeof(Record));
+    lPos += sizeof(Record);
+
+    int iDataLen = Record.sResult > 0 ? Record.sResult : 0;
+    if (lPos + Record.cNameLen + iDataLen > lSize)
+      break;  // Cut short (service killed mid write)
+
+    memcpy(szName, g_pReplayData + lPos, Record.cNameLen);
+    lPos += Record.cNameLen;
+    char *pData = g_pReplayData + lPos;
+    lPos += iDataLen;
+
+    // Writes come from the service under test, not the log
+    MockTag *pTag = MockFindTag(szName, 1);
+    if (Record.cType == 'w' || !pTag)
+    {
+      iWrites++;
+      continue;
+    }
+
+    // Chain onto the tag
+    int iRec = g_iReplayCount++;
+    MockReplayRecord *pRec = &g_pReplay[iRec];
+    pRec->llTimeUS = Record.llTimeUS;
+    pRec->sResult = Record.sResult;
+    pRec->sError = Record.sError;
+    pRec->pData = pData;
+    pRec->iNext = -1;
+
+    int iTag = pTag - g_MockTags;
+    if (pTag->iFirstRecord == -1)
+      pTag->iFirstRecord = iRec;
+    else
+      g_pReplay[piLast[iTag]].iNext = iRec;
+    piLast[iTag] = iRec;
+
+    if (Record.llTimeUS > g_llReplayEndUS)
+      g_llReplayEndUS = Record.llTimeUS;
+  }
+  free(piLast);
+
+  int iTags = 0;
+  for (int i = 0; i < g_iMockTagCount; i++)
+    iTags += (g_MockTags[i].iFirstRecord != -1);
+
+  fprintf(stderr, "mockplc:: replaying [%s] - %s, %d reads of %d tags over %.0f s (%d writes skipped)\n", \
+    pszFile, pHeader->iPLCType ? "MicroLogix" : "ControlLogix", g_iReplayCount, iTags, \
+    g_llReplayEndUS / 1e6, iWrites);
+
+  return 0;
+}
+
+// Finds the replayed result of a tag at the current simulated time
+// ..latest record at or before now (first record if none yet)
+// Returns: record, NULL if the log never read this tag
+MockReplayRecord *MockReplayRead(const char *pszAddr)
+{
+  MockTag *pTag = MockFindTag(pszAddr, 0);
+
+  if (!pTag || pTag->iFirstRecord == -1)
+    return NULL;
+
+  long long llNow = MockSimUS();
+  int iRec = pTag->iCurRecord == -1 ? pTag->iFirstRecord : pTag->iCurRecord;
+  while (g_pReplay[iRec].iNext != -1 && g_pReplay[g_pReplay[iRec].iNext].llTimeUS <= llNow)
+    iRec = g_pReplay[iRec].iNext;
+  pTag->iCurRecord = iRec;
+
+  return &g_pReplay[iRec];
+}
+
+// Takes an order stub written by the service
+void MockPlaceOrder(const char *pszStub, int bMicroLogix)
+{
+  if (g_iMockOrderCount == MOCKMAXORDERS || (int)strlen(pszStub) <= g_iBCONOffset)
+    return;
+
+  MockOrder *pOrder = &g_MockOrders[g_iMockOrderCount++];
+  memset(pOrder, 0, sizeof(MockOrder));
+  strncpy(pOrder->szBCON, pszStub + g_iBCONOffset, 82);
+  pOrder->llStartUS = MockSimUS();
+  pOrder->bMicroLogix = bMicroLogix;
+
+  // Next microwave [MicroLogix has 2]
+  pOrder->iMic = 1 + g_iNextMic++ % (bMicroLogix ? 2 : MOCKMICS);
+
+  // Dispenser busy
+  g_llReadyAtUS = pOrder->llStartUS + g_llDispenseUS;
+}
+
+/// Setup
+// Reads a numeric env setting
+double MockEnv(const char *pszName, double dDefault)
+{
+  char *pszVal = getenv(pszName);
+  return (pszVal && pszVal[0]) ? atof(pszVal) : dDefault;
+}
+
+// One-time init - settings, clock, preset tags
+void MockInit()
+{
+  struct timespec tsWall;
+
+  g_dSpeed = MockEnv("MOCKPLC_SPEED", 1.0);
+  if (g_dSpeed <= 0)
+    g_dSpeed = 1.0;
+  g_llLatencyUS = (long long)MockEnv("MOCKPLC_LATENCYUS", 2000);
+  g_llJitterUS = (long long)MockEnv("MOCKPLC_JITTERUS", 1000);
+  g_dTimeoutPct = MockEnv("MOCKPLC_TIMEOUTPCT", 0);
+  g_dCommErrPct = MockEnv("MOCKPLC_COMMERRPCT", 0);
+  g_llStageUS = (long long)(MockEnv("MOCKPLC_STAGEMS", 15000) * 1000);
+  g_llDispenseUS = (long long)(MockEnv("MOCKPLC_DISPENSEMS", 5000) * 1000);
+  g_iBCONOffset = (int)MockEnv("MOCKPLC_BCONOFFSET", 2);
+  g_bStrict = (int)MockEnv("MOCKPLC_STRICT", 0);
+  g_llReportUS = (long long)(MockEnv("MOCKPLC_REPORTSECS", 60) * 1000000);
+  if (g_llStageUS < 1)
+    g_llStageUS = 1;
+
+  g_llRealStartUS = MockRealUS();
+  clock_gettime(CLOCK_REALTIME, &tsWall);
+  g_ttWallStart = tsWall.tv_sec;
+  g_uSeed = (unsigned int)tsWall.tv_nsec;
+
+  // Machine powered on, ready, doors closed, microwaves not heating
+  MockSetValue(gboolPLCPowerON, 1);
+  MockSetValue(gMLboolPLCPowerON, 1);
+  MockSetValue(gboolPLCAlwaysON, 1);
+  MockSetValue(gMLboolPLCAlwaysON, 1);
+  MockSetValue(d1boolDoorClosed, 1);
+  MockSetValue(d1MLboolDoorClosed, 1);
+  for (int b = 0; b < 2; b++)
+    for (int m = 1; m <= MOCKMICS; m++)
+      MockSetValue(g_pszStageTags[b][7][m], 1);
+
+  // Presets from file
+  char *pszFile = getenv("MOCKPLC_TAGS");
+  FILE *pFile = pszFile ? fopen(pszFile, "r") : NULL;
+  if (pFile)
+  {
+    char szLine[256];
+    while (fgets(szLine, sizeof(szLine), pFile))
+    {
+      char *pszEq = strchr(szLine, '=');
+      if (!pszEq || szLine[0] == '#')
+        continue;
+      *pszEq = '\0';
+      pszEq[strcspn(pszEq + 1, "\r\n") + 1] = '\0';
+      MockSetTag(szLine, pszEq + 1, atoi(pszEq + 1));
+      MockSetValue(szLine, atoi(pszEq + 1));
+    }
+    fclose(pFile);
+  }
+
+  // Replay instead of simulating?
+  char *pszReplay = getenv("MOCKPLC_REPLAY");
+  if (pszReplay && pszReplay[0])
+  {
+    if (MockLoadReplay(pszReplay) == -1)
+      exit(1);
+    g_bReplay = 1;
+  }
+
+  fprintf(stderr, "mockplc:: speed %.1fx latency %lld+/-%lld us timeouts %.2f%% comm errors %.2f%% stage %lld ms\n", \
+    g_dSpeed, g_llLatencyUS, g_llJitterUS, g_dTimeoutPct, g_dCommErrPct, g_llStageUS / 1000);
+}
+
+// Sets a PLCIO error on a session
+void MockError(PLC *pPLC, int iError, const char *pszMsg)
+{
+  pPLC->j_error = iError;
+  snprintf(pPLC->ac_errmsg, sizeof(pPLC->ac_errmsg), "%s", pszMsg);
+}
+
+// Simulates the wire for one call: latency, injected timeouts + COMM errors
+// Returns: 0 if the call goes through, -1 (error set) otherwise
+int MockWire(PLC *pPLC, int iTimeoutMS)
+{
+  MockSession *pSession = (MockSession *)pPLC->pvoid;
+
+  pthread_once(&g_mockOnce, MockInit);
+
+  pthread_mutex_lock(&g_mockLock);
+  double dRoll = rand_r(&g_uSeed) * 100.0 / RAND_MAX;
+  long long llDelayUS = g_llLatencyUS + (g_llJitterUS ? rand_r(&g_uSeed) % (2 * g_llJitterUS + 1) - g_llJitterUS : 0);
+  pthread_mutex_unlock(&g_mockLock);
+
+  // Dead session - fails straight away
+  if (pSession->bDead)
+  {
+    g_lFailures++;
+    MockError(pPLC, PLCE_COMM_SEND, "Mock: connection is down");
+    return -1;
+  }
+
+  // Injected timeout - waits the full timeout
+  if (dRoll < g_dTimeoutPct)
+  {
+    g_lFailures++;
+    MockSleepUS((long long)iTimeoutMS * 1000);
+    MockError(pPLC, PLCE_TIMEOUT, "Mock: timeout");
+    return -1;
+  }
+
+  // Injected COMM error - session dies
+  if (dRoll < g_dTimeoutPct + g_dCommErrPct)
+  {
+    g_lFailures++;
+    MockSleepUS(llDelayUS);
+    pSession->bDead = 1;
+    MockError(pPLC, PLCE_COMM_RECV, "Mock: connection reset");
+    return -1;
+  }
+
+  MockSleepUS(llDelayUS > 0 ? llDelayUS : 0);
+  return 0;
+}
+
+// Is this address known? (strict mode)
+int MockKnown(const char *pszAddr)
+{
+  char szWord[64];
+
+  if (!pszAddr[0] || pszAddr[0] == ' ')
+    return 0;
+  if (g_bReplay)
+    return MockReplayRead(pszAddr) != NULL;
+  if (!g_bStrict)
+    return 1;
+  MockSplitBit(pszAddr, szWord);
+  return MockFindTag(szWord, 0) != NULL;
+}
+
+/// PLCIO API
+PLC *plc_open(char *pszIdent)
+{
+  pthread_once(&g_mockOnce, MockInit);
+
+  PLC *pPLC = (PLC *)calloc(1, sizeof(PLC));
+  MockSession *pSession = (MockSession *)calloc(1, sizeof(MockSession));
+  if (!pPLC || !pSession)
+  {
+    free(pPLC);
+    free(pSession);
+    plc_open_ptr = &g_OpenError;
+    MockError(plc_open_ptr, PLCE_NO_MEMORY, "Mock: out of memory");
+    return NULL;
+  }
+
+  pSession->bMicroLogix = !strncmp(pszIdent, "cipmlx", 6);
+  pPLC->pvoid = pSession;
+  pPLC->j_mode = PLC_MASTER;
+
+  // Connect time
+  MockSleepUS(g_llLatencyUS * 3);
+
+  return pPLC;
+}
+
+int plc_close(PLC *pPLC)
+{
+  if (!pPLC)
+    return -1;
+
+  free(pPLC->pvoid);
+  free(pPLC);
+  return 0;
+}
+
+int plc_validaddr(PLC *pPLC, char *pszAddr, int *piSize, int *piDomain, int *piOffset)
+{
+  if (MockWire(pPLC, 1000) == -1)
+    return -1;
+
+  pthread_mutex_lock(&g_mockLock);
+  int bKnown = MockKnown(pszAddr);
+  pthread_mutex_unlock(&g_mockLock);
+
+  if (!bKnown)
+  {
+    MockError(pPLC, PLCE_BAD_ADDRESS, "Mock: no such address");
+    return -1;
+  }
+
+  // Big enough for any of our reads (String82 struct)
+  *piSize = 88;
+  *piDomain = 0;
+  *piOffset = 0;
+  return 0;
+}
+
+int plc_read(PLC *pPLC, int iOp, char *pszAddr, void *pBuf, int iBytes, int iTimeout, char *pszFormat)
+{
+  if (MockWire(pPLC, iTimeout) == -1)
+    return -1;
+
+  pthread_mutex_lock(&g_mockLock);
+  MockAdvance();
+  g_lReads++;
+
+  if (!MockKnown(pszAddr))
+  {
+    pthread_mutex_unlock(&g_mockLock);
+    MockError(pPLC, PLCE_BAD_ADDRESS, "Mock: no such address");
+    return -1;
+  }
+
+  memset(pBuf, 0, iBytes);
+
+  // Replay? What the PLC returned then
+  if (g_bReplay)
+  {
+    MockReplayRecord *pRec = MockReplayRead(pszAddr);
+    short sResult = pRec->sResult, sError = pRec->sError;
+
+    if (sResult >= 0)
+      memcpy(pBuf, pRec->pData, sResult < iBytes ? sResult : iBytes);
+    else
+      g_lFailures++;
+    pthread_mutex_unlock(&g_mockLock);
+
+    if (sResult >= 0)
+      return sResult;
+
+    // Failed then - fail the same way
+    if (sError == PLCE_TIMEOUT)
+      MockSleepUS((long long)iTimeout * 1000);
+    if (sError == PLCE_COMM_SEND || sError == PLCE_COMM_RECV)
+      ((MockSession *)pPLC->pvoid)->bDead = 1;
+    MockError(pPLC, sError, "Mock: replayed failure");
+    return -1;
+  }
+
+  // String? ControlLogix String82 struct, or MicroLogix raw bytes
+  if (pszFormat != PLC_CVT_WORD && pszFormat != PLC_CVT_NONE && !strcmp(pszFormat, "i1c82"))
+  {
+    MockTag *pTag = MockFindTag(pszAddr, 1);
+    if (pTag && iBytes > (int)sizeof(int))
+    {
+      int iLen = strlen(pTag->szValue);
+      memcpy(pBuf, &iLen, sizeof(int));
+      strncpy((char *)pBuf + sizeof(int), pTag->szValue, iBytes - sizeof(int));
+    }
+  }
+  else if (iOp == PLC_RBYTE)
+  {
+    MockTag *pTag = MockFindTag(pszAddr, 1);
+    if (pTag)
+      strncpy((char *)pBuf, pTag->szValue, iBytes);
+  }
+  else
+  {
+    // Bool/int - as many bytes as asked for (1, 2 or 4)
+    int iValue = MockGetValue(pszAddr);
+    if (iBytes == 1)
+      *(char *)pBuf = (char)iValue;
+    else if (iBytes < 4)
+      *(short *)pBuf = (short)iValue;
+    else
+      *(int *)pBuf = iValue;
+  }
+  pthread_mutex_unlock(&g_mockLock);
+
+  return iBytes;
+}
+
+int plc_write(PLC *pPLC, int iOp, char *pszAddr, void *pBuf, int iBytes, int iTimeout, char *pszFormat)
+{
+  MockSession *pSession = (MockSession *)pPLC->pvoid;
+  char szValue[100] = {0};
+
+  if (MockWire(pPLC, iTimeout) == -1)
+    return -1;
+
+  // Decode - ControlLogix String82 struct, or MicroLogix byte swapped words
+  if (pszFormat != PLC_CVT_WORD && pszFormat != PLC_CVT_NONE && !strcmp(pszFormat, "i1c82"))
+    strncpy(szValue, (char *)pBuf + sizeof(int), iBytes - sizeof(int) < 82 ? iBytes - sizeof(int) : 82);
+  else if (iOp == PLC_WBYTE)
+  {
+    char szRaw[100] = {0};
+    memcpy(szRaw, pBuf, iBytes < 98 ? iBytes : 98);
+    for (int j = 2; j + 1 < 98; j += 2)
+    {
+      szValue[j - 2] = szRaw[j + 1];
+      szValue[j - 1] = szRaw[j];
+    }
+    szValue[82] = '\0';
+  }
+
+  pthread_mutex_lock(&g_mockLock);
+  g_lWrites++;
+  if (iOp == PLC_WBYTE || (pszFormat != PLC_CVT_WORD && pszFormat != PLC_CVT_NONE && !strcmp(pszFormat, "i1c82")))
+  {
+    MockSetTag(pszAddr, szValue, 0);
+
+    // An order?
+    if (!g_bReplay && (!strcmp(pszAddr, d1stringPlaceOrder) || !strcmp(pszAddr, d1MLstringPlaceOrder)))
+      MockPlaceOrder(szValue, pSession->bMicroLogix);
+  }
+  else
+    MockSetValue(pszAddr, iBytes == 1 ? *(char *)pBuf : *(short *)pBuf);
+  MockAdvance();
+  pthread_mutex_unlock(&g_mockLock);
+
+  return iBytes;
+}
+
+// No unsolicited traffic - every receive times out
+int plc_receive(PLC *pPLC, int iOp, PLCSLAVE *pSlave, void *pBuf, int iBytes, int iTimeout)
+{
+  pthread_once(&g_mockOnce, MockInit);
+
+  MockSleepUS((long long)iTimeout * 1000);
+  MockError(pPLC, PLCE_TIMEOUT, "Mock: no unsolicited data");
+  return -1;
+}
+
+int plc_reply(PLC *pPLC, int iOp, void *pBuf, int iBytes, int iTimeout)
+{
+  MockError(pPLC, PLCE_INVALID_REPLY, "Mock: nothing to reply to");
+  return -1;
+}
+
+// No sockets to watch
+int plc_fd_set(PLC *pPLC, fd_set *pReadSet, int *piMaxFd)
+{
+  return 0;
+}
+
+int plc_fd_isset(PLC *pPLC, fd_set *pReadSet)
+{
+  return 0;
+}
+
+void plc_print_error(PLC *pPLC, const char *pszString)
+{
+  if (!pPLC)
+    pPLC = plc_open_ptr;
+  fprintf(stderr, "%s: %s\n", pszString, pPLC ? pPLC->ac_errmsg : "Mock: unknown error");
+}
+
+void plc_log_init(const char *pszBuf)
+{
+}
+
+/// Simulated time for the service's own sleeps + timestamps
+unsigned int sleep(unsigned int uSeconds)
+{
+  pthread_once(&g_mockOnce, MockInit);
+  MockSleepUS((long long)uSeconds * 1000000);
+  return 0;
+}
+
+int usleep(useconds_t uMicroseconds)
+{
+  pthread_once(&g_mockOnce, MockInit);
+  MockSleepUS(uMicroseconds);
+  return 0;
+}
+
+time_t time(time_t *pttOut)
+{
+  pthread_once(&g_mockOnce, MockInit);
+
+  time_t ttNow = g_ttWallStart + (time_t)(MockSimUS() / 1000000);
+  if (pttOut)
+    *pttOut = ttNow;
+  return ttNow;
+}
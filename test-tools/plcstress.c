@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "plc.h"
+
+/// PLCIO re-entrancy stress test
+/// Opens two PLC sessions (like OrderPLC + ScanPLC in PLCHandler) and hammers
+/// ..a String82 tag from one thread per session, first with one global lock
+/// ..around every plc_read (old PLCHandler behaviour), then with one lock
+/// ..per session (current PLCHandler behaviour).
+/// If the per-session run shows errors or corrupted data that the global-lock
+/// ..run doesn't, PLCIO is not re-entrant across handles and PLCHandler must
+/// ..be built with -DPLCIO_GLOBAL_LOCK.
+///
+/// Build: gcc -o plcstress plcstress.c -I.. -L/usr/local/cti/lib -lplc -lplccip -lpthread
+/// Usage: ./plcstress [PLC IP] [String82 tag] [seconds per run] [1 = MicroLogix]
+
+// String82 read struct (ControlLogix)
+struct ReadStringStruct
+{
+  int iLen;
+  char szData[83];
+};
+
+// Per-session worker data
+typedef struct
+{
+  PLC *pPLC;
+  pthread_mutex_t *pLock;
+  long lReads;
+  long lErrors;
+  long lMismatches;
+} StressWorker;
+
+/// Globals
+char *g_pszTag = "Dispenser:Disp_Barcode_Data_1";
+int g_iSeconds = 10;
+bool g_bMicroLogix = false;
+volatile bool g_bStop = false;
+
+// Value of the tag read once before the runs (reference for corruption checks)
+char g_szExpected[83] = {0};
+
+// Reads the tag once into the passed buffer
+// Returns: plc_read result
+int ReadTag(PLC *pPLC, char *pszOut)
+{
+  struct ReadStringStruct ReadString;
+  char szRaw[83] = {0};
+  int iRes;
+
+  memset(&ReadString, 0, sizeof(ReadString));
+  if (!g_bMicroLogix)
+  {
+    iRes = plc_read(pPLC, 0, g_pszTag, (void *)&ReadString, sizeof(ReadString), 1000, "i1c82");
+    if (iRes > 0)
+      strncpy(pszOut, ReadString.szData, 82);
+  }
+  else
+  {
+    iRes = plc_read(pPLC, PLC_RBYTE, g_pszTag, (void *)szRaw, 82, 1000, PLC_CVT_NONE);
+    if (iRes > 0)
+      strncpy(pszOut, szRaw, 82);
+  }
+
+  return iRes;
+}
+
+// Worker thread - reads until told to stop
+void *StressWorkerFunc(void *pArg)
+{
+  StressWorker *pWorker = (StressWorker *)pArg;
+  char szVal[83];
+
+  while (!g_bStop)
+  {
+    memset(szVal, 0, sizeof(szVal));
+
+    pthread_mutex_lock(pWorker->pLock);
+    int iRes = ReadTag(pWorker->pPLC, szVal);
+    pthread_mutex_unlock(pWorker->pLock);
+
+    pWorker->lReads++;
+    if (iRes == -1)
+    {
+      pWorker->lErrors++;
+      plc_print_error(pWorker->pPLC, "plc_read");
+    }
+    else if (strcmp(szVal, g_szExpected))
+      pWorker->lMismatches++;
+  }
+
+  return NULL;
+}
+
+// Runs both sessions in parallel for g_iSeconds
+// Params: the two sessions, TRUE to share one lock between them
+void RunStress(PLC *pPLC1, PLC *pPLC2, bool bSharedLock)
+{
+  pthread_mutex_t Lock1, Lock2;
+  pthread_t t1, t2;
+  StressWorker W1 = {0}, W2 = {0};
+
+  pthread_mutex_init(&Lock1, NULL);
+  pthread_mutex_init(&Lock2, NULL);
+
+  W1.pPLC = pPLC1;
+  W1.pLock = &Lock1;
+  W2.pPLC = pPLC2;
+  W2.pLock = bSharedLock ? &Lock1 : &Lock2;
+
+  g_bStop = false;
+  pthread_create(&t1, NULL, StressWorkerFunc, &W1);
+  pthread_create(&t2, NULL, StressWorkerFunc, &W2);
+  sleep(g_iSeconds);
+  g_bStop = true;
+  pthread_join(t1, NULL);
+  pthread_join(t2, NULL);
+
+  printf("%-12s reads/s: %7.1f  errors: %ld  mismatches: %ld\n",
+    bSharedLock ? "global lock" : "per-session",
+    (double)(W1.lReads + W2.lReads) / g_iSeconds,
+    W1.lErrors + W2.lErrors, W1.lMismatches + W2.lMismatches);
+
+  pthread_mutex_destroy(&Lock1);
+  pthread_mutex_destroy(&Lock2);
+}
+
+// Opens a session, retrying until it succeeds
+PLC *OpenPLC(const char *pszIP)
+{
+  char szPLCString[1024];
+  PLC *pPLC;
+
+  snprintf(szPLCString, 1024, g_bMicroLogix ? "cipmlx %s" : "cip %s", pszIP);
+  while (!(pPLC = plc_open(szPLCString)))
+  {
+    plc_print_error(pPLC, "plc_open");
+    sleep(10);
+  }
+
+  return pPLC;
+}
+
+// Main Func of program
+int main(int argc, char **argv)
+{
+  char *pszIP = "192.168.1.80";
+
+  if (argc > 1)
+    pszIP = argv[1];
+  if (argc > 2)
+    g_pszTag = argv[2];
+  if (argc > 3)
+    g_iSeconds = atoi(argv[3]);
+  if (argc > 4)
+    g_bMicroLogix = atoi(argv[4]) == 1;
+
+  // Two sessions, like PLCHandler's OrderPLC + ScanPLC
+  PLC *pPLC1 = OpenPLC(pszIP);
+  PLC *pPLC2 = OpenPLC(pszIP);
+
+  // Reference value (tag must not change during the test)
+  if (ReadTag(pPLC1, g_szExpected) == -1)
+  {
+    plc_print_error(pPLC1, "plc_read");
+    return 1;
+  }
+  printf("Tag [%s] = [%s], %d seconds per run\n", g_pszTag, g_szExpected, g_iSeconds);
+
+  RunStress(pPLC1, pPLC2, true);
+  RunStress(pPLC1, pPLC2, false);
+
+  plc_close(pPLC1);
+  plc_close(pPLC2);
+
+  return 0;
+}
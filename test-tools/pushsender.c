@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "plc.h"
+
+/// PLC stage push stand-in
+/// Plays the PLC side of PLCHandler's push mode (PLCPushListen) on loopback:
+/// ..opens a master session to the handler's slave session and sends the
+/// ..unsolicited register writes the PLC would send as an item moves through
+/// ..the stages (file 50, element stage * 10 + variant, payload = BCON)
+/// Walks one dispense id through stages 1 to 9 (variant 1), one push per
+/// ..stage, and prints each push's round trip time - the handler log shows
+/// ..the stage updates ("Updated DispenseID ...") as they arrive
+///
+/// Build: gcc -o pushsender pushsender.c -I.. -L/usr/local/cti/lib -lplc -lplccip
+/// Usage: ./pushsender [PLCIO open string] [Dispense ID] [ms between stages]
+/// e.g.   ./pushsender "cip 127.0.0.1" 123456 500
+
+#define PUSHSTAGEFILE 50
+#define STAGE7 7
+
+// Sends one stage push
+// Returns: plc_write result
+int SendPush(PLC *pPLC, int iStage, int iVariant, char *pszPayload)
+{
+  char szAddr[32];
+
+  snprintf(szAddr, sizeof(szAddr), "N%d:%d", PUSHSTAGEFILE, iStage * 10 + iVariant);
+
+  return plc_write(pPLC, PLC_WBYTE, szAddr, (void *)pszPayload, 82, 1000, PLC_CVT_NONE);
+}
+
+// Main Func of program
+int main(int argc, char **argv)
+{
+  char *pszOpen = "cip 127.0.0.1";
+  char *pszDispenseID = "123456";
+  int iDelayMS = 500;
+
+  if (argc > 1)
+    pszOpen = argv[1];
+  if (argc > 2)
+    pszDispenseID = argv[2];
+  if (argc > 3)
+    iDelayMS = atoi(argv[3]);
+
+  PLC *pPLC = plc_open(pszOpen);
+  if (!pPLC)
+  {
+    plc_print_error(pPLC, "plc_open");
+    return 1;
+  }
+
+  for (int iStage = 1; iStage <= 9; iStage++)
+  {
+    char szPayload[83] = {0};
+
+    // BCON = 24 char barcode, 10 char spare, dispense id @ char 34
+    // ..STAGE7 is the heating flag instead (0 = heating)
+    if (iStage != STAGE7)
+      snprintf(szPayload, sizeof(szPayload), "%-34s%-6s", "TESTBARCODE0000000000000", pszDispenseID);
+
+    struct timespec tsStart, tsEnd;
+    clock_gettime(CLOCK_MONOTONIC, &tsStart);
+    int iRes = SendPush(pPLC, iStage, 1, szPayload);
+    clock_gettime(CLOCK_MONOTONIC, &tsEnd);
+
+    if (iRes == -1)
+      plc_print_error(pPLC, "plc_write");
+    else
+      printf("Stage %d pushed in %.2f ms\n", iStage, \
+        (tsEnd.tv_sec - tsStart.tv_sec) * 1000.0 + (tsEnd.tv_nsec - tsStart.tv_nsec) / 1000000.0);
+
+    usleep(iDelayMS * 1000);
+  }
+
+  plc_close(pPLC);
+
+  return 0;
+}